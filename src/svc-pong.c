@@ -59,16 +59,17 @@ struct __ping_s {
 
 /* packing service */
 #if !defined UNSERMON_DSO
-static union {
+union __ping_u {
 	struct __ping_s wire;
 	char buf[64];
-} __msg;
+};
 
-#define MAX_HNZ		((uint8_t)(sizeof(__msg) - 6U))
+#define MAX_HNZ		((uint8_t)(sizeof(union __ping_u) - 6U))
 
 int
 ud_pack_ping(ud_sock_t sock, const struct svc_ping_s msg[static 1])
 {
+	union __ping_u m;
 	ud_svc_t cmd;
 
 	switch (msg->what) {
@@ -83,17 +84,17 @@ ud_pack_ping(ud_sock_t sock, const struct svc_ping_s msg[static 1])
 	}
 
 	/* 4 bytes for the pid */
-	__msg.wire.pid = htobe32((uint32_t)msg->pid);
-	if ((__msg.wire.hnz = (uint8_t)msg->hostnlen) > MAX_HNZ) {
-		__msg.wire.hnz = sizeof(__msg) - 5;
+	m.wire.pid = htobe32((uint32_t)msg->pid);
+	if ((m.wire.hnz = (uint8_t)msg->hostnlen) > MAX_HNZ) {
+		m.wire.hnz = sizeof(m) - 5;
 	}
-	memcpy(__msg.wire.hn, msg->hostname, __msg.wire.hnz);
+	memcpy(m.wire.hn, msg->hostname, m.wire.hnz);
 
 	(void)ud_flush(sock);
 	return ud_pack_cmsg(sock, (struct ud_msg_s){
 			.svc = cmd,
-			.data = __msg.buf,
-			.dlen = __msg.wire.hn - __msg.buf + __msg.wire.hnz,
+			.data = m.buf,
+			.dlen = m.wire.hn - m.buf + m.wire.hnz,
 		});
 }
 
@@ -101,18 +102,18 @@ int
 ud_pack_pong(ud_sock_t sock, unsigned int pongp)
 {
 /* PINGs can't be packed. */
-	static struct svc_ping_s po;
-
-	if (UNLIKELY(po.hostnlen == 0U)) {
-		static char hname[_POSIX_HOST_NAME_MAX];
-		if (gethostname(hname, sizeof(hname)) < 0) {
-			return -1;
-		}
-		hname[_POSIX_HOST_NAME_MAX - 1] = '\0';
-		po.hostnlen = strlen(hname);
-		po.hostname = hname;
-		po.pid = getpid();
+	char hname[_POSIX_HOST_NAME_MAX];
+	struct svc_ping_s po;
+
+	/* pongs are rare enough to ask every time, and this way
+	 * there's nothing to share between threads */
+	if (gethostname(hname, sizeof(hname)) < 0) {
+		return -1;
 	}
+	hname[_POSIX_HOST_NAME_MAX - 1] = '\0';
+	po.hostnlen = strlen(hname);
+	po.hostname = hname;
+	po.pid = getpid();
 
 	if (pongp) {
 		po.what = SVC_PING_PONG;
@@ -125,27 +126,29 @@ ud_pack_pong(ud_sock_t sock, unsigned int pongp)
 int
 ud_chck_ping(struct svc_ping_s *restrict tgt, ud_sock_t sock)
 {
+/* the hostname handed out lives in a per-thread buffer */
+	static __thread union __ping_u m;
 	struct ud_msg_s msg[1];
 
 	if (ud_chck_msg(msg, sock) < 0) {
 		return -1;
-	} else if (msg->dlen > sizeof(__msg)) {
+	} else if (msg->dlen > sizeof(m)) {
 		return -1;
 	} else if ((msg->svc & ~0x01) != UD_CTRL_SVC(UD_SVC_PING)) {
 		/* not a PING nor a PONG */
 		return -1;
 	}
-	/* otherwise memcpy to static buffer for inspection */
-	memcpy(__msg.buf, msg->data, msg->dlen);
-	if (__msg.wire.hnz > MAX_HNZ) {
+	/* otherwise memcpy to our buffer for inspection */
+	memcpy(m.buf, msg->data, msg->dlen);
+	if (m.wire.hnz > MAX_HNZ) {
 		return -1;
 	}
-	tgt->hostnlen = __msg.wire.hnz;
-	tgt->hostname = __msg.wire.hn;
-	tgt->pid = be32toh(__msg.wire.pid);
+	tgt->hostnlen = m.wire.hnz;
+	tgt->hostname = m.wire.hn;
+	tgt->pid = be32toh(m.wire.pid);
 	tgt->what = msg->svc & 0x01 ? SVC_PING_PONG : SVC_PING_PING;
 	/* as a service, \nul terminate the hostname */
-	__msg.wire.hn[__msg.wire.hnz] = '\0';
+	m.wire.hn[m.wire.hnz] = '\0';
 	return 0;
 }
 #endif	/* !UNSERMON_DSO */
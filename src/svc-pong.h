@@ -118,7 +118,8 @@ extern int ud_pack_ping(ud_sock_t sock, const struct svc_ping_s msg[static 1]);
 extern int ud_pack_pong(ud_sock_t sock, unsigned int pongp);
 
 /**
- * Unpack a message assumed to be a svc_ping_s object FROM S into TGT. */
+ * Unpack a message assumed to be a svc_ping_s object FROM S into TGT.
+ * The hostname in TGT is valid until the next call in the same thread. */
 extern int ud_chck_ping(struct svc_ping_s *restrict tgt, ud_sock_t sock);
 
 /* for unsermon */
@@ -0,0 +1,338 @@
+/*** ud-crc32c.h -- castagnoli checksums, in hardware where possible
+ *
+ * Copyright (C) 2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@ga-group.nl>
+ *
+ * This file is part of unserding.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if !defined INCLUDED_ud_crc32c_h_
+#define INCLUDED_ud_crc32c_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined __x86_64__ && defined __GNUC__
+/* sse4.2 has crc32 insns, pclmul to combine them, avx512 with vpclmul
+ * folds whole cache lines at once, we check at runtime */
+# define HAVE_CRC32C_SSE42
+# include <immintrin.h>
+#elif defined __ARM_FEATURE_CRC32
+# include <arm_acle.h>
+#endif	/* __x86_64__ && __GNUC__ || __ARM_FEATURE_CRC32 */
+
+/* reflected polynomial 0x1edc6f41, for the byte-wise fallback */
+static const uint32_t __crc32c_tbl[256U] = {
+	0x00000000U, 0xf26b8303U, 0xe13b70f7U, 0x1350f3f4U,
+	0xc79a971fU, 0x35f1141cU, 0x26a1e7e8U, 0xd4ca64ebU,
+	0x8ad958cfU, 0x78b2dbccU, 0x6be22838U, 0x9989ab3bU,
+	0x4d43cfd0U, 0xbf284cd3U, 0xac78bf27U, 0x5e133c24U,
+	0x105ec76fU, 0xe235446cU, 0xf165b798U, 0x030e349bU,
+	0xd7c45070U, 0x25afd373U, 0x36ff2087U, 0xc494a384U,
+	0x9a879fa0U, 0x68ec1ca3U, 0x7bbcef57U, 0x89d76c54U,
+	0x5d1d08bfU, 0xaf768bbcU, 0xbc267848U, 0x4e4dfb4bU,
+	0x20bd8edeU, 0xd2d60dddU, 0xc186fe29U, 0x33ed7d2aU,
+	0xe72719c1U, 0x154c9ac2U, 0x061c6936U, 0xf477ea35U,
+	0xaa64d611U, 0x580f5512U, 0x4b5fa6e6U, 0xb93425e5U,
+	0x6dfe410eU, 0x9f95c20dU, 0x8cc531f9U, 0x7eaeb2faU,
+	0x30e349b1U, 0xc288cab2U, 0xd1d83946U, 0x23b3ba45U,
+	0xf779deaeU, 0x05125dadU, 0x1642ae59U, 0xe4292d5aU,
+	0xba3a117eU, 0x4851927dU, 0x5b016189U, 0xa96ae28aU,
+	0x7da08661U, 0x8fcb0562U, 0x9c9bf696U, 0x6ef07595U,
+	0x417b1dbcU, 0xb3109ebfU, 0xa0406d4bU, 0x522bee48U,
+	0x86e18aa3U, 0x748a09a0U, 0x67dafa54U, 0x95b17957U,
+	0xcba24573U, 0x39c9c670U, 0x2a993584U, 0xd8f2b687U,
+	0x0c38d26cU, 0xfe53516fU, 0xed03a29bU, 0x1f682198U,
+	0x5125dad3U, 0xa34e59d0U, 0xb01eaa24U, 0x42752927U,
+	0x96bf4dccU, 0x64d4cecfU, 0x77843d3bU, 0x85efbe38U,
+	0xdbfc821cU, 0x2997011fU, 0x3ac7f2ebU, 0xc8ac71e8U,
+	0x1c661503U, 0xee0d9600U, 0xfd5d65f4U, 0x0f36e6f7U,
+	0x61c69362U, 0x93ad1061U, 0x80fde395U, 0x72966096U,
+	0xa65c047dU, 0x5437877eU, 0x4767748aU, 0xb50cf789U,
+	0xeb1fcbadU, 0x197448aeU, 0x0a24bb5aU, 0xf84f3859U,
+	0x2c855cb2U, 0xdeeedfb1U, 0xcdbe2c45U, 0x3fd5af46U,
+	0x7198540dU, 0x83f3d70eU, 0x90a324faU, 0x62c8a7f9U,
+	0xb602c312U, 0x44694011U, 0x5739b3e5U, 0xa55230e6U,
+	0xfb410cc2U, 0x092a8fc1U, 0x1a7a7c35U, 0xe811ff36U,
+	0x3cdb9bddU, 0xceb018deU, 0xdde0eb2aU, 0x2f8b6829U,
+	0x82f63b78U, 0x709db87bU, 0x63cd4b8fU, 0x91a6c88cU,
+	0x456cac67U, 0xb7072f64U, 0xa457dc90U, 0x563c5f93U,
+	0x082f63b7U, 0xfa44e0b4U, 0xe9141340U, 0x1b7f9043U,
+	0xcfb5f4a8U, 0x3dde77abU, 0x2e8e845fU, 0xdce5075cU,
+	0x92a8fc17U, 0x60c37f14U, 0x73938ce0U, 0x81f80fe3U,
+	0x55326b08U, 0xa759e80bU, 0xb4091bffU, 0x466298fcU,
+	0x1871a4d8U, 0xea1a27dbU, 0xf94ad42fU, 0x0b21572cU,
+	0xdfeb33c7U, 0x2d80b0c4U, 0x3ed04330U, 0xccbbc033U,
+	0xa24bb5a6U, 0x502036a5U, 0x4370c551U, 0xb11b4652U,
+	0x65d122b9U, 0x97baa1baU, 0x84ea524eU, 0x7681d14dU,
+	0x2892ed69U, 0xdaf96e6aU, 0xc9a99d9eU, 0x3bc21e9dU,
+	0xef087a76U, 0x1d63f975U, 0x0e330a81U, 0xfc588982U,
+	0xb21572c9U, 0x407ef1caU, 0x532e023eU, 0xa145813dU,
+	0x758fe5d6U, 0x87e466d5U, 0x94b49521U, 0x66df1622U,
+	0x38cc2a06U, 0xcaa7a905U, 0xd9f75af1U, 0x2b9cd9f2U,
+	0xff56bd19U, 0x0d3d3e1aU, 0x1e6dcdeeU, 0xec064eedU,
+	0xc38d26c4U, 0x31e6a5c7U, 0x22b65633U, 0xd0ddd530U,
+	0x0417b1dbU, 0xf67c32d8U, 0xe52cc12cU, 0x1747422fU,
+	0x49547e0bU, 0xbb3ffd08U, 0xa86f0efcU, 0x5a048dffU,
+	0x8ecee914U, 0x7ca56a17U, 0x6ff599e3U, 0x9d9e1ae0U,
+	0xd3d3e1abU, 0x21b862a8U, 0x32e8915cU, 0xc083125fU,
+	0x144976b4U, 0xe622f5b7U, 0xf5720643U, 0x07198540U,
+	0x590ab964U, 0xab613a67U, 0xb831c993U, 0x4a5a4a90U,
+	0x9e902e7bU, 0x6cfbad78U, 0x7fab5e8cU, 0x8dc0dd8fU,
+	0xe330a81aU, 0x115b2b19U, 0x020bd8edU, 0xf0605beeU,
+	0x24aa3f05U, 0xd6c1bc06U, 0xc5914ff2U, 0x37faccf1U,
+	0x69e9f0d5U, 0x9b8273d6U, 0x88d28022U, 0x7ab90321U,
+	0xae7367caU, 0x5c18e4c9U, 0x4f48173dU, 0xbd23943eU,
+	0xf36e6f75U, 0x0105ec76U, 0x12551f82U, 0xe03e9c81U,
+	0x34f4f86aU, 0xc69f7b69U, 0xd5cf889dU, 0x27a40b9eU,
+	0x79b737baU, 0x8bdcb4b9U, 0x988c474dU, 0x6ae7c44eU,
+	0xbe2da0a5U, 0x4c4623a6U, 0x5f16d052U, 0xad7d5351U,
+};
+
+static inline uint32_t
+__crc32c_sw(uint32_t crc, const uint8_t *p, size_t z)
+{
+	for (; z > 0U; z--) {
+		crc = __crc32c_tbl[(crc ^ *p++) & 0xffU] ^ (crc >> 8U);
+	}
+	return crc;
+}
+
+#if defined HAVE_CRC32C_SSE42
+/* x^(8n - 33) mod P, multiplying a crc by these (and a crc32 insn)
+ * shifts it over n zero octets */
+# define CRC32C_K32	(0xba4fc28eU)
+# define CRC32C_K64	(0x9e4addf8U)
+# define CRC32C_K128	(0x0d3b6092U)
+# define CRC32C_K256	(0xb9e02b86U)
+
+static inline __attribute__((target("pclmul"))) uint64_t
+__crc32c_clmul(uint64_t c, uint32_t k)
+{
+	__m128i r = _mm_clmulepi64_si128(
+		_mm_cvtsi64_si128((long long)c),
+		_mm_cvtsi32_si128((int)k), 0x00);
+
+	return (uint64_t)_mm_cvtsi128_si64(r);
+}
+
+static inline __attribute__((target("sse4.2,pclmul"))) uint32_t
+__crc32c_3way(
+	uint32_t crc, const uint8_t **pp, size_t *zp,
+	const size_t l, const uint32_t kl, const uint32_t k2l)
+{
+/* crc32 insns take 3 cycles but issue every cycle, so go over 3 lanes
+ * of L octets each at once, then shift the first 2 lanes in place */
+	const uint8_t *p = *pp;
+	size_t z = *zp;
+
+	for (; z >= 3U * l; z -= 3U * l, p += 3U * l) {
+		uint64_t a = crc;
+		uint64_t b = 0U;
+		uint64_t c = 0U;
+
+		for (size_t i = 0; i < l; i += 8U) {
+			uint64_t va;
+			uint64_t vb;
+			uint64_t vc;
+
+			memcpy(&va, p + i, sizeof(va));
+			memcpy(&vb, p + l + i, sizeof(vb));
+			memcpy(&vc, p + 2U * l + i, sizeof(vc));
+			a = __builtin_ia32_crc32di(a, va);
+			b = __builtin_ia32_crc32di(b, vb);
+			c = __builtin_ia32_crc32di(c, vc);
+		}
+		crc = (uint32_t)__builtin_ia32_crc32di(
+			0U, __crc32c_clmul(a, k2l) ^ __crc32c_clmul(b, kl));
+		crc ^= (uint32_t)c;
+	}
+	*pp = p;
+	*zp = z;
+	return crc;
+}
+
+/* x^(8n + 63) and x^(8n - 1) mod P, bit-reflected into the upper half
+ * of a qword, clmul'ing the halves of a 16-octet chunk by these shifts
+ * it over n octets */
+# define CRC32C_F256	0xe9a5d8beU, 0x1426a815U
+# define CRC32C_F192	0x7ccbbbf2U, 0x31c94608U
+# define CRC32C_F128	0x6577b245U, 0x7417153fU
+# define CRC32C_F64	0x1c19243bU, 0x75bba45bU
+# define CRC32C_F48	0xa46ef4aaU, 0x6051243fU
+# define CRC32C_F32	0x33ccbbbcU, 0xa2158b34U
+# define CRC32C_F16	0x3743f7bdU, 0x3171d430U
+
+static inline __attribute__((target("avx512f,vpclmulqdq"))) __m512i
+__crc32c_fk(uint32_t lo, uint32_t hi)
+{
+	return _mm512_broadcast_i32x4(
+		_mm_set_epi64x((long long)hi << 32, (long long)lo << 32));
+}
+
+static inline __attribute__((target("avx512f,vpclmulqdq"))) __m512i
+__crc32c_fold(__m512i x, __m512i k)
+{
+	return _mm512_xor_si512(
+		_mm512_clmulepi64_epi128(x, k, 0x00),
+		_mm512_clmulepi64_epi128(x, k, 0x11));
+}
+
+static inline __attribute__((target("sse4.2,avx512f,vpclmulqdq"))) uint32_t
+__crc32c_vpclmul(uint32_t crc, const uint8_t **pp, size_t *zp)
+{
+/* fold 4 lanes of 64 octets over 256 octets at a time, every clmul
+ * takes 4 chunks at once, what's left is 16 octets with the same crc
+ * as the message so far, the crc32 insns take it from there */
+	const uint8_t *p = *pp;
+	size_t z = *zp;
+	__m512i k = __crc32c_fk(CRC32C_F256);
+	__m512i x0 = _mm512_loadu_si512(p);
+	__m512i x1 = _mm512_loadu_si512(p + 64U);
+	__m512i x2 = _mm512_loadu_si512(p + 128U);
+	__m512i x3 = _mm512_loadu_si512(p + 192U);
+	__m128i v;
+	uint64_t c;
+
+	/* the crc so far goes into the first 4 octets */
+	x0 = _mm512_xor_si512(
+		x0, _mm512_zextsi128_si512(_mm_cvtsi32_si128((int)crc)));
+	for (p += 256U, z -= 256U; z >= 256U; p += 256U, z -= 256U) {
+		x0 = _mm512_xor_si512(
+			__crc32c_fold(x0, k), _mm512_loadu_si512(p));
+		x1 = _mm512_xor_si512(
+			__crc32c_fold(x1, k), _mm512_loadu_si512(p + 64U));
+		x2 = _mm512_xor_si512(
+			__crc32c_fold(x2, k), _mm512_loadu_si512(p + 128U));
+		x3 = _mm512_xor_si512(
+			__crc32c_fold(x3, k), _mm512_loadu_si512(p + 192U));
+	}
+	/* lanes into the last one */
+	x0 = __crc32c_fold(x0, __crc32c_fk(CRC32C_F192));
+	x1 = __crc32c_fold(x1, __crc32c_fk(CRC32C_F128));
+	x2 = __crc32c_fold(x2, __crc32c_fk(CRC32C_F64));
+	x3 = _mm512_ternarylogic_epi64(x3, x0, x1, 0x96);
+	x3 = _mm512_xor_si512(x3, x2);
+	for (k = __crc32c_fk(CRC32C_F64); z >= 64U; p += 64U, z -= 64U) {
+		x3 = _mm512_xor_si512(
+			__crc32c_fold(x3, k), _mm512_loadu_si512(p));
+	}
+	/* chunks into the last one, which stays put */
+	k = _mm512_mask_blend_epi64(
+		0x0cU, __crc32c_fk(CRC32C_F48), __crc32c_fk(CRC32C_F32));
+	k = _mm512_mask_blend_epi64(0x30U, k, __crc32c_fk(CRC32C_F16));
+	x0 = _mm512_mask_blend_epi64(0xc0U, __crc32c_fold(x3, k), x3);
+	v = _mm_xor_si128(
+		_mm_xor_si128(_mm512_extracti32x4_epi32(x0, 0),
+			      _mm512_extracti32x4_epi32(x0, 1)),
+		_mm_xor_si128(_mm512_extracti32x4_epi32(x0, 2),
+			      _mm512_extracti32x4_epi32(x0, 3)));
+	c = __builtin_ia32_crc32di(0U, (uint64_t)_mm_cvtsi128_si64(v));
+	c = __builtin_ia32_crc32di(
+		c, (uint64_t)_mm_extract_epi64(v, 1));
+	*pp = p;
+	*zp = z;
+	return (uint32_t)c;
+}
+
+static inline __attribute__((target("sse4.2"))) uint32_t
+__crc32c_sse42(uint32_t crc, const uint8_t *p, size_t z)
+{
+	uint64_t c = crc;
+
+	for (; z >= 8U; z -= 8U, p += 8U) {
+		uint64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		c = __builtin_ia32_crc32di(c, v);
+	}
+	crc = (uint32_t)c;
+	for (; z > 0U; z--) {
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	}
+	return crc;
+}
+#elif defined __ARM_FEATURE_CRC32
+static inline uint32_t
+__crc32c_armv8(uint32_t crc, const uint8_t *p, size_t z)
+{
+	for (; z >= 8U; z -= 8U, p += 8U) {
+		uint64_t v;
+
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	for (; z > 0U; z--) {
+		crc = __crc32cb(crc, *p++);
+	}
+	return crc;
+}
+#endif	/* HAVE_CRC32C_SSE42 || __ARM_FEATURE_CRC32 */
+
+/**
+ * Return the CRC32C of P, of size Z. */
+static inline uint32_t
+ud_crc32c(const void *p, size_t z)
+{
+	uint32_t crc = 0xffffffffU;
+
+#if defined HAVE_CRC32C_SSE42
+	if (__builtin_cpu_supports("sse4.2") &&
+	    __builtin_cpu_supports("pclmul")) {
+		const uint8_t *q = p;
+
+		if (z >= 256U &&
+		    __builtin_cpu_supports("avx512f") &&
+		    __builtin_cpu_supports("vpclmulqdq")) {
+			crc = __crc32c_vpclmul(crc, &q, &z);
+		}
+		crc = __crc32c_3way(
+			crc, &q, &z, 128U, CRC32C_K128, CRC32C_K256);
+		crc = __crc32c_3way(crc, &q, &z, 32U, CRC32C_K32, CRC32C_K64);
+		return ~__crc32c_sse42(crc, q, z);
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		return ~__crc32c_sse42(crc, p, z);
+	}
+#elif defined __ARM_FEATURE_CRC32
+	return ~__crc32c_armv8(crc, p, z);
+#endif	/* HAVE_CRC32C_SSE42 || __ARM_FEATURE_CRC32 */
+	return ~__crc32c_sw(crc, p, z);
+}
+
+/**
+ * Same but always in software, for comparison. */
+static inline uint32_t
+ud_crc32c_sw(const void *p, size_t z)
+{
+	return ~__crc32c_sw(0xffffffffU, p, z);
+}
+
+#endif	/* INCLUDED_ud_crc32c_h_ */
@@ -0,0 +1,445 @@
+/*** ud-poller.c -- draining many unserding sockets in one loop
+ *
+ * Copyright (C) 2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@ga-group.nl>
+ *
+ * This file is part of unserding.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if defined HAVE_CONFIG_H
+# include "config.h"
+#endif	/* HAVE_CONFIG_H */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#if defined HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+# include <sys/eventfd.h>
+#endif	/* HAVE_SYS_EPOLL_H */
+
+#include "unserding.h"
+#include "ud-nifty.h"
+
+#if !defined countof
+# define countof(x)	(sizeof(x) / sizeof(*x))
+#endif	/* !countof */
+
+/* messages per socket and round unless told otherwise */
+#define POLL_BUDGET	(64U)
+/* readiness events taken off the kernel per round */
+#define POLL_NEV	(64U)
+
+struct __pent_s {
+	/* NULL once deleted from within a callback */
+	ud_sock_t s;
+	/* whether we're queued, on the list of sockets that ran out of
+	 * budget or on this round's */
+	bool pend;
+	/* whether the socket's timer went off */
+	bool tmrp;
+};
+
+struct __pcb_s {
+	ud_poller_f cb;
+	void *clo;
+};
+
+/* callbacks of the services of a channel, NULL for the catch-all */
+struct __pchn_s {
+	struct __pcb_s e[0x100U];
+};
+
+struct ud_poller_s {
+	int epfd;
+	/* in the epoll set, readable while there are stragglers */
+	int evfd;
+	unsigned int budget;
+	/* whether we're dispatching, deletions are deferred then */
+	bool runp;
+
+	/* registered sockets */
+	size_t nent;
+	size_t zent;
+	struct __pent_s **ent;
+	/* sockets that ran out of budget, served first next round,
+	 * ZENT long */
+	size_t npend;
+	struct __pent_s **pend;
+
+	/* service callbacks by channel, unused ones point at a channel
+	 * without any, and the one for the rest */
+	struct __pchn_s *chn[0x100U];
+	struct __pcb_s any;
+};
+
+
+#if defined HAVE_SYS_EPOLL_H
+/* shared by all pollers, never written to */
+static struct __pchn_s __pnop;
+
+/* timers go in the epoll set as their socket's entry, tagged */
+#define TMR_TAG(e)	((void*)((uintptr_t)(e) | 1U))
+#define TMR_TAG_P(x)	((uintptr_t)(x) & 1U)
+#define TMR_UNTAG(x)	((struct __pent_s*)((uintptr_t)(x) & ~(uintptr_t)1U))
+
+static void
+poller_reap(ud_poller_t p)
+{
+/* free entries deleted while dispatching */
+	size_t j;
+
+	j = 0U;
+	for (size_t i = 0; i < p->npend; i++) {
+		if (p->pend[i]->s != NULL) {
+			p->pend[j++] = p->pend[i];
+		}
+	}
+	p->npend = j;
+
+	j = 0U;
+	for (size_t i = 0; i < p->nent; i++) {
+		if (p->ent[i]->s != NULL) {
+			p->ent[j++] = p->ent[i];
+		} else {
+			free(p->ent[i]);
+		}
+	}
+	p->nent = j;
+	return;
+}
+
+static inline void
+poller_disp(ud_poller_t p, ud_sock_t s, const struct ud_msg_s *msg)
+{
+	const struct __pcb_s *e =
+		p->chn[msg->svc / 0x100U]->e + msg->svc % 0x100U;
+
+	if (e->cb == NULL) {
+		e = &p->any;
+	}
+	if (e->cb != NULL) {
+		e->cb(s, msg, e->clo);
+	}
+	return;
+}
+
+
+ud_poller_t
+ud_poller_open(unsigned int budget)
+{
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	ud_poller_t res;
+
+	if (UNLIKELY((res = calloc(1, sizeof(*res))) == NULL)) {
+		return NULL;
+	} else if (UNLIKELY((res->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)) {
+		goto free_out;
+	} else if (UNLIKELY((res->evfd = eventfd(
+				     0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)) {
+		goto clos_out;
+	} else if (UNLIKELY(epoll_ctl(
+				    res->epfd, EPOLL_CTL_ADD,
+				    res->evfd, &ev) < 0)) {
+		goto clos2_out;
+	}
+	res->budget = budget ?: POLL_BUDGET;
+	for (size_t i = 0; i < countof(res->chn); i++) {
+		res->chn[i] = &__pnop;
+	}
+	return res;
+
+clos2_out:
+	close(res->evfd);
+clos_out:
+	close(res->epfd);
+free_out:
+	free(res);
+	return NULL;
+}
+
+int
+ud_poller_close(ud_poller_t p)
+{
+	int res = close(p->epfd);
+
+	close(p->evfd);
+
+	for (size_t i = 0; i < p->nent; i++) {
+		free(p->ent[i]);
+	}
+	free(p->ent);
+	free(p->pend);
+	for (size_t i = 0; i < countof(p->chn); i++) {
+		if (p->chn[i] != &__pnop) {
+			free(p->chn[i]);
+		}
+	}
+	free(p);
+	return res;
+}
+
+int
+ud_poller_fd(ud_poller_t p)
+{
+	return p->epfd;
+}
+
+int
+ud_poller_add(ud_poller_t p, ud_sock_t s)
+{
+	struct epoll_event ev = {.events = EPOLLIN};
+	struct __pent_s *e;
+
+	if (UNLIKELY(s->fd < 0)) {
+		/* node-local sockets have nothing to poll */
+		errno = EINVAL;
+		return -1;
+	}
+	if (p->nent >= p->zent) {
+		size_t nu = p->zent ? 2U * p->zent : 64U;
+		void *ent;
+		void *pend;
+
+		ent = realloc(p->ent, nu * sizeof(*p->ent));
+		if (UNLIKELY(ent == NULL)) {
+			return -1;
+		}
+		p->ent = ent;
+		pend = realloc(p->pend, nu * sizeof(*p->pend));
+		if (UNLIKELY(pend == NULL)) {
+			return -1;
+		}
+		p->pend = pend;
+		p->zent = nu;
+	}
+	if (UNLIKELY((e = malloc(sizeof(*e))) == NULL)) {
+		return -1;
+	}
+	*e = (struct __pent_s){.s = s};
+	ev.data.ptr = e;
+	if (UNLIKELY(epoll_ctl(p->epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0)) {
+		free(e);
+		return -1;
+	}
+	/* deadlines of flushes, pacing and NAKs are served here too */
+	ev.data.ptr = TMR_TAG(e);
+	if (s->tfd >= 0 &&
+	    UNLIKELY(epoll_ctl(p->epfd, EPOLL_CTL_ADD, s->tfd, &ev) < 0)) {
+		(void)epoll_ctl(p->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+		free(e);
+		return -1;
+	}
+	p->ent[p->nent++] = e;
+	return 0;
+}
+
+int
+ud_poller_del(ud_poller_t p, ud_sock_t s)
+{
+	size_t i;
+
+	for (i = 0; i < p->nent && p->ent[i]->s != s; i++);
+	if (UNLIKELY(i >= p->nent)) {
+		errno = ENOENT;
+		return -1;
+	}
+	(void)epoll_ctl(p->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+	if (s->tfd >= 0) {
+		(void)epoll_ctl(p->epfd, EPOLL_CTL_DEL, s->tfd, NULL);
+	}
+	p->ent[i]->s = NULL;
+	if (!p->runp) {
+		poller_reap(p);
+	}
+	return 0;
+}
+
+int
+ud_poller_on(ud_poller_t p, ud_svc_t svc, ud_poller_f cb, void *clo)
+{
+	struct __pchn_s **c = p->chn + svc / 0x100U;
+
+	if (*c == &__pnop) {
+		if (cb == NULL) {
+			/* unregister what's never been registered */
+			return 0;
+		} else if (UNLIKELY((*c = calloc(1, sizeof(**c))) == NULL)) {
+			*c = &__pnop;
+			return -1;
+		}
+	}
+	(*c)->e[svc % 0x100U] = (struct __pcb_s){cb, clo};
+	return 0;
+}
+
+int
+ud_poller_on_any(ud_poller_t p, ud_poller_f cb, void *clo)
+{
+	p->any = (struct __pcb_s){cb, clo};
+	return 0;
+}
+
+ssize_t
+ud_poller_run(ud_poller_t p, int timeout)
+{
+	struct epoll_event ev[POLL_NEV];
+	struct __pent_s *rdy[POLL_NEV + p->npend];
+	size_t nrdy = 0U;
+	ssize_t res = 0;
+	int nev;
+
+	if ((nev = epoll_wait(p->epfd, ev, countof(ev), timeout)) < 0) {
+		if (errno != EINTR) {
+			return -1;
+		}
+		nev = 0;
+	}
+
+	/* stragglers from the last round go first, ... */
+	for (size_t i = 0; i < p->npend; i++) {
+		rdy[nrdy++] = p->pend[i];
+	}
+	p->npend = 0U;
+	/* ... then whatever the kernel says is ready */
+	for (int i = 0; i < nev; i++) {
+		struct __pent_s *e = ev[i].data.ptr;
+
+		if (e == NULL) {
+			/* stragglers' wakeup, they're in already */
+			uint64_t x;
+
+			(void)read(p->evfd, &x, sizeof(x));
+			continue;
+		} else if (TMR_TAG_P(e)) {
+			/* the socket's timer, no matter if it's readable */
+			e = TMR_UNTAG(e);
+			e->tmrp = true;
+		}
+		if (!e->pend) {
+			e->pend = true;
+			rdy[nrdy++] = e;
+		}
+	}
+
+	p->runp = true;
+	for (size_t i = 0; i < nrdy; i++) {
+		struct __pent_s *e = rdy[i];
+		struct ud_msg_s msg[1];
+		unsigned int n;
+
+		e->pend = false;
+		if (e->tmrp && e->s != NULL) {
+			/* flushing rearms the timer, or disarms it,
+			 * overdue NAKs go when the socket runs dry */
+			uint64_t x;
+
+			e->tmrp = false;
+			(void)read(e->s->tfd, &x, sizeof(x));
+			(void)ud_flush(e->s);
+		}
+		for (n = 0U; n < p->budget && e->s != NULL &&
+			     ud_chck_msg(msg, e->s) == 0; n++) {
+			poller_disp(p, e->s, msg);
+		}
+		res += n;
+		if (n >= p->budget && e->s != NULL) {
+			/* might have more, back of the queue */
+			e->pend = true;
+			p->pend[p->npend++] = e;
+		}
+	}
+	p->runp = false;
+	poller_reap(p);
+	if (p->npend > 0U) {
+		/* don't keep the stragglers waiting */
+		(void)write(p->evfd, &(uint64_t){1U}, sizeof(uint64_t));
+	}
+	return res;
+}
+
+#else  /* !HAVE_SYS_EPOLL_H */
+ud_poller_t
+ud_poller_open(unsigned int UNUSED(budget))
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int
+ud_poller_close(ud_poller_t UNUSED(p))
+{
+	return -1;
+}
+
+int
+ud_poller_fd(ud_poller_t UNUSED(p))
+{
+	return -1;
+}
+
+int
+ud_poller_add(ud_poller_t UNUSED(p), ud_sock_t UNUSED(s))
+{
+	return -1;
+}
+
+int
+ud_poller_del(ud_poller_t UNUSED(p), ud_sock_t UNUSED(s))
+{
+	return -1;
+}
+
+int
+ud_poller_on(
+	ud_poller_t UNUSED(p), ud_svc_t UNUSED(svc),
+	ud_poller_f UNUSED(cb), void *UNUSED(clo))
+{
+	return -1;
+}
+
+int
+ud_poller_on_any(
+	ud_poller_t UNUSED(p), ud_poller_f UNUSED(cb), void *UNUSED(clo))
+{
+	return -1;
+}
+
+ssize_t
+ud_poller_run(ud_poller_t UNUSED(p), int UNUSED(timeout))
+{
+	return -1;
+}
+#endif	/* HAVE_SYS_EPOLL_H */
+
+/* ud-poller.c ends here */
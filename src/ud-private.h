@@ -50,6 +50,22 @@ extern int ud_pack_cmsg(ud_sock_t s, struct ud_msg_s msg);
  * Scan messages in S for control messages and take actions. */
 extern int ud_chck_cmsg(struct ud_msg_s *restrict tgt, ud_sock_t s);
 
+/**
+ * Stop reading the subscriber S off the wire, for passive tools that
+ * capture traffic by other means and hand it to S via `ud_inject()'.
+ * S keeps its group membership but the kernel drops its traffic. */
+extern int ud_tap(ud_sock_t s);
+
+/**
+ * Make packet P of size Z, as sent by SRC and captured at TS (or NULL),
+ * the current packet of the tapped socket S.
+ * P is decoded in place by subsequent `ud_chck_msg()' calls and must
+ * stay put until those return -1. */
+extern int
+ud_inject(
+	ud_sock_t s, void *p, size_t z,
+	const struct sockaddr *src, const struct timespec *ts);
+
 
 /* specific services */
 /**
@@ -68,6 +84,10 @@ enum chn_ctrl_e {
 	UD_SVC_TIME = 0x02U,
 	/** Ping/pong service to determine neighbours */
 	UD_SVC_PING = 0x04U,
+	/** negative acknowledgements to get lost packets retransmitted */
+	UD_SVC_NAK = 0x06U,
+	/** parity packets to recover lost packets */
+	UD_SVC_FEC = 0x08U,
 };
 
 #endif	/* INCLUDED_ud_private_h_ */
@@ -64,9 +64,11 @@
 # define EV_P  struct ev_loop *loop __attribute__((unused))
 #endif	/* HAVE_EV_H */
 #include "unserding.h"
+#include "ud-private.h"
 #include "ud-nifty.h"
 #include "ud-sock.h"
 #include "ud-logger.h"
+#include "ud-tpacket.h"
 #include "daemonise.h"
 
 #if defined DEBUG_FLAG && !defined BENCHMARK
@@ -103,6 +105,12 @@ struct ctx_s {
 	uint32_t ident;
 };
 
+/* sockets whose ports we forward when capturing off a ring */
+static struct tap_s {
+	ev_io *beef;
+	size_t nbeef;
+} tap[1];
+
 
 static void
 ev_io_shut(EV_P_ ev_io *w)
@@ -301,6 +309,46 @@ sub_cb(EV_P_ ev_io *w, int UNUSED(revents))
 	return;
 }
 
+static void
+tpkt_frm(const struct ud_tpkt_frm_s *f, void *clo)
+{
+	const struct tap_s *t = clo;
+
+	for (size_t i = 0; i <= t->nbeef; i++) {
+		ud_sock_t s = t->beef[i].data;
+		const struct sockaddr_in6 *sa;
+		ctx_t ctx;
+
+		if (s == NULL) {
+			continue;
+		} else if ((sa = (const void*)ud_socket_addr(s)) == NULL) {
+			continue;
+		} else if (sa->sin6_port != f->dst.sin6_port) {
+			continue;
+		}
+		/* redirect packet as is, straight off the ring */
+		ctx = s->data;
+		for (size_t j = 0;
+		     j < MAX_RETR &&
+			     send(ctx->dst, f->pl, f->plz, 0) != (ssize_t)f->plz;
+		     j++) {
+			usleep(RETR_SLEEP);
+		}
+		break;
+	}
+	return;
+}
+
+static void
+tpkt_cb(EV_P_ ev_io *w, int UNUSED(revents))
+{
+	ud_tpkt_t t = w->data;
+
+	UD_DEBUG("tpkt_cb\n");
+	(void)ud_tpkt_walk(t, tpkt_frm, tap);
+	return;
+}
+
 static void
 chk_cb(EV_P_ ev_check *w, int rev)
 {
@@ -366,6 +414,9 @@ main(int argc, char *argv[])
 	ev_signal sigterm_watcher[1];
 	ev_io *beef = NULL;
 	size_t nbeef;
+	/* capture ring, if any */
+	ud_tpkt_t tpkt = NULL;
+	ev_io tpkt_w[1];
 	ev_check chk[1];
 	/* context we pass around */
 	struct ctx_s ctx[1];
@@ -419,23 +470,52 @@ main(int argc, char *argv[])
 		}
 	}
 
-	/* set up the one end, sub to unserding network */
-	for (unsigned int i = 0; i < argi->beef_given; i++) {
-		uint16_t port = (uint16_t)argi->beef_arg[i];
-		ud_sock_t s;
+	/* set up the one end, sub to unserding network, en bloc */
+	if (argi->beef_given) {
+		uint16_t ports[argi->beef_given];
+		ud_sock_t s[argi->beef_given];
 
-		if ((s = ud_socket((struct ud_sockopt_s){
-					UD_SUB,
-					.port = port})) == NULL) {
-			error(errno, "\
-cannot initialise unserding socket, channel %hu", port);
-			continue;
+		for (unsigned int i = 0; i < argi->beef_given; i++) {
+			ports[i] = (uint16_t)argi->beef_arg[i];
+		}
+		(void)ud_socket_bulk(
+			s, (struct ud_sockopt_s){UD_SUB},
+			ports, argi->beef_given);
+
+		for (unsigned int i = 0; i < argi->beef_given; i++) {
+			if (s[i] == NULL) {
+				error(0, "\
+cannot initialise unserding socket, channel %hu", ports[i]);
+				continue;
+			}
+			/* otherwise */
+			beef[i].data = s[i];
+			s[i]->data = ctx;
+			ev_io_init(beef + i, sub_cb, s[i]->fd, EV_READ);
+			ev_io_start(EV_A_ beef + i);
 		}
-		/* otherwise */
-		beef[i].data = s;
-		s->data = ctx;
-		ev_io_init(beef + i, sub_cb, s->fd, EV_READ);
-		ev_io_start(EV_A_ beef + i);
+	}
+
+	/* capture off a ring rather than reading the sockets */
+	if (argi->tpacket_given &&
+	    (tpkt = ud_tpkt_open(argi->tpacket_arg)) == NULL) {
+		error(errno, "\
+cannot capture on %s, reading sockets instead", argi->tpacket_arg);
+	} else if (tpkt != NULL) {
+		for (unsigned int i = 0; i <= nbeef; i++) {
+			ud_sock_t s = beef[i].data;
+
+			if (s != NULL) {
+				/* sockets just keep the groups joined now */
+				ev_io_stop(EV_A_ beef + i);
+				(void)ud_tap(s);
+			}
+		}
+		tap->beef = beef;
+		tap->nbeef = nbeef;
+		tpkt_w->data = tpkt;
+		ev_io_init(tpkt_w, tpkt_cb, ud_tpkt_fd(tpkt), EV_READ);
+		ev_io_start(EV_A_ tpkt_w);
 	}
 
 	/* set up preparation */
@@ -451,6 +531,11 @@ cannot initialise unserding socket, channel %hu", port);
 	chk_cb(EV_A_ chk, EV_CUSTOM);
 	ev_check_stop(EV_A_ chk);
 
+	if (tpkt != NULL) {
+		ev_io_stop(EV_A_ tpkt_w);
+		ud_tpkt_close(tpkt);
+	}
+
 	/* detaching beef channels */
 	for (unsigned int i = 0; i <= nbeef; i++) {
 		ud_sock_t s;
@@ -0,0 +1,219 @@
+/*** ud-tlv.h -- finding message boundaries in packets
+ *
+ * Copyright (C) 2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@ga-group.nl>
+ *
+ * This file is part of unserding.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if !defined INCLUDED_ud_tlv_h_
+#define INCLUDED_ud_tlv_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#if defined __x86_64__ && defined __GNUC__
+/* avx2 is checked for at runtime */
+# define TLV_AVX2
+# include <immintrin.h>
+#elif defined __ARM_NEON
+# include <arm_neon.h>
+#endif	/* __x86_64__ && __GNUC__ || __ARM_NEON */
+
+/* Tlvs start with the type in the lower nibble, 0x0c to 0x0f, and the
+ * upper 4 of 12 length bits, the lower 8 follow.  Odd types have a
+ * service after that.  Every tlv's end depends on its start, so
+ * vectorised we compute where a tlv would end for every position of
+ * a block, and then hop through the block by table look-ups. */
+#define UD_TLV_BLKZ	(64U)
+
+static inline bool
+__tlv_type_p(uint8_t b)
+{
+	return (b & 0x0cU) == 0x0cU;
+}
+
+static inline size_t
+__tlv_walk(
+	uint16_t *restrict tgt, size_t n, const uint8_t *p, size_t z,
+	size_t i, size_t k)
+{
+/* go from offset I on, with K offsets in TGT already */
+	for (; k < n && i + 2U <= z && __tlv_type_p(p[i]); k++) {
+		size_t nx = i + 2U + 2U * (p[i] & 1U) +
+			(((p[i] & 0xf0U) << 4U) | p[i + 1U]);
+
+		if (nx > z) {
+			break;
+		}
+		tgt[k] = (uint16_t)i;
+		i = nx;
+	}
+	return k;
+}
+
+#if defined TLV_AVX2
+static inline __attribute__((target("avx2"))) void
+__tlv_blk_avx2(uint16_t *restrict nx, const uint8_t *p, size_t base)
+{
+/* ends of tlvs starting anywhere in P[BASE, BASE + UD_TLV_BLKZ),
+ * 0 for positions that can't start one */
+	const __m256i iota = _mm256_setr_epi16(
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m256i c = _mm256_set1_epi16(0x0c);
+	const __m256i one = _mm256_set1_epi16(0x01);
+	const __m256i hi = _mm256_set1_epi16(0xf0);
+
+	for (size_t j = 0U; j < UD_TLV_BLKZ; j += 16U) {
+		const uint8_t *q = p + base + j;
+		__m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const void*)q));
+		__m256i b1 = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const void*)(q + 1U)));
+		__m256i i = _mm256_add_epi16(
+			_mm256_set1_epi16((short)(base + j + 2U)), iota);
+		__m256i hz = _mm256_slli_epi16(_mm256_and_si256(b0, one), 1);
+		__m256i len = _mm256_or_si256(
+			_mm256_slli_epi16(_mm256_and_si256(b0, hi), 4), b1);
+		__m256i ok = _mm256_cmpeq_epi16(_mm256_and_si256(b0, c), c);
+		__m256i e = _mm256_add_epi16(_mm256_add_epi16(i, hz), len);
+
+		_mm256_storeu_si256((void*)(nx + j), _mm256_and_si256(e, ok));
+	}
+	return;
+}
+#elif defined __ARM_NEON
+static inline void
+__tlv_blk_neon(uint16_t *restrict nx, const uint8_t *p, size_t base)
+{
+	static const uint16_t iota[8U] = {0, 1, 2, 3, 4, 5, 6, 7};
+	const uint16x8_t io = vld1q_u16(iota);
+	const uint16x8_t c = vdupq_n_u16(0x0cU);
+
+	for (size_t j = 0U; j < UD_TLV_BLKZ; j += 8U) {
+		const uint8_t *q = p + base + j;
+		uint16x8_t b0 = vmovl_u8(vld1_u8(q));
+		uint16x8_t b1 = vmovl_u8(vld1_u8(q + 1U));
+		uint16x8_t i = vaddq_u16(
+			vdupq_n_u16((uint16_t)(base + j + 2U)), io);
+		uint16x8_t hz = vshlq_n_u16(vandq_u16(b0, vdupq_n_u16(1U)), 1);
+		uint16x8_t len = vorrq_u16(
+			vshlq_n_u16(vandq_u16(b0, vdupq_n_u16(0xf0U)), 4), b1);
+		uint16x8_t ok = vceqq_u16(vandq_u16(b0, c), c);
+		uint16x8_t e = vaddq_u16(vaddq_u16(i, hz), len);
+
+		vst1q_u16(nx + j, vandq_u16(e, ok));
+	}
+	return;
+}
+#endif	/* TLV_AVX2 || __ARM_NEON */
+
+/* tlvs shorter than this make building a block's table worth it */
+#define UD_TLV_DENSE	(UD_TLV_BLKZ / 4U)
+
+/* walk tlv by tlv while they're long, hop through tables of blocks
+ * while they're short, BLK builds those tables */
+#define TLV_HOP(tgt, n, p, z, blk)					\
+	size_t i = 0U;							\
+	size_t k = 0U;							\
+									\
+	/* whole blocks only, they read one octet past their end */	\
+	while (k < n && i + UD_TLV_BLKZ < z) {				\
+		const size_t base = i;					\
+		uint16_t nx[UD_TLV_BLKZ];				\
+		size_t e = i + 2U + 2U * (p[i] & 1U) +			\
+			(((p[i] & 0xf0U) << 4U) | p[i + 1U]);		\
+									\
+		if (!__tlv_type_p(p[i]) || e > z) {			\
+			return k;					\
+		} else if (e - i >= UD_TLV_DENSE) {			\
+			/* a long one, tables are no use */		\
+			tgt[k++] = (uint16_t)i;				\
+			i = e;						\
+			continue;					\
+		}							\
+		blk(nx, p, base);					\
+		do {							\
+			e = nx[i - base];				\
+			/* ends before starts wrapped around, or are 0 */ \
+			if (e <= i || e > z) {				\
+				return k;				\
+			}						\
+			tgt[k++] = (uint16_t)i;				\
+			i = e;						\
+		} while (k < n && i < base + UD_TLV_BLKZ);		\
+	}								\
+	return __tlv_walk(tgt, n, p, z, i, k)
+
+#if defined TLV_AVX2
+static inline __attribute__((target("avx2"))) size_t
+__tlv_hop_avx2(uint16_t *restrict tgt, size_t n, const uint8_t *p, size_t z)
+{
+	TLV_HOP(tgt, n, p, z, __tlv_blk_avx2);
+}
+#elif defined __ARM_NEON
+static inline size_t
+__tlv_hop_neon(uint16_t *restrict tgt, size_t n, const uint8_t *p, size_t z)
+{
+	TLV_HOP(tgt, n, p, z, __tlv_blk_neon);
+}
+#endif	/* TLV_AVX2 || __ARM_NEON */
+#undef TLV_HOP
+
+/**
+ * Put the offsets of the tlvs in payload P, of size Z, into TGT, up to
+ * N of them.  Indexing stops at the first tlv of unknown type or one
+ * that exceeds Z, much like `ud_chck_msg()' skips the rest of a packet.
+ * Payloads must be shorter than 64k.
+ * The receive path doesn't use this, it only pays for messages under
+ * 16 octets and loses on longer ones, see bench_tlv.
+ * Return the number of offsets put into TGT. */
+static inline size_t
+ud_tlv_index(uint16_t *restrict tgt, size_t n, const void *p, size_t z)
+{
+#if defined TLV_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		return __tlv_hop_avx2(tgt, n, p, z);
+	}
+#elif defined __ARM_NEON
+	return __tlv_hop_neon(tgt, n, p, z);
+#endif	/* TLV_AVX2 || __ARM_NEON */
+	return __tlv_walk(tgt, n, p, z, 0U, 0U);
+}
+
+/**
+ * Same but walking tlv by tlv, for comparison. */
+static inline size_t
+ud_tlv_index_sw(uint16_t *restrict tgt, size_t n, const void *p, size_t z)
+{
+	return __tlv_walk(tgt, n, p, z, 0U, 0U);
+}
+
+#endif	/* INCLUDED_ud_tlv_h_ */
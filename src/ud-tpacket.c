@@ -0,0 +1,276 @@
+/*** ud-tpacket.c -- capturing traffic off TPACKET_V3 rings
+ *
+ * Copyright (C) 2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@ga-group.nl>
+ *
+ * This file is part of unserding.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if defined HAVE_CONFIG_H
+# include "config.h"
+#endif	/* HAVE_CONFIG_H */
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#if defined HAVE_LINUX_IF_PACKET_H
+# include <linux/if_packet.h>
+# include <linux/if_ether.h>
+# include <linux/if_arp.h>
+#endif	/* HAVE_LINUX_IF_PACKET_H */
+
+#include "ud-tpacket.h"
+#include "ud-nifty.h"
+
+#if defined HAVE_LINUX_IF_PACKET_H && defined TPACKET3_HDRLEN
+# define HAVE_TPACKET_V3
+#endif	/* HAVE_LINUX_IF_PACKET_H && TPACKET3_HDRLEN */
+
+/* ring geometry, blocks are handed over when full or after TOV ms */
+#define TPKT_BLKZ	(1U << 20U)
+#define TPKT_NBLK	(64U)
+#define TPKT_FRMZ	(2048U)
+#define TPKT_TOV	(10U)
+
+/* ipv6 and udp headers */
+#define IP6_HDRZ	(40U)
+#define UDP_HDRZ	(8U)
+
+struct ud_tpkt_s {
+	int fd;
+	/* the ring proper, NBLK blocks of BLKZ bytes */
+	uint8_t *ring;
+	unsigned int nblk;
+	size_t blkz;
+	/* block to look at next */
+	unsigned int cur;
+};
+
+
+ud_tpkt_t
+ud_tpkt_open(const char *ifn)
+{
+#if defined HAVE_TPACKET_V3
+	struct tpacket_req3 req = {
+		.tp_block_size = TPKT_BLKZ,
+		.tp_block_nr = TPKT_NBLK,
+		.tp_frame_size = TPKT_FRMZ,
+		.tp_frame_nr = TPKT_BLKZ / TPKT_FRMZ * TPKT_NBLK,
+		.tp_retire_blk_tov = TPKT_TOV,
+	};
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		/* outgoing traffic only goes to ETH_P_ALL taps */
+		.sll_protocol = htons(ETH_P_ALL),
+	};
+	int ver = TPACKET_V3;
+	ud_tpkt_t res;
+	void *ring;
+	int s;
+
+	/* cooked sockets, so lo and ethernet look alike */
+	if ((s = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) < 0) {
+		return NULL;
+	} else if ((sll.sll_ifindex = if_nametoindex(ifn)) == 0) {
+		goto clos_out;
+	} else if (setsockopt(s, SOL_PACKET, PACKET_VERSION,
+			      &ver, sizeof(ver)) < 0) {
+		goto clos_out;
+	} else if (setsockopt(s, SOL_PACKET, PACKET_RX_RING,
+			      &req, sizeof(req)) < 0) {
+		goto clos_out;
+	}
+	ring = mmap(NULL, (size_t)TPKT_BLKZ * TPKT_NBLK,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, s, 0);
+	if (ring == MAP_FAILED) {
+		/* try without locking */
+		ring = mmap(NULL, (size_t)TPKT_BLKZ * TPKT_NBLK,
+			    PROT_READ | PROT_WRITE, MAP_SHARED, s, 0);
+	}
+	if (ring == MAP_FAILED) {
+		goto clos_out;
+	} else if (bind(s, (void*)&sll, sizeof(sll)) < 0) {
+		goto unmap_out;
+	} else if ((res = malloc(sizeof(*res))) == NULL) {
+		goto unmap_out;
+	}
+	*res = (struct ud_tpkt_s){
+		.fd = s,
+		.ring = ring,
+		.nblk = TPKT_NBLK,
+		.blkz = TPKT_BLKZ,
+	};
+	return res;
+
+unmap_out:
+	munmap(ring, (size_t)TPKT_BLKZ * TPKT_NBLK);
+clos_out:
+	close(s);
+#endif	/* HAVE_TPACKET_V3 */
+	return NULL;
+}
+
+void
+ud_tpkt_close(ud_tpkt_t t)
+{
+	munmap(t->ring, t->blkz * t->nblk);
+	close(t->fd);
+	free(t);
+	return;
+}
+
+int
+ud_tpkt_fd(ud_tpkt_t t)
+{
+	return t->fd;
+}
+
+int
+ud_tpkt_dissect(
+	struct ud_tpkt_frm_s *restrict f,
+	const struct sockaddr_ll *sll, void *pkt, size_t z)
+{
+#if defined HAVE_LINUX_IF_PACKET_H
+	uint8_t *p = pkt;
+	size_t off = IP6_HDRZ;
+	size_t ulen;
+	uint8_t nxt;
+
+	if (sll->sll_pkttype == PACKET_OUTGOING &&
+	    sll->sll_hatype == ARPHRD_LOOPBACK) {
+		/* we'll see it again coming in */
+		return -1;
+	} else if (sll->sll_protocol != htons(ETH_P_IPV6)) {
+		return -1;
+	} else if (z < IP6_HDRZ || p[0U] >> 4U != 6U) {
+		return -1;
+	}
+	/* skip extension headers we can skip */
+	for (nxt = p[6U];
+	     nxt == IPPROTO_HOPOPTS ||
+		     nxt == IPPROTO_ROUTING ||
+		     nxt == IPPROTO_DSTOPTS;
+	     nxt = p[off], off += (p[off + 1U] + 1U) * 8U) {
+		if (off + 8U > z) {
+			return -1;
+		}
+	}
+	if (nxt != IPPROTO_UDP || off + UDP_HDRZ > z) {
+		/* fragments too, half a packet is no packet */
+		return -1;
+	} else if ((ulen = p[off + 4U] << 8U | p[off + 5U]) < UDP_HDRZ) {
+		return -1;
+	} else if (off + ulen > z) {
+		/* truncated */
+		return -1;
+	}
+
+	memset(f, 0, sizeof(*f));
+	f->src.sin6_family = AF_INET6;
+	memcpy(&f->src.sin6_port, p + off + 0U, sizeof(f->src.sin6_port));
+	memcpy(&f->src.sin6_addr, p + 8U, sizeof(f->src.sin6_addr));
+	f->dst.sin6_family = AF_INET6;
+	memcpy(&f->dst.sin6_port, p + off + 2U, sizeof(f->dst.sin6_port));
+	memcpy(&f->dst.sin6_addr, p + 24U, sizeof(f->dst.sin6_addr));
+	f->pl = p + off + UDP_HDRZ;
+	f->plz = ulen - UDP_HDRZ;
+	return 0;
+#else  /* !HAVE_LINUX_IF_PACKET_H */
+	(void)f;
+	(void)sll;
+	(void)pkt;
+	(void)z;
+	return -1;
+#endif	/* HAVE_LINUX_IF_PACKET_H */
+}
+
+#if defined HAVE_TPACKET_V3
+static size_t
+tpkt_frm(struct tpacket3_hdr *h, ud_tpkt_f cb, void *clo)
+{
+/* dissect the ipv6/udp datagram in H and call CB for it */
+	const struct sockaddr_ll *sll =
+		(const void*)((uint8_t*)h + TPACKET_ALIGN(sizeof(*h)));
+	size_t z = h->tp_snaplen - (h->tp_net - h->tp_mac);
+	struct ud_tpkt_frm_s f;
+
+	if (ud_tpkt_dissect(&f, sll, (uint8_t*)h + h->tp_net, z) < 0) {
+		return 0U;
+	}
+	f.ts = (struct timespec){h->tp_sec, h->tp_nsec};
+	cb(&f, clo);
+	return 1U;
+}
+#endif	/* HAVE_TPACKET_V3 */
+
+size_t
+ud_tpkt_walk(ud_tpkt_t t, ud_tpkt_f cb, void *clo)
+{
+	size_t res = 0U;
+
+#if defined HAVE_TPACKET_V3
+	for (;;) {
+		struct tpacket_block_desc *bd =
+			(void*)(t->ring + t->cur * t->blkz);
+		struct tpacket_hdr_v1 *bh = &bd->hdr.bh1;
+		uint8_t *p;
+
+		if (!(__atomic_load_n(&bh->block_status, __ATOMIC_ACQUIRE) &
+		      TP_STATUS_USER)) {
+			/* kernel's still filling this one */
+			break;
+		}
+		p = (uint8_t*)bd + bh->offset_to_first_pkt;
+		for (uint32_t i = 0U; i < bh->num_pkts; i++) {
+			struct tpacket3_hdr *h = (void*)p;
+
+			res += tpkt_frm(h, cb, clo);
+			p += h->tp_next_offset;
+		}
+		/* hand the block back */
+		__atomic_store_n(
+			&bh->block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		t->cur = (t->cur + 1U) % t->nblk;
+	}
+#else  /* !HAVE_TPACKET_V3 */
+	(void)t;
+	(void)cb;
+	(void)clo;
+#endif	/* HAVE_TPACKET_V3 */
+	return res;
+}
+
+/* ud-tpacket.c ends here */
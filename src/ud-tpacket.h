@@ -0,0 +1,101 @@
+/*** ud-tpacket.h -- capturing traffic off TPACKET_V3 rings
+ *
+ * Copyright (C) 2013 Sebastian Freundt
+ *
+ * Author:  Sebastian Freundt <freundt@ga-group.nl>
+ *
+ * This file is part of unserding.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+#if !defined INCLUDED_ud_tpacket_h_
+#define INCLUDED_ud_tpacket_h_
+
+#include <stddef.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif	/* __cplusplus */
+
+typedef struct ud_tpkt_s *ud_tpkt_t;
+
+struct sockaddr_ll;
+
+/**
+ * Captured udp datagram, pointing into the ring. */
+struct ud_tpkt_frm_s {
+	struct sockaddr_in6 src;
+	struct sockaddr_in6 dst;
+	/** the udp payload, i.e. the unserding packet */
+	void *pl;
+	size_t plz;
+	/** capture time */
+	struct timespec ts;
+};
+
+typedef void(*ud_tpkt_f)(const struct ud_tpkt_frm_s *frm, void *clo);
+
+/**
+ * Open a TPACKET_V3 ring on interface IFN (lo is fine) capturing ipv6
+ * udp traffic, takes CAP_NET_RAW.
+ * Poll `ud_tpkt_fd()' for reading, then `ud_tpkt_walk()' the ring. */
+extern ud_tpkt_t ud_tpkt_open(const char *ifn);
+
+/**
+ * Unmap and close the ring. */
+extern void ud_tpkt_close(ud_tpkt_t);
+
+/**
+ * Return the socket of the ring, for polling. */
+extern int ud_tpkt_fd(ud_tpkt_t);
+
+/**
+ * Call CB for every udp datagram in blocks the kernel has handed over,
+ * then give the blocks back.  Frames are only valid during CB.
+ * Return the number of datagrams seen. */
+extern size_t ud_tpkt_walk(ud_tpkt_t, ud_tpkt_f cb, void *clo);
+
+/**
+ * Dissect the frame PKT of size Z, as captured on a cooked packet
+ * socket with link layer info SLL, into FRM, all but its time stamp.
+ * Return 0 if it's a complete ipv6/udp datagram, -1 otherwise, as
+ * for looped back frames on their way out, fragments, and frames or
+ * datagrams cut short. */
+extern int
+ud_tpkt_dissect(
+	struct ud_tpkt_frm_s *restrict frm,
+	const struct sockaddr_ll *sll, void *pkt, size_t z);
+
+#if defined __cplusplus
+}
+#endif	/* __cplusplus */
+
+#endif	/* INCLUDED_ud_tpacket_h_ */
@@ -42,6 +42,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
 #if defined HAVE_SYS_TYPES_H
 # include <sys/types.h>
 #endif	/* HAVE_SYS_TYPES_H */
@@ -61,6 +63,30 @@
 # include <errno.h>
 #endif	/* HAVE_ERRNO_H */
 #include <sys/mman.h>
+#include <sys/stat.h>
+/* for flock() */
+#include <sys/file.h>
+/* for clock_gettime() */
+#include <time.h>
+#if defined HAVE_SYS_TIMERFD_H
+# include <sys/timerfd.h>
+#endif	/* HAVE_SYS_TIMERFD_H */
+#if defined HAVE_LINUX_NET_TSTAMP_H && defined HAVE_LINUX_ERRQUEUE_H
+# include <linux/net_tstamp.h>
+# include <linux/errqueue.h>
+# define HAVE_TX_TSTAMP
+#endif	/* HAVE_LINUX_NET_TSTAMP_H && HAVE_LINUX_ERRQUEUE_H */
+#if defined HAVE_LINUX_FILTER_H
+# include <linux/filter.h>
+#endif	/* HAVE_LINUX_FILTER_H */
+#if defined HAVE_FCNTL_H
+# include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+#include <poll.h>
+#if defined HAVE_LINUX_FUTEX_H
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif	/* HAVE_LINUX_FUTEX_H */
 
 /* our master include */
 #include "unserding.h"
@@ -68,6 +94,7 @@
 #include "ud-sock.h"
 #include "ud-sockaddr.h"
 #include "ud-private.h"
+#include "ud-crc32c.h"
 #include "boobs.h"
 
 #if !defined IPPROTO_IPV6
@@ -75,7 +102,6 @@
 #endif	/* IPPROTO_IPV6 */
 
 #if defined DEBUG_FLAG
-# include <stdio.h>
 # define UDEBUG(args...)	fprintf(stderr, args)
 # else	/* !DEBUG_FLAG */
 # define UDEBUG(args...)
@@ -89,12 +115,99 @@
 #define H3B_MTU		(1024U + 512U + 256U)
 /* control messages are shorter */
 #define CTRL_MTU	(80U)
+/* largest mtu we support */
+#define MAX_MTU		(65535U)
+/* ipv6 and udp headers, plus some room for extension headers,
+ * chosen so that an ethernet mtu of 1500 leaves us with ETH_MTU */
+#define PKT_OVERHEAD	(60U)
 
 #define UDP_MULTICAST_TTL	64
 
 /* magic string to identify unserding packets */
 #define UD_PROTO_INI	0x5544/*UD*/
 
+/* packet flavours, as put in the magic slot */
+#define UD_MAGIC_DATA	(0xda7aU)
+/* protocol v2, every message comes with its service,
+ * the lower octet is reserved for flags */
+#define UD_MAGIC_DATA2	(0xd200U)
+#define UD_MAGIC_V2_P(m)	(((m) & 0xff00U) == UD_MAGIC_DATA2)
+/* flags in the lower octet of v2 magics, packet ends in a crc32c */
+#define UD_MAGIC_CRC	(0x01U)
+#define CRC_Z		(sizeof(uint32_t))
+/* parity packets, see __fec_s */
+#define UD_MAGIC_FEC	(0xfec0U)
+
+/* tlv types, lower nibble of the first octet */
+#define UDPC_TYPE_DATA	(0x0cU)
+/* data with the service in front of it, for v2 packets */
+#define UDPC_TYPE_SDATA	(0x0dU)
+/* fragment of a large message, see __frag_s */
+#define UDPC_TYPE_FRAG	(0x0eU)
+/* tick record with the service in front, see __tick_enc() */
+#define UDPC_TYPE_TICK	(0x0fU)
+/* tlv lengths are 12 bits wide */
+#define MAX_TLVZ	(0xfffU)
+
+/* large messages, no more than this many bytes */
+#define MAX_LMSG	(16U * 1024U * 1024U)
+/* number of large messages under reassembly at any one time */
+#define NREASM		(16U)
+/* after this many milliseconds we give up on reassembling */
+#define REASM_TIMEOUT	(1000U)
+
+/* number of sources we track sequence numbers for, must be 2^n */
+#define NSEQ		(64U)
+/* probe this many slots before we evict */
+#define NSEQ_PROBE	(8U)
+/* sequence window, packets older than this are stale, unless this
+ * many in a row are consecutive, then the publisher's started over */
+#define SEQ_WIN		(64U)
+#define SEQ_NRST	(4U)
+
+/* packets kept for retransmission in reliable mode, by default */
+#define NHIST		(256U)
+#define MAX_NHIST	(4096U)
+/* subscribers hold back NAKs for up to this many ms, so that one
+ * NAK can do for all of them */
+#define NAK_BACKOFF	(8U)
+/* publishers retransmit a packet at most once in this many ms */
+#define NAK_HOLD	(20U)
+
+/* largest number of packets covered by one parity packet */
+#define MAX_NFEC	(64U)
+
+/* channels don't go further than this */
+#define MAX_NGROUP	(256U)
+
+/* node-local rings, must be the same for everyone on the node */
+#define SHM_NSLOT	(4096U)
+#define SHM_SLOTZ	(2048U)
+#define SHM_PKTZ	(SHM_SLOTZ - 16U)
+
+/* maximum number of receive slots per socket, cf. UIO_MAXIOV */
+#define MAX_NRECV	(1024U)
+/* maximum number of queued packets per socket, cf. UIO_MAXIOV */
+#define MAX_NSEND	(1024U)
+
+/* services per packet whose ticks are delta-encoded, beyond that
+ * they go against 0, must be the same for everyone */
+#define NTICK		(16U)
+/* 3 varints of 64 bits */
+#define TICK_MAXZ	(3U * 10U)
+/* ticks handed out by one `ud_chck_mmsg()' call at most */
+#define NBTICK		(256U)
+
+/* sockets in slabs start on cache lines of their own */
+#define SLAB_ALGN	(64U)
+/* hugepage size we ask for, slabs backed by them are multiples */
+#define HUGE_PGSZ	(2U * 1024U * 1024U)
+
+/* services per publisher whose packets jump the queue */
+#define NURG		(16U)
+/* token buckets count in millionths, so us times per-second rates fit */
+#define TK_ONE		(1000000LL)
+
 typedef struct __sock_s *__sock_t;
 
 struct ud_hdr_s {
@@ -114,6 +227,197 @@ union ud_buf_u {
 	uint8_t buf[ETH_MTU];
 };
 
+#if !defined HAVE_RECVMMSG || !defined HAVE_SENDMMSG
+/* we emulate recvmmsg() and sendmmsg() using a sequence of
+ * recvmsg() or sendmsg() calls respectively */
+# define mmsghdr	__mmsghdr_s
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif	/* !HAVE_RECVMMSG || !HAVE_SENDMMSG */
+
+/* ancillary data we're prepared to receive along with packets */
+#if defined IPV6_PATHMTU
+# define RCTL_MTU_Z	(CMSG_SPACE(sizeof(struct ip6_mtuinfo)))
+#else  /* !IPV6_PATHMTU */
+# define RCTL_MTU_Z	(CMSG_SPACE(sizeof(int)))
+#endif	/* IPV6_PATHMTU */
+#define RCTL_Z		(RCTL_MTU_Z + CMSG_SPACE(sizeof(struct timespec)) + \
+			 CMSG_SPACE(sizeof(uint32_t)))
+
+/* time (in ms) a grown receive buffer gets before growing again */
+#define RCVZ_HOLD	(100U)
+/* publishers look for path mtu notifications at most this often (ms) */
+#define PMTU_HOLD	(1000U)
+
+/* number of packets we remember for tx time stamps */
+#define NTXQ		(256U)
+
+/* fragment header, in front of every fragment's data, it's free of
+ * padding but sits unaligned in the packet, so memcpy it in and out */
+struct __frag_s {
+	ud_svc_t svc;
+	/* message id, the pno of the first fragment */
+	uint16_t fid;
+	/* fragment number and total number of fragments */
+	uint16_t fno;
+	uint16_t nfr;
+	/* total size of the message and offset of this fragment */
+	uint32_t tot;
+	uint32_t off;
+};
+
+/* large message under reassembly */
+struct __reasm_s {
+	struct sockaddr_in6 src;
+	uint16_t fid;
+	ud_svc_t svc;
+	uint16_t nfr;
+	/* number of fragments we've got so far */
+	uint16_t ngot;
+	uint32_t tot;
+	/* time of the last fragment, in ms */
+	uint64_t last;
+	/* the message proper, followed by a bitset of fragments */
+	uint8_t *buf;
+};
+
+/* sequence tracking per source */
+struct __seq_s {
+	struct in6_addr addr;
+	/* port in network byte order, 0 if slot is unused */
+	uint16_t port;
+	/* highest pno seen so far */
+	uint16_t hi;
+	/* bitset of pnos seen, bit i corresponds to HI - i */
+	uint64_t seen;
+	/* pno we've started tracking at */
+	uint16_t lo;
+	/* time a pending NAK is due, in ms, 0 if none */
+	uint64_t ndue;
+	/* pno expected next from a restarted publisher, and the number
+	 * of consecutive pnos before it that were out of the window */
+	uint16_t rst;
+	uint16_t nrst;
+	/* parity of packets since the last parity packet, NULL if the
+	 * source doesn't send parity packets */
+	uint8_t *facc;
+	size_t fmax;
+	/* pno of the packets covered by the next parity packet */
+	uint16_t fnext;
+	/* number of packets in FACC, xor of their pnos and lengths */
+	uint16_t fcnt;
+	uint16_t fpx;
+	uint16_t flen;
+	struct ud_stats_s st;
+};
+
+/* parity packet header, followed by the xor of the packets covered */
+struct __fec_s {
+	/* pno of the first packet covered */
+	uint16_t fid;
+	/* number of packets covered */
+	uint16_t n;
+	/* xor of the lengths of packets covered */
+	uint16_t len;
+	uint16_t rsvd;
+};
+
+/* negative acknowledgement, sent on the control channel */
+struct __nak_s {
+	/* publisher as seen by the subscriber, port in network order */
+	struct in6_addr addr;
+	uint16_t port;
+	/* highest pno seen */
+	uint16_t pno;
+	/* bitset of missing packets, bit i corresponds to PNO - i */
+	uint64_t miss;
+} __attribute__((packed));
+
+/* publisher's record of a sent packet */
+struct __hist_s {
+	uint16_t pno;
+	/* size of the packet, 0 if slot is unused */
+	uint32_t len;
+	/* time of the last retransmission, in ms */
+	uint64_t rtx;
+};
+
+/* slot in a node-local ring, SEQ is 2t + 1 while ticket t is being
+ * written and 2t + 2 once it's readable */
+struct __shm_slot_s {
+	uint64_t seq;
+	/* publisher id, as port of the source address */
+	uint16_t src;
+	uint16_t len;
+	uint32_t rsvd;
+	uint8_t buf[SHM_PKTZ];
+};
+
+/* node-local ring, one per port, zeroes are a valid initial state */
+struct __shm_s {
+	/* publisher ids handed out */
+	uint32_t npub;
+	/* futex word, bumped on every flush, number of sleepers on it */
+	uint32_t wake;
+	uint32_t nwait;
+	/* next ticket, on a cache line of its own */
+	uint64_t __attribute__((aligned(64))) head;
+	struct __shm_slot_s __attribute__((aligned(64))) slot[SHM_NSLOT];
+};
+
+/* multicast group for a share of the channels */
+struct __grp_s {
+	struct ud_sockaddr_s dst[1];
+	/* our membership, and the number of channels joined through it */
+	struct ipv6_mreq memb[1];
+	unsigned int nref;
+};
+
+/* last tick of a service within the current packet */
+struct __tick_s {
+	ud_svc_t svc;
+	struct ud_tick_s last;
+};
+
+/* handler of a service, see `ud_disp_on()' */
+struct __dent_s {
+	ud_disp_f cb;
+	void *clo;
+};
+
+/* handlers of the services of a channel, services without one of
+ * their own carry a copy of the channel's, OWN tells them apart */
+struct __dchn_s {
+	struct __dent_s e[0x100U];
+	struct __dent_s any;
+	uint64_t own[4U];
+};
+
+/* handlers of all channels, unused ones point at a channel of nops */
+struct __disp_s {
+	struct __dchn_s *chn[0x100U];
+};
+
+/* mapping that bulk opened sockets are packed into */
+struct __slab_s {
+	/* size of the mapping */
+	size_t z;
+	/* offset of the first unused byte */
+	size_t off;
+	/* sockets living here, plus one while the slab is being filled */
+	unsigned int nref;
+};
+
+/* state of a bulk open */
+struct __bulk_s {
+	struct __slab_s *slab;
+	/* number of sockets still to come, including the current one */
+	size_t nleft;
+	bool hugep;
+};
+
 union ud_ctrl_u {
 	struct {
 		struct ud_hdr_s hdr;
@@ -130,6 +434,7 @@ struct __sock_s {
 		/* non const version of PUB */
 		struct {
 			int fd;
+			int tfd;
 			uint32_t fl;
 			const void *data;
 			char priv[];
@@ -146,8 +451,18 @@ struct __sock_s {
 	int pno;
 	/* service we're after */
 	ud_svc_t svc;
+	/* whether the current packet mixes services (v2 only) */
+	bool mixd;
+	/* time by which packs must be flushed, in us, 0 if not armed */
+	uint64_t due;
+	/* kernel time stamp of the current packet */
+	struct timespec rts;
+	/* pnos of packets sent, by tx time stamp id */
+	uint32_t ntx;
+	uint16_t txpno[NTXQ];
 
-	struct ud_sockaddr_s src[1];
+	/* source of the current packet, points into the receive ring */
+	struct ud_sockaddr_s *src;
 	struct ud_sockaddr_s dst[1];
 
 	/* our membership */
@@ -157,13 +472,128 @@ struct __sock_s {
 	size_t nrd;
 	/** offset to which packet has been checked (in B) */
 	size_t nck;
-	union ud_buf_u ALGN16(recv);
+	/** current receive buffer, points into the receive ring */
+	union ud_buf_u *recv;
+
+	/** size of every packet buffer, in either direction (in B) */
+	size_t bufz;
+	/** maximum size of packets to send (in B), at most BUFZ */
+	size_t mtu;
+	/** time (in ms) we last looked for path mtu notifications */
+	uint64_t pmtut;
+
+	/** number of receive slots, number of filled ones, current one */
+	unsigned int nrs;
+	unsigned int nrf;
+	unsigned int irs;
+	/** the receive ring proper, all of them NRS long */
+	uint8_t *rbuf;
+	struct mmsghdr *rmsg;
+	struct iovec *riov;
+	struct ud_sockaddr_s *rsrc;
+	uint8_t *rctl;
+
+	/** large messages being reassembled, NREASM of them, NULL until
+	 * the first fragment comes in */
+	struct __reasm_s *reasm;
+	/** large message handed out by the last `ud_chck_msg()' */
+	uint8_t *lbuf;
+
+	/** sequence tracking, per source and overall, NSEQ sources,
+	 * NULL until the first packet comes in */
+	struct __seq_s *seq;
+	struct ud_stats_s st;
+
+	/** how subscribers see us, for NAKs */
+	struct sockaddr_in6 self;
+	/** state for randomised NAK back-offs */
+	uint32_t rnd;
+	/** time the earliest pending NAK is due, in ms, 0 if none */
+	uint64_t nakt;
+	/** number of packets kept for retransmission */
+	unsigned int nhs;
+	/** the history proper, NHS long */
+	uint8_t *hbuf;
+	struct __hist_s *hist;
+
+	/** node-local ring, NULL if we're on the wire, and its shm fd */
+	struct __shm_s *shm;
+	int shfd;
+	/** next ticket to read off SHM, our publisher id */
+	uint64_t shr;
+	uint16_t shid;
+
+	/** whether packets are injected rather than read off the wire,
+	 * and the source of the injected packet */
+	bool tap;
+	struct ud_sockaddr_s isrc[1];
+	/** whether a filter's attached, the kernel counts what it drops */
+	bool filt;
+
+	/** the kernel's drop counter as last seen,
+	 * and the time (in ms) the receive buffer last grew */
+	uint32_t ovfl;
+	uint64_t rcvt;
+
+	/** groups channels are spread over, NULL if all go to DST */
+	struct __grp_s *grp;
+	/** channels joined, as bitset */
+	uint64_t chn[4U];
+
+	/** tick deltas of the packet being packed, and being checked,
+	 * and the tick handed out by the last `ud_chck_msg()' */
+	unsigned int nstk;
+	unsigned int nrtk;
+	struct __tick_s stk[NTICK];
+	struct __tick_s rtk[NTICK];
+	struct ud_tick_s rtick;
+	/** ticks handed out by the last `ud_chck_mmsg()', NBTICK long */
+	struct ud_tick_s *btick;
+	/** handlers for `ud_disp_run()', NULL until the first one */
+	struct __disp_s *disp;
+
+	/** token buckets of paced publishers, octets and packets in
+	 * millionths, negative when in debt, and the time of the last
+	 * top-up (in us) */
+	int64_t tkb;
+	int64_t tkp;
+	uint64_t tkt;
+	/** time (in us) held back packets may go, 0 if none are held */
+	uint64_t pdue;
+	/** services whose packets go past the queue, see `ud_set_prio()' */
+	unsigned int nurg;
+	ud_svc_t urg[NURG];
+
+	/** parity of the packets since the last parity packet */
+	uint8_t *facc;
+	size_t fmax;
+	/** number of packets in FACC, the first one's pno, xor of lengths */
+	unsigned int nfc;
+	uint16_t ffid;
+	uint16_t flen;
 
 	/** total number of sent bytes in buffer */
 	size_t nwr;
 	/** offset to which packet has been packed (in B) */
 	size_t npk;
-	union ud_buf_u ALGN16(send);
+	/** current send buffer, points into the send queue */
+	union ud_buf_u *send;
+
+	/** number of send slots, queued packets, first unsent packet */
+	unsigned int nss;
+	unsigned int nsq;
+	unsigned int isq;
+	/** the send queue proper, all of them NSS long */
+	uint8_t *sbuf;
+	struct mmsghdr *smsg;
+	struct iovec *siov;
+
+	/** size of this object, including the rings */
+	size_t z;
+	/** slab we're packed into, NULL if we're a mapping of our own */
+	struct __slab_s *slab;
+	/* receive ring and send queue go here */
+	uint8_t ALGN16(ring[]);
 };
 
 
@@ -186,6 +616,523 @@ munmap_mem(void *p, size_t z)
 	return;
 }
 
+static struct __slab_s*
+slab_new(size_t z, bool hugep)
+{
+	static size_t pgsz;
+	struct __slab_s *res = MAP_FAILED;
+
+	if (UNLIKELY(!pgsz)) {
+		pgsz = sysconf(_SC_PAGESIZE);
+	}
+	z = hugep ? ROUND(z, HUGE_PGSZ) : ROUND(z, pgsz);
+#if defined MAP_HUGETLB
+	if (hugep) {
+		/* only works with hugepages reserved by the admin */
+		res = mmap(NULL, z, PROT_MEM, MAP_MEM | MAP_HUGETLB, -1, 0);
+	}
+#endif	/* MAP_HUGETLB */
+	if (res == MAP_FAILED) {
+		if (UNLIKELY((res = mmap_mem(z)) == NULL)) {
+			return NULL;
+		}
+#if defined MADV_HUGEPAGE
+		if (hugep) {
+			/* try transparent ones then */
+			(void)madvise(res, z, MADV_HUGEPAGE);
+		}
+#endif	/* MADV_HUGEPAGE */
+	}
+	res->z = z;
+	res->off = ROUND(sizeof(*res), SLAB_ALGN);
+	res->nref = 1U;
+	return res;
+}
+
+static void
+slab_unref(struct __slab_s *s)
+{
+	if (__atomic_sub_fetch(&s->nref, 1U, __ATOMIC_ACQ_REL) == 0U) {
+		munmap_mem(s, s->z);
+	}
+	return;
+}
+
+static __sock_t
+sock_alloc(struct __bulk_s *b, size_t z)
+{
+/* memory for a socket object of size Z, packed into B's slab if given */
+	__sock_t res;
+
+	if (b == NULL) {
+		if (UNLIKELY((res = mmap_mem(z)) == NULL)) {
+			return NULL;
+		}
+		res->z = z;
+		res->slab = NULL;
+		return res;
+	}
+
+	z = ROUND(z, SLAB_ALGN);
+	if (b->slab == NULL || b->slab->off + z > b->slab->z) {
+		/* room for the rest of the bulk */
+		size_t sz = ROUND(sizeof(*b->slab), SLAB_ALGN) + b->nleft * z;
+		struct __slab_s *new;
+
+		if (UNLIKELY((new = slab_new(sz, b->hugep)) == NULL)) {
+			return NULL;
+		} else if (b->slab != NULL) {
+			slab_unref(b->slab);
+		}
+		b->slab = new;
+	}
+	res = (void*)((uint8_t*)b->slab + b->slab->off);
+	b->slab->off += z;
+	__atomic_add_fetch(&b->slab->nref, 1U, __ATOMIC_RELAXED);
+	res->z = z;
+	res->slab = b->slab;
+	return res;
+}
+
+static void
+sock_free(__sock_t us)
+{
+	if (us->slab != NULL) {
+		slab_unref(us->slab);
+		return;
+	}
+	munmap_mem(us, us->z);
+	return;
+}
+
+static inline uint64_t
+__now_ms(void)
+{
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsp);
+	return tsp.tv_sec * 1000ULL + tsp.tv_nsec / 1000000ULL;
+}
+
+static inline uint64_t
+__now_us(void)
+{
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsp);
+	return tsp.tv_sec * 1000000ULL + tsp.tv_nsec / 1000ULL;
+}
+
+static inline union ud_buf_u*
+__rslot(__sock_t us, unsigned int i)
+{
+	return (void*)(us->rbuf + i * us->bufz);
+}
+
+static inline union ud_buf_u*
+__sslot(__sock_t us, unsigned int i)
+{
+	return (void*)(us->sbuf + i * us->bufz);
+}
+
+static size_t
+rring_size(unsigned int nrs, size_t bufz)
+{
+	size_t z = 0U;
+
+	z += nrs * bufz;
+	z += nrs * sizeof(struct mmsghdr);
+	z += nrs * sizeof(struct iovec);
+	z += nrs * sizeof(struct ud_sockaddr_s);
+	z += nrs * ROUND(RCTL_Z, 16U);
+	return z;
+}
+
+static uint8_t*
+rring_init(__sock_t us, uint8_t *p, unsigned int nrs)
+{
+	/* buffers first, they're the ones that need aligning */
+	us->rbuf = p;
+	p += nrs * us->bufz;
+	us->rctl = p;
+	p += nrs * ROUND(RCTL_Z, 16U);
+	us->rmsg = (void*)p;
+	p += nrs * sizeof(*us->rmsg);
+	us->riov = (void*)p;
+	p += nrs * sizeof(*us->riov);
+	us->rsrc = (void*)p;
+	p += nrs * sizeof(*us->rsrc);
+
+	for (unsigned int i = 0; i < nrs; i++) {
+		us->riov[i].iov_base = __rslot(us, i)->buf;
+		us->riov[i].iov_len = us->bufz;
+		us->rmsg[i].msg_hdr = (struct msghdr){
+			.msg_name = &us->rsrc[i].sa,
+			.msg_namelen = sizeof(us->rsrc[i].sa),
+			.msg_iov = us->riov + i,
+			.msg_iovlen = 1U,
+			.msg_control = us->rctl + i * ROUND(RCTL_Z, 16U),
+			.msg_controllen = RCTL_Z,
+		};
+		us->rsrc[i].sz = sizeof(us->rsrc[i].sa);
+	}
+
+	us->nrs = nrs;
+	us->nrf = 0U;
+	us->irs = 0U;
+	us->recv = __rslot(us, 0U);
+	us->src = us->rsrc;
+	return p;
+}
+
+static inline union ud_buf_u*
+__hslot(__sock_t us, unsigned int i)
+{
+	return (void*)(us->hbuf + i * us->bufz);
+}
+
+static size_t
+hring_size(unsigned int nhs, size_t bufz)
+{
+	size_t z = 0U;
+
+	z += nhs * bufz;
+	z += nhs * sizeof(struct __hist_s);
+	return z;
+}
+
+static uint8_t*
+hring_init(__sock_t us, uint8_t *p, unsigned int nhs)
+{
+	us->hbuf = p;
+	p += nhs * us->bufz;
+	us->hist = (void*)p;
+	p += nhs * sizeof(*us->hist);
+	us->nhs = nhs;
+	return p;
+}
+
+static int
+grp_addr(struct in6_addr *restrict a, const char *addr, unsigned int i)
+{
+/* put the I-th group of the range starting at ADDR into A, return -1
+ * if ADDR is no multicast address or the range runs out before I */
+	uint8_t *b = a->s6_addr;
+
+	if (inet_pton(AF_INET6, addr, a) <= 0) {
+		return -1;
+	} else if (!IN6_IS_ADDR_MULTICAST(a)) {
+		return -1;
+	}
+	/* add with carry, flags and scope stay put */
+	for (size_t j = 16U; i && j-- > 2U; i >>= 8U) {
+		i += b[j];
+		b[j] = (uint8_t)(i & 0xffU);
+	}
+	return i ? -1 : 0;
+}
+
+static uint8_t*
+grp_init(__sock_t us, uint8_t *p, unsigned int ngrp)
+{
+	const struct sockaddr_in6 *base = &us->dst->sa.sa6;
+	const char *addr = us->opt.group_addr;
+
+	if (ngrp == 0U) {
+		us->grp = NULL;
+		return p;
+	}
+	us->grp = (void*)p;
+	p += ngrp * sizeof(*us->grp);
+
+	for (unsigned int i = 0; i < ngrp; i++) {
+		struct ud_sockaddr_s *sa = us->grp[i].dst;
+
+		*sa = *us->dst;
+		/* channel share I goes to ADDR + I, checked in __socket() */
+		(void)grp_addr(&sa->sa.sa6.sin6_addr, addr, i);
+		/* scope and port like the main group */
+		sa->sa.sa6.sin6_scope_id = base->sin6_scope_id;
+		us->grp[i].memb->ipv6mr_multiaddr = sa->sa.sa6.sin6_addr;
+		us->grp[i].memb->ipv6mr_interface = base->sin6_scope_id;
+		us->grp[i].nref = 0U;
+	}
+	return p;
+}
+
+static inline struct ud_sockaddr_s*
+__grp_dst(__sock_t us, ud_svc_t svc)
+{
+/* destination of packets of service SVC */
+	if (us->grp == NULL || UD_CHN(svc) == UD_CHN_CTRL) {
+		return us->dst;
+	}
+	return us->grp[UD_CHN(svc) % us->opt.ngroup].dst;
+}
+
+static size_t
+sring_size(unsigned int nss, size_t bufz)
+{
+	size_t z = 0U;
+
+	z += nss * bufz;
+	z += nss * sizeof(struct mmsghdr);
+	z += nss * sizeof(struct iovec);
+	return z;
+}
+
+static uint8_t*
+sring_init(__sock_t us, uint8_t *p, unsigned int nss)
+{
+	/* buffers first again */
+	us->sbuf = p;
+	p += nss * us->bufz;
+	us->smsg = (void*)p;
+	p += nss * sizeof(*us->smsg);
+	us->siov = (void*)p;
+	p += nss * sizeof(*us->siov);
+
+	/* the last one's spare, see __send_now() */
+	nss--;
+	for (unsigned int i = 0; i <= nss; i++) {
+		us->siov[i].iov_base = __sslot(us, i)->buf;
+		us->siov[i].iov_len = 0U;
+		us->smsg[i].msg_hdr = (struct msghdr){
+			.msg_name = &us->dst->sa,
+			.msg_namelen = us->dst->sz,
+			.msg_iov = us->siov + i,
+			.msg_iovlen = 1U,
+		};
+	}
+
+	us->nss = nss;
+	us->nsq = 0U;
+	us->isq = 0U;
+	us->send = __sslot(us, 0U);
+	return p;
+}
+
+/* node-local transport */
+static struct __shm_s*
+shm_attach(short unsigned int port, int *restrict fdp)
+{
+/* map the ring of PORT, its fd goes to FDP, attached sockets hold a
+ * shared lock on it, so the last one out knows to unlink it */
+#if defined HAVE_SHM_OPEN
+	struct __shm_s *res;
+	struct stat st;
+	char nm[32U];
+	int fd;
+
+	snprintf(nm, sizeof(nm), "/unserding.%hu", port);
+again:
+	if ((fd = shm_open(nm, O_RDWR | O_CREAT, 0600)) < 0) {
+		return NULL;
+	} else if (flock(fd, LOCK_SH) < 0) {
+		goto clos_out;
+	} else if (fstat(fd, &st) < 0) {
+		goto clos_out;
+	} else if (st.st_nlink == 0U) {
+		/* the last one out unlinked it between our open and lock */
+		close(fd);
+		goto again;
+	} else if (st.st_size == 0 && ftruncate(fd, sizeof(*res)) < 0) {
+		/* first one here sizes it, zeroes are fine to start with */
+		goto clos_out;
+	} else if ((size_t)st.st_size > 0U &&
+		   (size_t)st.st_size != sizeof(*res)) {
+		/* someone else's layout */
+		goto clos_out;
+	}
+	res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (UNLIKELY(res == MAP_FAILED)) {
+		goto clos_out;
+	}
+	*fdp = fd;
+	return res;
+clos_out:
+	close(fd);
+#else  /* !HAVE_SHM_OPEN */
+	(void)port;
+	(void)fdp;
+#endif	/* HAVE_SHM_OPEN */
+	return NULL;
+}
+
+static void
+shm_detach(struct __shm_s *shm, int fd, short unsigned int port)
+{
+	munmap(shm, sizeof(*shm));
+#if defined HAVE_SHM_OPEN
+	if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+		/* nobody else attached, the ring goes with us */
+		char nm[32U];
+
+		snprintf(nm, sizeof(nm), "/unserding.%hu", port);
+		shm_unlink(nm);
+	}
+#else  /* !HAVE_SHM_OPEN */
+	(void)port;
+#endif	/* HAVE_SHM_OPEN */
+	close(fd);
+	return;
+}
+
+static void
+__shm_wake(struct __shm_s *shm)
+{
+/* tell sleepers there's something new */
+	__atomic_add_fetch(&shm->wake, 1U, __ATOMIC_SEQ_CST);
+#if defined HAVE_LINUX_FUTEX_H
+	if (__atomic_load_n(&shm->nwait, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &shm->wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+#endif	/* HAVE_LINUX_FUTEX_H */
+	return;
+}
+
+static int
+__shm_wait(__sock_t us, int timeout)
+{
+/* like poll() but for node-local rings */
+	struct __shm_s *shm = us->shm;
+	uint32_t w;
+	int res;
+
+	__atomic_add_fetch(&shm->nwait, 1U, __ATOMIC_SEQ_CST);
+	w = __atomic_load_n(&shm->wake, __ATOMIC_SEQ_CST);
+	if ((res = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) > us->shr)) {
+		;
+	} else if (timeout != 0) {
+		struct timespec ts = {
+			timeout / 1000, (timeout % 1000) * 1000000L,
+		};
+#if defined HAVE_LINUX_FUTEX_H
+		/* a wake between W and here makes this return at once */
+		syscall(SYS_futex, &shm->wake, FUTEX_WAIT, w,
+			timeout > 0 ? &ts : NULL, NULL, 0);
+#else  /* !HAVE_LINUX_FUTEX_H */
+		/* nap and have another look */
+		(void)w;
+		ts = (struct timespec){0, 100000L};
+		nanosleep(&ts, NULL);
+#endif	/* HAVE_LINUX_FUTEX_H */
+		res = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) > us->shr;
+	}
+	__atomic_sub_fetch(&shm->nwait, 1U, __ATOMIC_SEQ_CST);
+	return res;
+}
+
+static int
+__shm_put(__sock_t us, const void *b, size_t z)
+{
+/* put packet B of size Z on the node-local ring */
+	struct __shm_s *shm = us->shm;
+	struct __shm_slot_s *s;
+	uint64_t t;
+
+	if (UNLIKELY(z > SHM_PKTZ)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	t = __atomic_fetch_add(&shm->head, 1U, __ATOMIC_RELAXED);
+	s = shm->slot + t % SHM_NSLOT;
+	__atomic_store_n(&s->seq, 2U * t + 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->src = us->shid;
+	s->len = (uint16_t)z;
+	memcpy(s->buf, b, z);
+	__atomic_store_n(&s->seq, 2U * t + 2U, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int
+__shm_fill(__sock_t us)
+{
+/* like rring_fill() but off the node-local ring */
+	struct __shm_s *shm = us->shm;
+	uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+	unsigned int n = 0U;
+
+	if (head - us->shr > SHM_NSLOT) {
+		/* we've been lapped, pnos will tell what's lost */
+		us->shr = head - SHM_NSLOT;
+	}
+	for (; n < us->nrs && us->shr < head; us->shr++) {
+		const struct __shm_slot_s *s = shm->slot + us->shr % SHM_NSLOT;
+		const uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		struct mmsghdr *m = us->rmsg + n;
+		uint16_t src;
+		size_t z;
+
+		if (seq < 2U * us->shr + 2U) {
+			if (head - us->shr < SHM_NSLOT / 2U) {
+				/* still being written, come back later */
+				break;
+			}
+			/* writer must have died, skip it */
+			continue;
+		} else if (seq > 2U * us->shr + 2U) {
+			/* overwritten already */
+			continue;
+		}
+		src = s->src;
+		z = s->len;
+		m->msg_hdr.msg_flags = z > us->bufz ? MSG_TRUNC : 0;
+		z = z < us->bufz ? z : us->bufz;
+		memcpy(__rslot(us, n)->buf, s->buf, z);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+			/* overwritten while we were copying */
+			continue;
+		}
+		m->msg_len = (unsigned int)z;
+		m->msg_hdr.msg_controllen = 0U;
+		m->msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+		us->rsrc[n].sa.sa6 = (struct sockaddr_in6){
+			.sin6_family = AF_INET6,
+			.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+			.sin6_port = htons(src),
+		};
+		n++;
+	}
+	return n > 0U ? (int)n : -1;
+}
+
+static int
+rring_fill(__sock_t us)
+{
+/* fill the receive ring, return the number of datagrams read */
+	int n;
+
+	if (us->shm != NULL) {
+		return __shm_fill(us);
+	} else if (us->tap) {
+		/* packets come through ud_inject() */
+		return -1;
+	}
+	for (unsigned int i = 0; i < us->nrs; i++) {
+		us->rmsg[i].msg_hdr.msg_namelen = sizeof(us->rsrc[i].sa);
+		us->rmsg[i].msg_hdr.msg_controllen = RCTL_Z;
+	}
+#if defined HAVE_RECVMMSG
+	n = recvmmsg(us->fd, us->rmsg, us->nrs, 0, NULL);
+#else  /* !HAVE_RECVMMSG */
+	for (n = 0; (unsigned int)n < us->nrs; n++) {
+		ssize_t nrd;
+
+		if ((nrd = recvmsg(us->fd, &us->rmsg[n].msg_hdr, 0)) < 0) {
+			break;
+		}
+		us->rmsg[n].msg_len = (unsigned int)nrd;
+	}
+	if (n == 0) {
+		n = -1;
+	}
+#endif	/* HAVE_RECVMMSG */
+	return n;
+}
+
 
 static int
 mc6_loop(int s, int on)
@@ -288,10 +1235,31 @@ mc6_set_pub(int s)
 		},
 	};
 
+#if defined IPV6_DONTFRAG
+	/* rather be told than to fragment, see __send_q() */
+	setsockopt_int(s, IPPROTO_IPV6, IPV6_DONTFRAG, 1);
+#endif	/* IPV6_DONTFRAG */
+#if defined IPV6_RECVPATHMTU
+	/* obtain path mtu to send maximum non-fragmented packet */
+	setsockopt_int(s, IPPROTO_IPV6, IPV6_RECVPATHMTU, 1);
+#endif	/* IPV6_RECVPATHMTU */
+
 	/* as a courtesy to tools bind the channel */
 	return bind(s, &sa.sa, sizeof(sa));
 }
 
+static size_t
+mc6_pktz(size_t mtu)
+{
+/* turn MTU into a packet size that we can live with */
+	if (mtu < MIN_MTU) {
+		mtu = MIN_MTU;
+	} else if (mtu > MAX_MTU) {
+		mtu = MAX_MTU;
+	}
+	return mtu - PKT_OVERHEAD;
+}
+
 static int
 mc6_set_sub(int s, short unsigned int port)
 {
@@ -358,18 +1326,267 @@ mc6_unset_sub(int s)
 }
 
 
-/* implementation of public interface */
-ud_sock_t
-ud_socket(struct ud_sockopt_s opt)
+static void
+__set_mtu(__sock_t us, size_t mtu)
 {
-	__sock_t res;
-	int s = -1;
-	int s2 = -1;
+	size_t z = mc6_pktz(mtu);
+	size_t max = mc6_pktz(us->opt.mtu);
 
-#define MODE_SUBP(fl)	(fl & UD_SUB)
-#define MODE_PUBP(fl)	(fl & UD_PUB)
+	us->mtu = z < max ? z : max;
+	return;
+}
 
-	/* check if someone tries to trick us */
+static void
+__pmtu_upd(__sock_t us)
+{
+/* ask the kernel about the path mtu towards our destination */
+#if defined IPV6_MTU
+	int mtu;
+
+	if ((mtu = getsockopt_int(us->fd_send, IPPROTO_IPV6, IPV6_MTU)) > 0) {
+		__set_mtu(us, mtu);
+	}
+#endif	/* IPV6_MTU */
+	return;
+}
+
+static void
+__pmtu_chck(__sock_t us)
+{
+/* take path mtu notifications off the sending socket, the kernel
+ * leaves them there when a packet didn't fit, e.g. when sent past the
+ * queue, they come before any datagram and we only peek at those */
+#if defined IPV6_RECVPATHMTU && defined IPV6_PATHMTU
+	const uint64_t now = __now_ms();
+
+	if (LIKELY(now < us->pmtut + PMTU_HOLD)) {
+		return;
+	}
+	us->pmtut = now;
+	for (;;) {
+		uint8_t ALGN16(ctl[RCTL_MTU_Z]);
+		struct msghdr m = {
+			.msg_control = ctl,
+			.msg_controllen = sizeof(ctl),
+		};
+		struct cmsghdr *c;
+		struct ip6_mtuinfo mi;
+
+		if (recvmsg(us->fd_send, &m, MSG_DONTWAIT | MSG_PEEK) < 0) {
+			break;
+		} else if ((c = CMSG_FIRSTHDR(&m)) == NULL ||
+			   c->cmsg_level != IPPROTO_IPV6 ||
+			   c->cmsg_type != IPV6_PATHMTU) {
+			/* a proper datagram, not for us */
+			break;
+		}
+		memcpy(&mi, CMSG_DATA(c), sizeof(mi));
+		__set_mtu(us, mi.ip6m_mtu);
+	}
+#else  /* !IPV6_RECVPATHMTU || !IPV6_PATHMTU */
+	(void)us;
+#endif	/* IPV6_RECVPATHMTU && IPV6_PATHMTU */
+	return;
+}
+
+static inline bool
+__paced_p(__sock_t us)
+{
+	return us->opt.rate > 0U || us->opt.pkt_rate > 0U;
+}
+
+static void
+__pace_fill(__sock_t us, uint64_t now)
+{
+/* top up the buckets for the time since the last top-up */
+	uint64_t dt = now - us->tkt;
+
+	/* beyond that the products overflow, no bucket's that deep */
+	if (dt > 1000000000U) {
+		dt = 1000000000U;
+	}
+	us->tkt = now;
+	if (us->opt.rate) {
+		const int64_t cap =
+			(int64_t)(us->opt.burst * us->mtu) * TK_ONE;
+
+		us->tkb += (int64_t)(dt * us->opt.rate);
+		us->tkb = us->tkb < cap ? us->tkb : cap;
+	}
+	if (us->opt.pkt_rate) {
+		const int64_t cap = us->opt.burst * TK_ONE;
+
+		us->tkp += (int64_t)(dt * us->opt.pkt_rate);
+		us->tkp = us->tkp < cap ? us->tkp : cap;
+	}
+	return;
+}
+
+static inline void
+__pace_take(__sock_t us, size_t z)
+{
+/* charge the buckets for a packet of size Z */
+	if (us->opt.rate) {
+		us->tkb -= (int64_t)z * TK_ONE;
+	}
+	if (us->opt.pkt_rate) {
+		us->tkp -= TK_ONE;
+	}
+	return;
+}
+
+static unsigned int
+__pace_n(__sock_t us, unsigned int n)
+{
+/* number of the N queued packets from ISQ onwards that may go now,
+ * a packet goes as long as there's anything in the buckets, debts
+ * are paid off by those coming after */
+	int64_t b;
+	int64_t p;
+	unsigned int i;
+
+	__pace_fill(us, __now_us());
+	/* buckets of rates not limited never run dry */
+	b = us->opt.rate ? us->tkb : 1;
+	p = us->opt.pkt_rate ? us->tkp : 1;
+	for (i = 0U; i < n && b > 0 && p > 0; i++) {
+		if (us->opt.rate) {
+			b -= (int64_t)us->siov[us->isq + i].iov_len * TK_ONE;
+		}
+		if (us->opt.pkt_rate) {
+			p -= TK_ONE;
+		}
+	}
+	return i;
+}
+
+static uint64_t
+__pace_wait(__sock_t us)
+{
+/* time (in us) till the buckets are out of debt */
+	uint64_t res = 0U;
+
+	if (us->opt.rate && us->tkb <= 0) {
+		res = (uint64_t)-us->tkb / us->opt.rate + 1U;
+	}
+	if (us->opt.pkt_rate && us->tkp <= 0) {
+		uint64_t w = (uint64_t)-us->tkp / us->opt.pkt_rate + 1U;
+
+		res = w > res ? w : res;
+	}
+	return res;
+}
+
+static void
+__tmr_arm(__sock_t us)
+{
+/* arm the timer for the flush deadline or the time held back packets
+ * may go, whichever's earlier, or disarm if neither is pending */
+#if defined HAVE_SYS_TIMERFD_H
+	if (us->tfd >= 0) {
+		uint64_t t = us->due;
+		struct itimerspec its = {.it_interval = {0, 0}};
+
+		if (us->pdue && (!t || us->pdue < t)) {
+			t = us->pdue;
+		}
+		if (us->nakt && (!t || us->nakt * 1000U < t)) {
+			t = us->nakt * 1000U;
+		}
+		/* disarming resets the expiry count too */
+		its.it_value = (struct timespec){
+			.tv_sec = t / 1000000U,
+			.tv_nsec = t % 1000000U * 1000U,
+		};
+		(void)timerfd_settime(us->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+#endif	/* HAVE_SYS_TIMERFD_H */
+	return;
+}
+
+static void
+__kpace(__sock_t us)
+{
+/* have the kernel pace us as well, with the fq qdisc that spreads
+ * what the buckets let go at once over the wire, but it paces by
+ * socket so urgent packets would queue up behind the rest */
+#if defined SO_MAX_PACING_RATE
+	if (us->opt.rate > 0U && us->shm == NULL) {
+		const int r = us->nurg ? -1/*unlimited*/ : (int)us->opt.rate;
+
+		setsockopt_int(us->fd_send, SOL_SOCKET, SO_MAX_PACING_RATE, r);
+	}
+#else  /* !SO_MAX_PACING_RATE */
+	(void)us;
+#endif	/* SO_MAX_PACING_RATE */
+	return;
+}
+
+
+/* dispatch tables */
+static void
+__disp_nop(
+	ud_sock_t UNUSED(s), const struct ud_msg_s *UNUSED(msg),
+	void *UNUSED(clo))
+{
+	return;
+}
+
+/* shared by all sockets, never written to, so set up at compile time */
+static struct __dchn_s __dnop = {
+	.e = {[0 ... 0xffU] = {__disp_nop, NULL}},
+	.any = {__disp_nop, NULL},
+};
+
+static struct __dchn_s*
+__disp_chn(__sock_t us, unsigned int c)
+{
+/* return the handlers of channel C, set up if need be */
+	struct __dchn_s *dc;
+
+	if (UNLIKELY(us->disp == NULL)) {
+		if ((us->disp = malloc(sizeof(*us->disp))) == NULL) {
+			return NULL;
+		}
+		for (size_t i = 0; i < countof(us->disp->chn); i++) {
+			us->disp->chn[i] = &__dnop;
+		}
+	}
+	if ((dc = us->disp->chn[c]) == &__dnop) {
+		if ((dc = malloc(sizeof(*dc))) == NULL) {
+			return NULL;
+		}
+		/* all nops, none of them the services' own */
+		*dc = __dnop;
+		us->disp->chn[c] = dc;
+	}
+	return dc;
+}
+
+static void
+__disp_free(struct __disp_s *d)
+{
+	for (size_t i = 0; i < countof(d->chn); i++) {
+		if (d->chn[i] != &__dnop) {
+			free(d->chn[i]);
+		}
+	}
+	free(d);
+	return;
+}
+
+/* implementation of public interface */
+static ud_sock_t
+__socket(struct ud_sockopt_s opt, struct __bulk_s *b)
+{
+	__sock_t res;
+	int s = -1;
+	int s2 = -1;
+
+#define MODE_SUBP(fl)	(fl & UD_SUB)
+#define MODE_PUBP(fl)	(fl & UD_PUB)
+
+	/* check if someone tries to trick us */
 	if (UNLIKELY(opt.mode == UD_NONE)) {
 		goto out;
 	}
@@ -380,9 +1597,18 @@ ud_socket(struct ud_sockopt_s opt)
 	if (opt.port == 0) {
 		opt.port = UD_NETWORK_SERVICE;
 	}
+	if (opt.mode_opt & UD_MOPT_CRC) {
+		/* only v2 magics have room for flags */
+		opt.mode_opt |= UD_MOPT_PROTO2;
+	}
 
 	/* do all the socket magic first, so we don't waste memory */
-	if (UNLIKELY((s = s2 = mc6_socket()) < 0)) {
+	if (opt.mode_opt & UD_MOPT_SHM) {
+		/* no sockets at all, the ring is attached below */
+		if (opt.mode_opt & UD_MOPT_RELIABLE || opt.ngroup > 0U) {
+			goto out;
+		}
+	} else if (UNLIKELY((s = s2 = mc6_socket()) < 0)) {
 		goto out;
 	} else if (MODE_SUBP(opt.mode) && MODE_PUBP(opt.mode)) {
 		/* we've got a PUBSUB request */
@@ -396,19 +1622,136 @@ ud_socket(struct ud_sockopt_s opt)
 	if (0) {
 		/* for the aesthetical value */
 		;
+	} else if (opt.mode_opt & UD_MOPT_SHM) {
+		;
 	} else if (MODE_SUBP(opt.mode) && mc6_set_sub(s, opt.port) < 0) {
 		goto clos2_out;
 	} else if (MODE_PUBP(opt.mode) && mc6_set_pub(s2) < 0) {
 		goto clos2_out;
 	}
 
-	/* fingers crossed we don't waste memory (on hugepage systems) */
-	if (UNLIKELY((res = mmap_mem(sizeof(*res))) == NULL)) {
+	if (opt.mode_opt & UD_MOPT_TSTAMP) {
+		/* have the kernel stamp packets */
+#if defined SO_TIMESTAMPNS
+		if (MODE_SUBP(opt.mode)) {
+			setsockopt_int(s, SOL_SOCKET, SO_TIMESTAMPNS, 1);
+		}
+#endif	/* SO_TIMESTAMPNS */
+#if defined HAVE_TX_TSTAMP
+		/* subscribers send through their receiving socket,
+		 * tx time stamps would clog that up */
+		if (MODE_PUBP(opt.mode)) {
+			setsockopt_int(
+				s2, SOL_SOCKET, SO_TIMESTAMPING,
+				SOF_TIMESTAMPING_TX_SOFTWARE |
+				SOF_TIMESTAMPING_SOFTWARE |
+				SOF_TIMESTAMPING_OPT_ID |
+				SOF_TIMESTAMPING_OPT_TSONLY);
+		}
+#endif	/* HAVE_TX_TSTAMP */
+	}
+
+#if defined SO_RXQ_OVFL
+	if (MODE_SUBP(opt.mode) && s >= 0) {
+		/* have the kernel tell us what it had to drop */
+		setsockopt_int(s, SOL_SOCKET, SO_RXQ_OVFL, 1);
+	}
+#endif	/* SO_RXQ_OVFL */
+
+	if (opt.spin > 0U && MODE_SUBP(opt.mode)) {
+		/* have the kernel spin on the device queue for us,
+		 * going past net.core.busy_read takes CAP_NET_ADMIN */
+#if defined SO_BUSY_POLL
+		setsockopt_int(s, SOL_SOCKET, SO_BUSY_POLL, (int)opt.spin);
+#endif	/* SO_BUSY_POLL */
+#if defined SO_PREFER_BUSY_POLL
+		setsockopt_int(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1);
+#endif	/* SO_PREFER_BUSY_POLL */
+	}
+
+	/* receive ring needs at least one slot */
+	if (opt.nrecv == 0U) {
+		opt.nrecv = 1U;
+	} else if (opt.nrecv > MAX_NRECV) {
+		opt.nrecv = MAX_NRECV;
+	}
+	/* same for the send queue */
+	if (opt.nsend == 0U) {
+		opt.nsend = 1U;
+	} else if (opt.nsend > MAX_NSEND) {
+		opt.nsend = MAX_NSEND;
+	}
+
+	/* paced publishers may send a queue's worth back to back */
+	if (opt.burst == 0U) {
+		opt.burst = opt.nsend;
+	}
+
+	/* packets are sized for ethernet unless told otherwise */
+	if (opt.mtu == 0U) {
+		opt.mtu = ETH_MTU + PKT_OVERHEAD;
+	}
+
+	/* parity packets cover a maximum number of packets */
+	if (opt.nfec > MAX_NFEC) {
+		opt.nfec = MAX_NFEC;
+	}
+
+	/* channels go to groups of their own */
+	if (opt.ngroup > MAX_NGROUP) {
+		opt.ngroup = MAX_NGROUP;
+	}
+	if (opt.ngroup > 0U && opt.group_addr == NULL) {
+		opt.group_addr = UD_MCAST6_CHN_BASE;
+	}
+	if (opt.ngroup > 0U) {
+		struct in6_addr a;
+
+		if (grp_addr(&a, opt.group_addr, opt.ngroup - 1U) < 0) {
+			/* b0rked address, or not enough groups after it */
+			errno = EINVAL;
+			goto clos2_out;
+		}
+	}
+	if (opt.ngroup > 0U && (opt.nfec || opt.mode_opt & UD_MOPT_RELIABLE)) {
+		/* subscribers miss out on other groups' packets on purpose,
+		 * parity and NAKs would have them chase those */
 		goto clos2_out;
 	}
 
+	/* only reliable publishers keep a history */
+	if (!(opt.mode_opt & UD_MOPT_RELIABLE) || !MODE_PUBP(opt.mode)) {
+		opt.nhist = 0U;
+	} else if (opt.nhist == 0U) {
+		opt.nhist = NHIST;
+	} else if (opt.nhist > MAX_NHIST) {
+		opt.nhist = MAX_NHIST;
+	}
+
+	/* fingers crossed we don't waste memory (on hugepage systems) */
+	{
+		size_t z = sizeof(*res);
+		/* we must be able to receive what others send by default */
+		size_t bufz = mc6_pktz(opt.mtu);
+
+		bufz = ROUND(bufz > ETH_MTU ? bufz : ETH_MTU, 16U);
+		z += rring_size(opt.nrecv, bufz);
+		/* plus a spare slot for urgent packets */
+		z += sring_size(opt.nsend + 1U, bufz);
+		z += hring_size(opt.nhist, bufz);
+		/* publishers accumulate parity */
+		z += opt.nfec && MODE_PUBP(opt.mode) ? bufz : 0U;
+		z += opt.ngroup * sizeof(struct __grp_s);
+		if (UNLIKELY((res = sock_alloc(b, z)) == NULL)) {
+			goto clos2_out;
+		}
+		res->bufz = bufz;
+		res->mtu = mc6_pktz(opt.mtu);
+	}
+
 	/* fill in res */
 	res->fd = s;
+	res->tfd = -1;
 	res->fd_send = s2;
 	res->fl = 0U;
 	res->data = NULL;
@@ -418,20 +1761,80 @@ ud_socket(struct ud_sockopt_s opt)
 
 	/* destination address now, use SILO by default for now */
 	mc6_set_dest(res->dst, opt.addr, opt.port, opt.intf);
-	/* set the length of the storage for the source address */
-	res->src->sz = sizeof(res->src->sa);
+	/* set up the receive ring and the send queue */
+	{
+		uint8_t *p = res->ring;
+
+		p = rring_init(res, p, opt.nrecv);
+		p = sring_init(res, p, opt.nsend + 1U);
+		p = hring_init(res, p, opt.nhist);
+		if (opt.nfec && MODE_PUBP(opt.mode)) {
+			res->facc = p;
+			p += res->bufz;
+		}
+		p = grp_init(res, p, opt.ngroup);
+	}
+#if defined IPV6_MULTICAST_ALL
+	if (MODE_SUBP(opt.mode) && opt.ngroup > 0U) {
+		/* only hear groups joined through this socket */
+		setsockopt_int(s, IPPROTO_IPV6, IPV6_MULTICAST_ALL, 0);
+	}
+#endif	/* IPV6_MULTICAST_ALL */
+	/* seed for NAK back-offs, must not be 0 */
+	res->rnd = ((uint32_t)getpid() ^ (uint32_t)__now_ms()) | 1U;
 
 	/* join the mcast group(s) */
-	if (MODE_SUBP(opt.mode) && mc6_join_group(s, res->dst, res->memb) < 0) {
+	if (opt.mode_opt & UD_MOPT_SHM) {
+		/* or rather the ring of our port */
+		uint32_t id;
+
+		if (UNLIKELY((res->shm =
+			      shm_attach(opt.port, &res->shfd)) == NULL)) {
+			goto munm_out;
+		}
+		/* start with what's published from now on */
+		res->shr = __atomic_load_n(&res->shm->head, __ATOMIC_ACQUIRE);
+		/* publisher ids go as port, 0 is taken */
+		id = __atomic_add_fetch(&res->shm->npub, 1U, __ATOMIC_RELAXED);
+		res->shid = (uint16_t)(id % 0xffffU + 1U);
+		if (res->mtu > SHM_PKTZ) {
+			res->mtu = SHM_PKTZ;
+		}
+	} else if (MODE_SUBP(opt.mode) &&
+		   mc6_join_group(s, res->dst, res->memb) < 0) {
 		goto munm_out;
 	} else if (MODE_PUBP(opt.mode)) {
 		/* service for tools like ud-dealer */
 		(void)connect(res->fd_send, &res->dst->sa.sa, res->dst->sz);
+		/* now that we're connected, ask for the path mtu */
+		__pmtu_upd(res);
+		/* ... and for the address subscribers will see */
+		{
+			socklen_t sz = sizeof(res->self);
+
+			(void)getsockname(res->fd_send, (void*)&res->self, &sz);
+		}
+	}
+	if (MODE_PUBP(opt.mode) && __paced_p(res)) {
+		/* start out with full buckets */
+		res->tkb = (int64_t)(opt.burst * res->mtu) * TK_ONE;
+		res->tkp = (int64_t)opt.burst * TK_ONE;
+		res->tkt = __now_us();
+		__kpace(res);
+	}
+#if defined HAVE_SYS_TIMERFD_H
+	/* deadlines for coalescing publishers, and paced ones,
+	 * and for NAKs of reliable subscribers */
+	if ((MODE_PUBP(opt.mode) && (opt.max_delay > 0U || __paced_p(res))) ||
+	    (MODE_SUBP(opt.mode) && opt.mode_opt & UD_MOPT_RELIABLE)) {
+		res->tfd = timerfd_create(
+			CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
 	}
+#endif	/* HAVE_SYS_TIMERFD_H */
 	return (ud_sock_t)res;
 
 munm_out:
-	munmap_mem(res, sizeof(*res));
+	sock_free(res);
 clos2_out:
 	if (s != s2 && s2 >= 0) {
 		close(s2);
@@ -442,11 +1845,61 @@ out:
 	return NULL;
 }
 
+ud_sock_t
+ud_socket(struct ud_sockopt_s opt)
+{
+	return __socket(opt, NULL);
+}
+
+size_t
+ud_socket_bulk(
+	ud_sock_t *restrict tgt, struct ud_sockopt_s opt,
+	const uint16_t *ports, size_t n)
+{
+	struct __bulk_s b = {
+		.nleft = n,
+		.hugep = (opt.mode_opt & UD_MOPT_HUGE) != 0U,
+	};
+	size_t res = 0U;
+
+	for (size_t i = 0; i < n; i++, b.nleft--) {
+		if (ports != NULL) {
+			opt.port = ports[i];
+		}
+		res += (tgt[i] = __socket(opt, &b)) != NULL;
+	}
+	/* let go of the slab, the sockets in there keep it alive */
+	if (b.slab != NULL) {
+		slab_unref(b.slab);
+	}
+	return res;
+}
+
 int
 ud_close(ud_sock_t s)
 {
 	__sock_t us = (__sock_t)s;
 	int fd = us->fd;
+	int res = 0;
+
+	/* the pack in the making and packets the rates hold back go
+	 * before we do */
+	while (UNLIKELY(us->npk > 0U || us->nsq > us->isq)) {
+		uint64_t w;
+
+		if (ud_flush(s) < 0 && errno != EAGAIN) {
+			res = -1;
+			break;
+		} else if (us->nsq <= us->isq) {
+			break;
+		} else if (!(w = __pace_wait(us))) {
+			/* not the buckets holding them back, fuck off */
+			res = -1;
+			break;
+		}
+		nanosleep(&(struct timespec){
+				w / 1000000U, w % 1000000U * 1000U}, NULL);
+	}
 
 	switch (us->opt.mode) {
 	case UD_PUBSUB:
@@ -457,6 +1910,12 @@ ud_close(ud_sock_t s)
 		mc6_unset_sub(fd);
 		/* leave the mcast group */
 		mc6_leave_group(fd, us->memb);
+		/* and the channel groups */
+		for (unsigned int i = 0; us->grp && i < us->opt.ngroup; i++) {
+			if (us->grp[i].nref > 0U) {
+				mc6_leave_group(fd, us->grp[i].memb);
+			}
+		}
 		break;
 	case UD_PUB:
 		mc6_unset_pub(fd);
@@ -465,242 +1924,2117 @@ ud_close(ud_sock_t s)
 		break;
 	}
 
-	munmap_mem(us, sizeof(*us));
-	return close(fd);
+	/* free large messages in the making */
+	for (size_t i = 0; us->reasm != NULL && i < NREASM; i++) {
+		free(us->reasm[i].buf);
+	}
+	free(us->reasm);
+	free(us->lbuf);
+	free(us->btick);
+	/* and the dispatch table */
+	if (us->disp != NULL) {
+		__disp_free(us->disp);
+	}
+	/* and parity of sources */
+	for (size_t i = 0; us->seq != NULL && i < NSEQ; i++) {
+		free(us->seq[i].facc);
+	}
+	free(us->seq);
+	if (us->tfd >= 0) {
+		close(us->tfd);
+	}
+	if (us->shm != NULL) {
+		shm_detach(us->shm, us->shfd, us->opt.port);
+	}
+
+	sock_free(us);
+	/* node-local sockets have no fd */
+	if (fd >= 0 && close(fd) < 0) {
+		res = -1;
+	}
+	return res;
+}
+
+int
+ud_close_bulk(ud_sock_t *s, size_t n)
+{
+	int res = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (s[i] != NULL && ud_close(s[i]) < 0) {
+			res = -1;
+		}
+		s[i] = NULL;
+	}
+	return res;
+}
+
+/* actual I/O */
+static void
+__rcvz_grow(__sock_t us)
+{
+/* double the receive buffer, up to MAX_RCVBUF */
+	const uint64_t now = __now_ms();
+	uint64_t z;
+	int cur;
+
+	if (now - us->rcvt < RCVZ_HOLD) {
+		/* give the last one a chance */
+		return;
+	}
+	us->rcvt = now;
+	/* the kernel reports twice what it's been asked for */
+	if ((cur = getsockopt_int(us->fd, SOL_SOCKET, SO_RCVBUF)) <= 0) {
+		return;
+	} else if ((z = 2U * (uint64_t)cur) > us->opt.max_rcvbuf) {
+		z = us->opt.max_rcvbuf;
+	}
+	if (z <= (uint64_t)cur) {
+		return;
+	}
+#if defined SO_RCVBUFFORCE
+	/* past net.core.rmem_max if we're allowed to */
+	if (setsockopt_int(
+		    us->fd, SOL_SOCKET, SO_RCVBUFFORCE, (int)(z / 2U)) == 0) {
+		return;
+	}
+#endif	/* SO_RCVBUFFORCE */
+	(void)setsock_rcvz(us->fd, (int)(z / 2U));
+	return;
+}
+
+static void
+__rctl(__sock_t us, struct msghdr *m)
+{
+/* inspect ancillary data that came with M */
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(m);
+	     c != NULL; c = CMSG_NXTHDR(m, c)) {
+#if defined SO_TIMESTAMPNS
+		if (c->cmsg_level == SOL_SOCKET &&
+		    c->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&us->rts, CMSG_DATA(c), sizeof(us->rts));
+			continue;
+		}
+#endif	/* SO_TIMESTAMPNS */
+#if defined SO_RXQ_OVFL
+		if (c->cmsg_level == SOL_SOCKET &&
+		    c->cmsg_type == SO_RXQ_OVFL) {
+			/* total drops so far, the kernel's counter wraps */
+			uint32_t ovfl;
+			uint32_t d;
+
+			memcpy(&ovfl, CMSG_DATA(c), sizeof(ovfl));
+			d = ovfl - us->ovfl;
+			us->ovfl = ovfl;
+			if (d == 0U || us->filt) {
+				/* can't tell drops from filtered packets */
+				continue;
+			}
+			us->st.novfl += d;
+			if (us->opt.max_rcvbuf) {
+				__rcvz_grow(us);
+			}
+			continue;
+		}
+#endif	/* SO_RXQ_OVFL */
+		if (c->cmsg_level != IPPROTO_IPV6) {
+			continue;
+		}
+		switch (c->cmsg_type) {
+#if defined IPV6_PATHMTU
+		case IPV6_PATHMTU: {
+			struct ip6_mtuinfo mi;
+
+			memcpy(&mi, CMSG_DATA(c), sizeof(mi));
+			__set_mtu(us, mi.ip6m_mtu);
+			break;
+		}
+#endif	/* IPV6_PATHMTU */
+		default:
+			break;
+		}
+	}
+	return;
+}
+
+static inline void
+__tx_note(__sock_t us, const void *b)
+{
+/* remember the pno of packet B, tx time stamps come back by number */
+	if (UNLIKELY(us->opt.mode_opt & UD_MOPT_TSTAMP)) {
+		const struct ud_hdr_s *hdr = b;
+
+		us->txpno[us->ntx++ % NTXQ] = be16toh(hdr->pno);
+	}
+	return;
+}
+
+static int
+__send_big(__sock_t us)
+{
+/* the packet at ISQ exceeds the path mtu, learn the new mtu for
+ * future packets and push this one through, fragmented */
+	struct msghdr *m = &us->smsg[us->isq].msg_hdr;
+	int res = 0;
+
+	__pmtu_upd(us);
+#if defined IPV6_DONTFRAG
+	setsockopt_int(us->fd_send, IPPROTO_IPV6, IPV6_DONTFRAG, 0);
+#endif	/* IPV6_DONTFRAG */
+	if (sendmsg(us->fd_send, m, 0) < 0) {
+		res = -1;
+	} else {
+		__tx_note(us, m->msg_iov->iov_base);
+		__pace_take(us, m->msg_iov->iov_len);
+		us->isq++;
+	}
+#if defined IPV6_DONTFRAG
+	setsockopt_int(us->fd_send, IPPROTO_IPV6, IPV6_DONTFRAG, 1);
+#endif	/* IPV6_DONTFRAG */
+	return res;
+}
+
+static int
+__shm_send_q(__sock_t us)
+{
+/* put queued packets from ISQ onwards on the node-local ring, those
+ * too big for it never will be, so they're dropped all the same */
+	int res = 0;
+
+	for (; us->isq < us->nsq; us->isq++) {
+		const struct iovec *v = us->siov + us->isq;
+
+		res |= __shm_put(us, v->iov_base, v->iov_len);
+	}
+	__shm_wake(us->shm);
+
+	/* update indexes */
+	us->isq = 0U;
+	us->nsq = 0U;
+	us->send = __sslot(us, 0U);
+	return res;
+}
+
+static int
+__send_q(__sock_t us)
+{
+/* send queued packets from ISQ onwards */
+	if (us->shm != NULL) {
+		return __shm_send_q(us);
+	}
+	while (us->isq < us->nsq) {
+		struct mmsghdr *m = us->smsg + us->isq;
+		unsigned int nm = us->nsq - us->isq;
+		int n;
+
+		if (__paced_p(us) && (nm = __pace_n(us, nm)) == 0U) {
+			/* buckets are dry, have the timer tell when they
+			 * aren't, holding back is fine while there's room */
+			us->pdue = __now_us() + __pace_wait(us);
+			__tmr_arm(us);
+			if (us->nsq < us->nss) {
+				return 0;
+			}
+			errno = EAGAIN;
+			return -1;
+		}
+#if defined HAVE_SENDMMSG
+		n = sendmmsg(us->fd_send, m, nm, 0);
+#else  /* !HAVE_SENDMMSG */
+		for (n = 0; (unsigned int)n < nm; n++) {
+			ssize_t nwr;
+
+			if ((nwr = sendmsg(us->fd_send, &m[n].msg_hdr, 0)) < 0) {
+				break;
+			}
+			m[n].msg_len = (unsigned int)nwr;
+		}
+#endif	/* HAVE_SENDMMSG */
+		if (n < 0 && errno == EMSGSIZE && __send_big(us) == 0) {
+			/* path mtu's shrunk, we've had to fragment */
+			continue;
+		} else if (n <= 0) {
+			/* keep the rest for the next attempt */
+			return -1;
+		}
+		for (int i = 0; i < n; i++) {
+			__tx_note(us, m[i].msg_hdr.msg_iov->iov_base);
+		}
+		if (__paced_p(us)) {
+			for (int i = 0; i < n; i++) {
+				__pace_take(us, m[i].msg_len);
+			}
+		}
+		us->isq += n;
+	}
+	if (us->pdue) {
+		/* nothing's held back anymore */
+		us->pdue = 0U;
+		__tmr_arm(us);
+	}
+
+	/* update indexes */
+	us->isq = 0U;
+	us->nsq = 0U;
+	us->send = __sslot(us, 0U);
+	return 0;
+}
+
+static inline bool
+__urg_p(__sock_t us, ud_svc_t svc)
+{
+	for (unsigned int i = 0U; i < us->nurg; i++) {
+		if (us->urg[i] == svc) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+__send_now(__sock_t us)
+{
+/* send the current packet past the queue and the buckets, those
+ * queued have to make up for it though */
+	const struct msghdr *m = &us->smsg[us->nsq].msg_hdr;
+	ssize_t nwr;
+
+	if (us->shm != NULL) {
+		int rc = __shm_put(us, m->msg_iov->iov_base, m->msg_iov->iov_len);
+
+		__shm_wake(us->shm);
+		return rc;
+	} else if ((nwr = sendmsg(us->fd_send, m, 0)) < 0) {
+		return -1;
+	}
+	__tx_note(us, m->msg_iov->iov_base);
+	if (__paced_p(us)) {
+		__pace_fill(us, __now_us());
+		__pace_take(us, (size_t)nwr);
+	}
+	return 0;
+}
+
+static void
+__hist_add(__sock_t us, const union ud_buf_u *b, size_t z)
+{
+	unsigned int i = (uint16_t)us->pno % us->nhs;
+
+	us->hist[i] = (struct __hist_s){.pno = (uint16_t)us->pno, .len = z};
+	memcpy(__hslot(us, i), b, z);
+	return;
+}
+
+#if defined __GNUC__
+/* whatever vector registers the target has, gcc splits or merges */
+typedef uint8_t __xv_t __attribute__((vector_size(32)));
+#endif	/* __GNUC__ */
+
+static void
+__xorb(uint8_t *restrict tgt, const uint8_t *restrict src, size_t z)
+{
+/* TGT ^= SRC for Z bytes, this runs for every packet so vectorise */
+	size_t i = 0U;
+
+#if defined __GNUC__
+	for (; i + sizeof(__xv_t) <= z; i += sizeof(__xv_t)) {
+		__xv_t a;
+		__xv_t b;
+
+		memcpy(&a, tgt + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a ^= b;
+		memcpy(tgt + i, &a, sizeof(a));
+	}
+#endif	/* __GNUC__ */
+	for (; i < z; i++) {
+		tgt[i] ^= src[i];
+	}
+	return;
+}
+
+static void
+__fec_add(__sock_t us, const void *b, size_t z)
+{
+/* account for packet B of size Z in the current parity block */
+	if (us->nfc++ == 0U) {
+		us->ffid = (uint16_t)us->pno;
+	}
+	__xorb(us->facc, b, z);
+	us->flen ^= (uint16_t)z;
+	if (z > us->fmax) {
+		us->fmax = z;
+	}
+	return;
+}
+
+static void
+__fec_rset(__sock_t us)
+{
+	memset(us->facc, 0, us->fmax);
+	us->fmax = 0U;
+	us->nfc = 0U;
+	us->flen = 0U;
+	return;
+}
+
+static int
+__fec_emit(__sock_t us)
+{
+/* put the parity packet of the current block on the send queue */
+	struct __fec_s *f = (void*)us->send->pl;
+
+	us->send->hdr.ini = htobe16(UD_PROTO_INI);
+	us->send->hdr.pno = htobe16(us->pno);
+	us->send->hdr.cmd = htobe16(UD_CTRL_SVC(UD_SVC_FEC));
+	us->send->hdr.magic = htobe16(UD_MAGIC_FEC);
+	*f = (struct __fec_s){
+		.fid = htobe16(us->ffid),
+		.n = htobe16((uint16_t)us->nfc),
+		.len = htobe16(us->flen),
+	};
+	memcpy(f + 1, us->facc, us->fmax);
+	us->siov[us->nsq++].iov_len =
+		sizeof(us->send->hdr) + sizeof(*f) + us->fmax;
+	us->pno++;
+	__fec_rset(us);
+
+	/* with the queue full that's the spare slot */
+	us->send = __sslot(us, us->nsq);
+	if (us->nsq >= us->nss && __send_q(us) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+static int
+__close_pkt(__sock_t us)
+{
+/* stamp the current packet and put it on the send queue */
+	if (LIKELY(us->npk > 0U)) {
+		uint16_t magic = UD_MAGIC_DATA;
+		ud_svc_t cmd = us->svc;
+
+		if (us->opt.mode_opt & UD_MOPT_PROTO2) {
+			magic = UD_MAGIC_DATA2;
+			/* mixed packets go as service 0 */
+			cmd = (ud_svc_t)(us->mixd ? 0U : cmd);
+		}
+		if (us->opt.mode_opt & UD_MOPT_CRC) {
+			magic |= UD_MAGIC_CRC;
+		}
+		us->send->hdr.ini = htobe16(UD_PROTO_INI);
+		us->send->hdr.pno = htobe16(us->pno);
+		us->send->hdr.cmd = htobe16(cmd);
+		us->send->hdr.magic = htobe16(magic);
+		if (us->opt.mode_opt & UD_MOPT_CRC) {
+			/* over header and payload, goes last */
+			size_t z = us->npk + sizeof(us->send->hdr);
+			uint32_t crc = htobe32(ud_crc32c(us->send->buf, z));
+
+			memcpy(us->send->pl + us->npk, &crc, CRC_Z);
+			us->npk += CRC_Z;
+		}
+		us->siov[us->nsq].iov_len = us->npk + sizeof(us->send->hdr);
+		if (us->grp != NULL) {
+			/* off to the channel's group */
+			struct ud_sockaddr_s *dst = __grp_dst(us, us->svc);
+
+			us->smsg[us->nsq].msg_hdr.msg_name = &dst->sa;
+			us->smsg[us->nsq].msg_hdr.msg_namelen = dst->sz;
+		}
+		if (us->nhs > 0U) {
+			/* keep a copy for retransmissions */
+			__hist_add(us, us->send, us->siov[us->nsq].iov_len);
+		}
+		if (us->facc != NULL) {
+			__fec_add(us, us->send, us->siov[us->nsq].iov_len);
+		}
+		if (UNLIKELY(us->nurg > 0U) && __urg_p(us, us->svc)) {
+			int rc = __send_now(us);
+
+			if (rc == 0 || us->nsq >= us->nss) {
+				/* gone past the queue, the slot's free
+				 * again, or lost, there's no room to
+				 * queue it up */
+				us->npk = 0U;
+				us->nwr = 0U;
+				us->pno++;
+				if (us->facc == NULL ||
+				    us->nfc < us->opt.nfec) {
+					;
+				} else if (us->nsq < us->nss) {
+					(void)__fec_emit(us);
+				} else {
+					__fec_rset(us);
+				}
+				us->svc = 0U;
+				us->mixd = false;
+				us->nstk = 0U;
+				return rc;
+			}
+		}
+		us->nsq++;
+
+		/* update indexes */
+		us->npk = 0U;
+		us->nwr = 0U;
+
+		/* update our counters and stuff */
+		us->pno++;
+
+		/* with the queue full that's the spare slot */
+		us->send = __sslot(us, us->nsq);
+		if (us->nsq >= us->nss && __send_q(us) < 0) {
+			/* the packet's safe in the queue but
+			 * there's no room for new ones */
+			if (us->facc != NULL && us->nfc >= us->opt.nfec) {
+				/* nor for parity, block goes unprotected */
+				__fec_rset(us);
+			}
+			us->svc = 0U;
+			us->mixd = false;
+			return -1;
+		}
+
+		if (us->facc != NULL && us->nfc >= us->opt.nfec &&
+		    __fec_emit(us) < 0) {
+			/* parity's queued, but that's it for now */
+			us->svc = 0U;
+			us->mixd = false;
+			return -1;
+		}
+	}
+	/* definitely reset svc field */
+	us->svc = 0U;
+	us->mixd = false;
+	/* and ticks of the next packet start from scratch */
+	us->nstk = 0U;
+	return 0;
+}
+
+static void
+__due_set(__sock_t us, uint64_t due)
+{
+/* set the flush deadline to DUE, or disarm if 0 */
+	us->due = due;
+	__tmr_arm(us);
+	return;
+}
+
+static int
+__coal(__sock_t us)
+{
+/* coalescing publishers, see if what's been packed must go */
+	if (us->opt.min_fill && us->npk >= us->opt.min_fill) {
+		/* full enough */
+		return ud_flush((ud_sock_t)us);
+	} else if (!us->due) {
+		/* first pack since the last flush, start the clock */
+		__due_set(us, __now_us() + us->opt.max_delay);
+	} else if (__now_us() >= us->due) {
+		/* someone's missed the deadline */
+		return ud_flush((ud_sock_t)us);
+	}
+	return 0;
+}
+
+int
+ud_flush(ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+
+	if (us->due) {
+		/* whatever's due goes now */
+		__due_set(us, 0U);
+	}
+	if (us->shm == NULL) {
+		__pmtu_chck(us);
+	}
+	if (UNLIKELY(__close_pkt(us) < 0)) {
+		return -1;
+	}
+	/* the block so far gets its parity now, nothing might come
+	 * to fill it up */
+	if (us->facc != NULL && us->nfc > 0U && us->nsq < us->nss &&
+	    UNLIKELY(__fec_emit(us) < 0)) {
+		return -1;
+	} else if (us->nsq > us->isq) {
+		return __send_q(us);
+	}
+	return 0;
+}
+
+int
+ud_set_prio(ud_sock_t sock, ud_svc_t svc, int prio)
+{
+	__sock_t us = (__sock_t)sock;
+	unsigned int i;
+
+	for (i = 0U; i < us->nurg && us->urg[i] != svc; i++);
+	if (prio <= 0) {
+		/* back to normal, plug the hole */
+		if (i >= us->nurg) {
+			return 0;
+		}
+		us->urg[i] = us->urg[--us->nurg];
+	} else if (i < us->nurg) {
+		return 0;
+	} else if (UNLIKELY(us->nurg >= countof(us->urg))) {
+		return -1;
+	} else {
+		us->urg[us->nurg++] = svc;
+	}
+	if (us->nurg <= 1U) {
+		/* first one in or last one out */
+		__kpace(us);
+	}
+	return 0;
+}
+
+static bool
+__proto_p(const struct ud_hdr_s *hdr)
+{
+	if (LIKELY(be16toh(hdr->ini) == UD_PROTO_INI)) {
+		return true;
+	}
+	/* for transition purposes we don't fuck off
+	 * right here but instead we check if the magic
+	 * matches to ease migrating from older setups */
+	switch (be16toh(hdr->magic)) {
+	case 0xbeef/*UDPC_PKTFLO_NOW_ONE*/:
+	case 0xbeee/*UDPC_PKTFLO_NOW_MANY*/:
+	case 0xcaff/*UDPC_PKTFLO_SOON_ONE*/:
+	case 0xcafe/*UDPC_PKTFLO_SOON_MANY*/:
+	case UD_MAGIC_DATA/*UDPC_PKTFLO_DATA*/:
+		return true;
+	default:
+		break;
+	}
+	UDEBUG("magic fucked %04hx\n", be16toh(hdr->magic));
+	return false;
+}
+
+static inline bool
+__fec_p(const struct ud_hdr_s *hdr)
+{
+	return be16toh(hdr->ini) == UD_PROTO_INI &&
+		be16toh(hdr->magic) == UD_MAGIC_FEC;
+}
+
+static inline bool
+__crc_p(const struct ud_hdr_s *hdr)
+{
+	uint16_t m = be16toh(hdr->magic);
+
+	return UD_MAGIC_V2_P(m) && (m & UD_MAGIC_CRC);
+}
+
+static inline unsigned int
+__seq_hash(const struct sockaddr_in6 *sa)
+{
+	const uint32_t *a = (const uint32_t*)&sa->sin6_addr;
+	uint32_t h = a[0U] ^ a[1U] ^ a[2U] ^ a[3U] ^ sa->sin6_port;
+
+	/* fibonacci hashing, take the top bits */
+	return (h * 0x9e3779b1U) >> (32U - __builtin_ctz(NSEQ));
+}
+
+static struct __seq_s*
+__seq_slot(__sock_t us, const struct sockaddr_in6 *sa, bool creatp)
+{
+/* find the sequence slot for source SA, or make one if CREATP */
+	unsigned int h = __seq_hash(sa);
+	struct __seq_s *res = NULL;
+
+	if (UNLIKELY(us->seq == NULL)) {
+		/* nothing heard yet, most sockets in a slab never do */
+		if (!creatp) {
+			return NULL;
+		} else if ((us->seq = calloc(NSEQ, sizeof(*us->seq))) == NULL) {
+			return NULL;
+		}
+	}
+	for (unsigned int i = 0U; i < NSEQ_PROBE; i++) {
+		struct __seq_s *q = us->seq + ((h + i) & (NSEQ - 1U));
+
+		if (q->port == 0U) {
+			if (res == NULL) {
+				res = q;
+			}
+			continue;
+		} else if (q->port == sa->sin6_port &&
+			   !memcmp(&q->addr, &sa->sin6_addr, sizeof(q->addr))) {
+			/* found him */
+			return q;
+		}
+	}
+	if (!creatp) {
+		return NULL;
+	} else if (res == NULL) {
+		/* evict whoever's in the home slot, their stats live on
+		 * in the socket's overall stats */
+		res = us->seq + h;
+	}
+	free(res->facc);
+	*res = (struct __seq_s){
+		.addr = sa->sin6_addr,
+		.port = sa->sin6_port,
+	};
+	us->st.nsrc++;
+	return res;
+}
+
+static uint64_t
+__seq_miss(const struct __seq_s *q)
+{
+/* bitset of pnos missing from Q's window */
+	uint16_t span = (uint16_t)(q->hi - q->lo);
+	uint64_t valid = span >= 63U ? ~0ULL : (2ULL << span) - 1U;
+
+	return ~q->seen & valid;
+}
+
+static bool
+__seq_seen_p(const struct __seq_s *q, uint16_t pno)
+{
+/* whether we've seen PNO, anything out of the window counts as seen */
+	int16_t d = (int16_t)(uint16_t)(q->hi - pno);
+
+	if (d < 0) {
+		return false;
+	} else if (d >= 64) {
+		return true;
+	}
+	return (q->seen >> d) & 1U;
+}
+
+static void
+__nak_send(__sock_t us, struct __seq_s *q)
+{
+	struct __nak_s nak = {
+		.addr = q->addr,
+		.port = q->port,
+		.pno = htobe16(q->hi),
+		.miss = htobe64(__seq_miss(q)),
+	};
+
+	q->ndue = 0U;
+	if (nak.miss) {
+		(void)ud_pack_cmsg((ud_sock_t)us, (struct ud_msg_s){
+				.svc = UD_CTRL_SVC(UD_SVC_NAK),
+				.data = &nak,
+				.dlen = sizeof(nak),
+			});
+	}
+	return;
+}
+
+static void
+__nak_rtx(__sock_t us, uint16_t pno, uint64_t miss)
+{
+/* retransmit packets in MISS, unless we've just done so */
+	uint64_t now = __now_ms();
+	/* pnos still queued, urgent packets overtaking them make them
+	 * look lost, but they're on their way */
+	uint16_t qlo = 0U;
+	uint16_t nq = 0U;
+
+	if (us->nsq > us->isq) {
+		qlo = be16toh(__sslot(us, us->isq)->hdr.pno);
+		nq = (uint16_t)(be16toh(__sslot(us, us->nsq - 1U)->hdr.pno) -
+				qlo + 1U);
+	}
+	for (unsigned int i = 0U; miss; i++, miss >>= 1U) {
+		uint16_t p = (uint16_t)(pno - i);
+		struct __hist_s *h = us->hist + p % us->nhs;
+
+		if (!(miss & 1U)) {
+			continue;
+		} else if ((uint16_t)(p - qlo) < nq) {
+			/* held back, will go anyway */
+			continue;
+		} else if (h->pno != p || h->len == 0U) {
+			/* too old, gone */
+			continue;
+		} else if (h->rtx && h->rtx + NAK_HOLD > now) {
+			/* someone else asked for that one already */
+			continue;
+		}
+		if (send(us->fd_send, __hslot(us, h - us->hist), h->len, 0) > 0) {
+			__tx_note(us, __hslot(us, h - us->hist));
+		}
+		h->rtx = now;
+	}
+	return;
+}
+
+static void
+__nak_chck(__sock_t us, const struct ud_msg_s *msg)
+{
+/* inspect the NAK in MSG */
+	struct __nak_s nak;
+	struct sockaddr_in6 sa;
+	struct __seq_s *q;
+
+	if (UNLIKELY(msg->dlen < sizeof(nak))) {
+		return;
+	}
+	memcpy(&nak, msg->data, sizeof(nak));
+
+	if (us->nhs > 0U && nak.port == us->self.sin6_port &&
+	    !memcmp(&nak.addr, &us->self.sin6_addr, sizeof(nak.addr))) {
+		/* it's us they're missing */
+		__nak_rtx(us, be16toh(nak.pno), be64toh(nak.miss));
+	}
+
+	if (!(us->opt.mode_opt & UD_MOPT_RELIABLE)) {
+		return;
+	}
+	/* NAK suppression, see if the NAK covers our own losses */
+	sa = (struct sockaddr_in6){.sin6_addr = nak.addr, .sin6_port = nak.port};
+	if ((q = __seq_slot(us, &sa, false)) != NULL && q->ndue) {
+		int16_t d = (int16_t)(uint16_t)(q->hi - be16toh(nak.pno));
+		uint64_t theirs = be64toh(nak.miss);
+
+		if (d >= 64 || d <= -64) {
+			return;
+		}
+		/* align their bitset with ours */
+		theirs = d >= 0 ? theirs << d : theirs >> -d;
+		if (!(__seq_miss(q) & ~theirs)) {
+			q->ndue = 0U;
+		}
+	}
+	return;
+}
+
+static void
+__nak_due(__sock_t us)
+{
+/* send NAKs that are due, for losses no later packet has told us
+ * about, like those at the end of a burst */
+	const uint64_t now = __now_ms();
+	uint64_t nx = 0U;
+
+	if (LIKELY(!us->nakt) || now < us->nakt) {
+		return;
+	}
+	/* NAKs being due, there's sources */
+	for (size_t i = 0; i < NSEQ; i++) {
+		struct __seq_s *q = us->seq + i;
+
+		if (!q->ndue) {
+			continue;
+		} else if (now >= q->ndue) {
+			__nak_send(us, q);
+		} else if (!nx || q->ndue < nx) {
+			nx = q->ndue;
+		}
+	}
+	us->nakt = nx;
+	__tmr_arm(us);
+	return;
+}
+
+static int
+__nak_tmo(__sock_t us, int timeout)
+{
+/* TIMEOUT (in ms) cut short to when the next NAK is due */
+	if (us->nakt) {
+		const uint64_t now = __now_ms();
+		uint64_t w = us->nakt > now ? us->nakt - now : 0U;
+
+		if (timeout < 0 || w < (uint64_t)timeout) {
+			return (int)w;
+		}
+	}
+	return timeout;
+}
+
+static struct __seq_s*
+__seq_tick(__sock_t us, uint16_t pno, bool *restrict dupp)
+{
+/* account for packet PNO from the current source, return NULL if it's
+ * stale and to be dropped, DUPP is set if we've seen it before */
+	struct __seq_s *q;
+	int16_t d;
+	size_t ngap = 0U;
+	size_t ndup = 0U;
+	size_t nreo = 0U;
+	size_t nfil = 0U;
+
+	if (UNLIKELY((q = __seq_slot(us, &us->src->sa.sa6, true)) == NULL)) {
+		/* no memory to track them, can't tell stale ones either */
+		return NULL;
+	}
+	/* signed distance to the highest pno seen, wraps just fine */
+	d = (int16_t)(uint16_t)(pno - q->hi);
+	if (UNLIKELY(d <= -(int16_t)SEQ_WIN) && q->st.npkt > 0U) {
+		/* retransmissions for others come late, restarted
+		 * publishers count up from where they are */
+		q->nrst = q->nrst && pno == q->rst ? q->nrst + 1U : 1U;
+		q->rst = (uint16_t)(pno + 1U);
+		if (q->nrst < SEQ_NRST) {
+			/* out of the window counts as seen */
+			q->st.npkt++;
+			q->st.ndup++;
+			us->st.npkt++;
+			us->st.ndup++;
+			return NULL;
+		}
+	}
+	if (UNLIKELY(q->st.npkt == 0U || d <= -(int16_t)SEQ_WIN)) {
+		/* new source, or a publisher that's started over */
+		q->hi = pno;
+		q->lo = pno;
+		q->seen = 1U;
+		q->ndue = 0U;
+		q->nrst = 0U;
+	} else if (LIKELY(d > 0)) {
+		/* the usual case, anything in between is missing */
+		ngap = d - 1U;
+		q->seen = (unsigned int)d < 64U ? q->seen << d : 0U;
+		q->seen |= 1U;
+		q->hi = pno;
+	} else if (q->seen & (1ULL << -d)) {
+		ndup = 1U;
+	} else {
+		/* late but welcome */
+		q->seen |= 1ULL << -d;
+		nreo = 1U;
+		/* fills a gap we've counted before, unless it predates
+		 * the first packet we've seen */
+		nfil = q->st.ngap > 0U;
+	}
+
+	q->st.npkt++;
+	q->st.ngap += ngap - nfil;
+	q->st.ndup += ndup;
+	q->st.nreo += nreo;
+	us->st.npkt++;
+	us->st.ngap += ngap - nfil;
+	us->st.ndup += ndup;
+	us->st.nreo += nreo;
+	*dupp = ndup > 0U;
+
+	if (!(us->opt.mode_opt & UD_MOPT_RELIABLE)) {
+		/* don't care */
+		;
+	} else if (ngap > 0U && !q->ndue) {
+		/* wait a random bit so others can NAK before us */
+		us->rnd ^= us->rnd << 13U;
+		us->rnd ^= us->rnd >> 17U;
+		us->rnd ^= us->rnd << 5U;
+		q->ndue = __now_ms() + us->rnd % NAK_BACKOFF;
+		if (!us->nakt || q->ndue < us->nakt) {
+			/* no later packet might come to send it */
+			us->nakt = q->ndue;
+			__tmr_arm(us);
+		}
+	} else if (UNLIKELY(q->ndue) && __now_ms() >= q->ndue) {
+		__nak_send(us, q);
+	}
+	return q;
+}
+
+static void
+__fec_rset_src(struct __seq_s *q, uint16_t next)
+{
+	memset(q->facc, 0, q->fmax);
+	q->fmax = 0U;
+	q->fcnt = 0U;
+	q->fpx = 0U;
+	q->flen = 0U;
+	q->fnext = next;
+	return;
+}
+
+static void
+__fec_acc(struct __seq_s *q, uint16_t pno, const void *b, size_t z)
+{
+/* account for packet B of size Z from source Q */
+	if ((int16_t)(uint16_t)(pno - q->fnext) < 0) {
+		/* belongs to a block whose parity we've seen already */
+		return;
+	}
+	__xorb(q->facc, b, z);
+	q->fcnt++;
+	q->fpx ^= pno;
+	q->flen ^= (uint16_t)z;
+	if (z > q->fmax) {
+		q->fmax = z;
+	}
+	return;
+}
+
+static ssize_t
+__fec_recv(__sock_t us, struct __seq_s *q, union ud_buf_u *b, size_t z)
+{
+/* parity packet B of size Z from source Q, rebuild the one packet we've
+ * lost in place and return its size, or -1 if there's nothing to do */
+	const struct __fec_s *f = (const void*)b->pl;
+	uint16_t pno = be16toh(b->hdr.pno);
+	uint16_t fid;
+	uint16_t n;
+	uint16_t miss;
+	size_t len;
+	ssize_t res = -1;
+
+	if (UNLIKELY(z < sizeof(b->hdr) + sizeof(*f))) {
+		return -1;
+	} else if (UNLIKELY(q->facc == NULL)) {
+		/* first parity from this source, start accumulating */
+		if ((q->facc = calloc(us->bufz, 1U)) != NULL) {
+			q->fnext = (uint16_t)(pno + 1U);
+		}
+		return -1;
+	}
+	z -= sizeof(b->hdr) + sizeof(*f);
+	fid = be16toh(f->fid);
+	n = be16toh(f->n);
+	if (q->fcnt + 1U != n) {
+		/* nothing's lost, or too much */
+		goto rset;
+	}
+	/* the pno that's missing from the block */
+	miss = q->fpx;
+	for (uint16_t i = 0U; i < n; i++) {
+		miss ^= (uint16_t)(fid + i);
+	}
+	len = be16toh(f->len) ^ q->flen;
+	if (UNLIKELY(len <= sizeof(b->hdr) || len > z)) {
+		goto rset;
+	} else if (__seq_seen_p(q, miss)) {
+		/* got it after all */
+		goto rset;
+	}
+	/* rebuild */
+	memmove(b->buf, f + 1, len);
+	__xorb(b->buf, q->facc, len);
+	if (be16toh(b->hdr.pno) == miss && __proto_p(&b->hdr)) {
+		res = len;
+	}
+rset:
+	__fec_rset_src(q, (uint16_t)(pno + 1U));
+	return res;
+}
+
+static int
+__take(__sock_t us, union ud_buf_u *b, size_t len)
+{
+/* make B, LEN bytes long and from US->SRC, the current packet */
+	ssize_t nrd = len;
+
+	if ((nrd -= sizeof(b->hdr)) <= 0) {
+		return -1;
+	} else if (UNLIKELY(__fec_p(&b->hdr))) {
+		/* parity, might give us back a packet we've lost */
+		bool dup;
+		struct __seq_s *q = __seq_tick(us, be16toh(b->hdr.pno), &dup);
+		ssize_t z;
+
+		if (q == NULL || dup || !us->opt.nfec) {
+			/* a parity packet's twin would spoil the next block */
+			return -1;
+		} else if ((z = __fec_recv(us, q, b, len)) < 0) {
+			return -1;
+		}
+		nrd = z - sizeof(b->hdr);
+	} else if (!__proto_p(&b->hdr)) {
+		return -1;
+	}
+	if (__crc_p(&b->hdr)) {
+		/* make sure it's what they sent */
+		uint32_t crc;
+
+		if (UNLIKELY((nrd -= CRC_Z) < 0)) {
+			us->st.ncrc++;
+			return -1;
+		}
+		memcpy(&crc, b->pl + nrd, CRC_Z);
+		if (UNLIKELY(be32toh(crc) !=
+			     ud_crc32c(b->buf, nrd + sizeof(b->hdr)))) {
+			us->st.ncrc++;
+			return -1;
+		}
+	}
+	{
+		uint16_t pno = be16toh(b->hdr.pno);
+		bool dup;
+		struct __seq_s *q = __seq_tick(us, pno, &dup);
+
+		if (q == NULL) {
+			/* stale */
+			return -1;
+		} else if (q->facc != NULL && !dup) {
+			/* twins would cancel out in the parity */
+			__fec_acc(q, pno, b, nrd + sizeof(b->hdr));
+		}
+	}
+	/* yay, found one */
+	us->recv = b;
+	us->nrd = nrd;
+	us->nrtk = 0U;
+	return 0;
+}
+
+static int
+__take_slot(__sock_t us)
+{
+/* make the first usable slot from IRS onwards the current packet */
+	for (; us->irs < us->nrf; us->irs++) {
+		struct mmsghdr *m = us->rmsg + us->irs;
+
+		/* packets without a stamp mustn't inherit the last one's */
+		us->rts = (struct timespec){0};
+		if (m->msg_hdr.msg_controllen > 0U) {
+			/* path mtu notifications and the like */
+			__rctl(us, &m->msg_hdr);
+		}
+		if (UNLIKELY(m->msg_hdr.msg_flags & MSG_TRUNC)) {
+			/* half a packet is no packet */
+			continue;
+		}
+		us->src = us->rsrc + us->irs;
+		us->src->sz = m->msg_hdr.msg_namelen;
+		if (__take(us, __rslot(us, us->irs), m->msg_len) == 0) {
+			return 0;
+		}
+	}
+	/* ring's exhausted */
+	us->nrd = 0U;
+	return -1;
+}
+
+int
+ud_dscrd(ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+	int res = 0;
+
+	if (UNLIKELY(us->nrd == 0U)) {
+		/* oh, we shall read the shebang off the wire innit? */
+		int n;
+
+		if ((n = rring_fill(us)) < 0) {
+			us->nrf = 0U;
+			res = -1;
+		} else {
+			us->nrf = (unsigned int)n;
+		}
+		us->irs = 0U;
+		/* find us a packet */
+		if (LIKELY(res == 0)) {
+			res = __take_slot(us);
+		}
+	} else {
+		/* discard the current packet, move on to the next slot */
+		us->irs++;
+		(void)__take_slot(us);
+	}
+	/* pretend we haven't checked anything */
+	us->nck = 0U;
+	return res;
+}
+
+static inline size_t
+__pkt_room(__sock_t s)
+{
+/* payload bytes available in an empty packet */
+	size_t res = s->mtu - sizeof(s->send->hdr);
+
+	if (s->facc != NULL) {
+		/* make sure parity packets fit */
+		res -= sizeof(s->send->hdr) + sizeof(struct __fec_s);
+	}
+	if (s->opt.mode_opt & UD_MOPT_CRC) {
+		/* and the checksum */
+		res -= CRC_Z;
+	}
+	return res;
+}
+
+static inline bool
+__msg_fits_p(__sock_t s, size_t len)
+{
+	return s->npk + 2U + len <= __pkt_room(s);
+}
+
+static inline bool
+__svc_same_p(__sock_t s, ud_svc_t svc)
+{
+	return s->svc == 0U || svc == s->svc;
+}
+
+static inline bool
+__grp_same_p(__sock_t s, ud_svc_t svc)
+{
+	return s->npk == 0U || __grp_dst(s, svc) == __grp_dst(s, s->svc);
+}
+
+static inline bool
+__urg_same_p(__sock_t s, ud_svc_t svc)
+{
+/* urgent messages don't share packets with the rest */
+	return LIKELY(s->nurg == 0U) || s->npk == 0U ||
+		__urg_p(s, svc) == __urg_p(s, s->svc);
+}
+
+int
+ud_pack_msg(ud_sock_t sock, struct ud_msg_s msg)
+{
+	__sock_t us = (__sock_t)sock;
+	size_t z = msg.dlen;
+	const uint8_t *d = msg.data;
+	const bool v2p = us->opt.mode_opt & UD_MOPT_PROTO2;
+	uint8_t *restrict p;
+
+	if (UNLIKELY(z > MAX_TLVZ || 2U + z + (v2p ? 2U : 0U) > __pkt_room(us))) {
+		/* won't fit, not even in an empty packet */
+		return -1;
+	} else if (UNLIKELY(us->nsq >= us->nss) && __send_q(us) < 0 &&
+		   !__urg_p(us, msg.svc)) {
+		/* queue's still clogged from last time,
+		 * only urgent stuff may use the spare slot */
+		return -1;
+	} else if (UNLIKELY(!__msg_fits_p(us, z + (v2p ? 2U : 0U)) ||
+			    (!v2p && !__svc_same_p(us, msg.svc)) ||
+			    !__grp_same_p(us, msg.svc) ||
+			    !__urg_same_p(us, msg.svc))) {
+		/* queue what we've got, send if need be */
+		if (UNLIKELY(__close_pkt(us)) < 0 && !__urg_p(us, msg.svc)) {
+			/* nah, don't pack up new stuff,
+			 * we need to get rid of the old shit first
+			 * actually this should be configurable behaviour */
+			return -1;
+		}
+	}
+
+	/* update service slot, always, v2 packets remember mixing */
+	if (v2p && us->npk > 0U && us->svc != msg.svc) {
+		us->mixd = true;
+	}
+	us->svc = msg.svc;
+
+	/* now copy the blob */
+	p = us->send->pl + us->npk;
+	{
+		uint8_t rs = (uint8_t)(z % 256U);
+		uint8_t xc = (uint8_t)(z / 256U);
+
+		if (LIKELY(!v2p)) {
+			*p++ = (uint8_t)(UDPC_TYPE_DATA | (xc << 4U));
+			*p++ = rs;
+		} else {
+			*p++ = (uint8_t)(UDPC_TYPE_SDATA | (xc << 4U));
+			*p++ = rs;
+			*p++ = (uint8_t)(msg.svc >> 8U);
+			*p++ = (uint8_t)(msg.svc & 0xffU);
+		}
+	}
+	memcpy(p, d, z);
+	p += z;
+
+	/* and update counters */
+	us->npk = p - us->send->pl;
+	if (UNLIKELY(us->nsq >= us->nss)) {
+		/* packed into the spare slot, mustn't linger */
+		return __close_pkt(us);
+	} else if (us->opt.max_delay) {
+		return __coal(us);
+	}
+	return 0;
+}
+
+static struct ud_tick_s*
+__tick_last(struct __tick_s *tk, unsigned int *ntk, ud_svc_t svc)
+{
+/* last tick of SVC in the packet, or a zeroed one if it's the first,
+ * or NULL if there's no room to track SVC */
+	for (unsigned int i = 0U; i < *ntk; i++) {
+		if (tk[i].svc == svc) {
+			return &tk[i].last;
+		}
+	}
+	if (*ntk >= NTICK) {
+		return NULL;
+	}
+	tk[*ntk] = (struct __tick_s){.svc = svc};
+	return &tk[(*ntk)++].last;
+}
+
+static inline uint8_t*
+__vput(uint8_t *restrict p, uint64_t v)
+{
+/* zigzag V so small magnitudes go in few octets, then varint it */
+	uint64_t u = (v << 1U) ^ -(v >> 63U);
+
+	for (; u >= 0x80U; u >>= 7U) {
+		*p++ = (uint8_t)(u | 0x80U);
+	}
+	*p++ = (uint8_t)u;
+	return p;
+}
+
+static inline const uint8_t*
+__vget(uint64_t *restrict tgt, const uint8_t *p, const uint8_t *ep)
+{
+	uint64_t u = 0U;
+
+	for (unsigned int sh = 0U; p < ep && sh < 64U; sh += 7U) {
+		u |= (uint64_t)(*p & 0x7fU) << sh;
+		if (!(*p++ & 0x80U)) {
+			*tgt = (u >> 1U) ^ -(u & 1U);
+			return p;
+		}
+	}
+	/* truncated or too long */
+	return NULL;
+}
+
+static size_t
+__tick_enc(uint8_t *restrict p, const struct ud_tick_s *t, struct ud_tick_s *b)
+{
+/* encode T against B, then make T the new B */
+	static const struct ud_tick_s nil;
+	const struct ud_tick_s *o = b ?: &nil;
+	uint8_t *q = p;
+
+	/* deltas wrap around rather than overflow */
+	q = __vput(q, (uint64_t)t->ts - (uint64_t)o->ts);
+	q = __vput(q, (uint64_t)t->px - (uint64_t)o->px);
+	q = __vput(q, (uint64_t)t->qty - (uint64_t)o->qty);
+	if (b != NULL) {
+		*b = *t;
+	}
+	return q - p;
+}
+
+static int
+__tick_dec(
+	struct ud_tick_s *restrict t, const uint8_t *p, size_t z,
+	struct ud_tick_s *b)
+{
+/* decode P of size Z against B into T, then make T the new B */
+	static const struct ud_tick_s nil;
+	const struct ud_tick_s *o = b ?: &nil;
+	const uint8_t *ep = p + z;
+	uint64_t d[3U];
+
+	for (size_t i = 0; i < countof(d); i++) {
+		if (UNLIKELY((p = __vget(d + i, p, ep)) == NULL)) {
+			return -1;
+		}
+	}
+	if (UNLIKELY(p != ep)) {
+		return -1;
+	}
+	t->ts = (int64_t)((uint64_t)o->ts + d[0U]);
+	t->px = (int64_t)((uint64_t)o->px + d[1U]);
+	t->qty = (int64_t)((uint64_t)o->qty + d[2U]);
+	if (b != NULL) {
+		*b = *t;
+	}
+	return 0;
+}
+
+int
+ud_pack_tick(ud_sock_t sock, ud_svc_t svc, const struct ud_tick_s *t)
+{
+	__sock_t us = (__sock_t)sock;
+	const bool v2p = us->opt.mode_opt & UD_MOPT_PROTO2;
+	uint8_t *restrict p;
+	size_t z;
+
+	if (UNLIKELY(us->nsq >= us->nss) && __send_q(us) < 0 &&
+	    !__urg_p(us, svc)) {
+		/* queue's still clogged from last time,
+		 * only urgent stuff may use the spare slot */
+		return -1;
+	} else if (UNLIKELY(!__msg_fits_p(us, 2U/*svc*/ + TICK_MAXZ) ||
+			    (!v2p && !__svc_same_p(us, svc)) ||
+			    !__grp_same_p(us, svc) ||
+			    !__urg_same_p(us, svc)) &&
+		   UNLIKELY(__close_pkt(us) < 0) && !__urg_p(us, svc)) {
+		/* can't get rid of what we've got */
+		return -1;
+	}
+
+	/* update service slot, always, v2 packets remember mixing */
+	if (v2p && us->npk > 0U && us->svc != svc) {
+		us->mixd = true;
+	}
+	us->svc = svc;
+
+	/* the tick goes after the tlv header, which we know by then */
+	p = us->send->pl + us->npk;
+	z = __tick_enc(p + 4U, t, __tick_last(us->stk, &us->nstk, svc));
+	*p++ = UDPC_TYPE_TICK;
+	*p++ = (uint8_t)z;
+	*p++ = (uint8_t)(svc >> 8U);
+	*p++ = (uint8_t)(svc & 0xffU);
+
+	/* and update counters */
+	us->npk += 4U + z;
+	if (UNLIKELY(us->nsq >= us->nss)) {
+		/* packed into the spare slot, mustn't linger */
+		return __close_pkt(us);
+	} else if (us->opt.max_delay) {
+		return __coal(us);
+	}
+	return 0;
+}
+
+int
+ud_pack_lmsg(ud_sock_t sock, struct ud_msg_s msg)
+{
+	__sock_t us = (__sock_t)sock;
+	const uint8_t *d = msg.data;
+	size_t room;
+	size_t nfr;
+	uint16_t fid;
+
+	/* chunk size, all fragments go in packets of their own */
+	room = __pkt_room(us) - 2U - sizeof(struct __frag_s);
+	if (room > MAX_TLVZ - sizeof(struct __frag_s)) {
+		room = MAX_TLVZ - sizeof(struct __frag_s);
+	}
+
+	if (msg.dlen <= room - 2U/*svc of v2*/) {
+		/* small enough to go as normal message */
+		return ud_pack_msg(sock, msg);
+	} else if (UNLIKELY(msg.dlen > MAX_LMSG)) {
+		return -1;
+	} else if ((nfr = (msg.dlen + room - 1U) / room) > 0xffffU) {
+		return -1;
+	} else if (UNLIKELY(us->nsq >= us->nss) && __send_q(us) < 0) {
+		/* queue's still clogged from last time */
+		return -1;
+	} else if (UNLIKELY(__close_pkt(us) < 0)) {
+		/* can't get rid of what we've got */
+		return -1;
+	}
+
+	/* packet numbers go up one by one from here */
+	fid = (uint16_t)us->pno;
+	for (size_t i = 0, off = 0U; i < nfr; i++, off += room) {
+		size_t z = msg.dlen - off < room ? msg.dlen - off : room;
+		size_t tz = sizeof(struct __frag_s) + z;
+		struct __frag_s f;
+		uint8_t *restrict p;
+
+		if (UNLIKELY(us->nsq >= us->nss) && __send_q(us) < 0) {
+			/* message is toast, fragments up to here are
+			 * queued or gone already, subscribers drop the
+			 * torso when its reassembly slot times out */
+			return -1;
+		}
+
+		p = us->send->pl;
+		*p++ = (uint8_t)(UDPC_TYPE_FRAG | ((tz / 256U) << 4U));
+		*p++ = (uint8_t)(tz % 256U);
+		f = (struct __frag_s){
+			.svc = htobe16(msg.svc),
+			.fid = htobe16(fid),
+			.fno = htobe16((uint16_t)i),
+			.nfr = htobe16((uint16_t)nfr),
+			.tot = htobe32((uint32_t)msg.dlen),
+			.off = htobe32((uint32_t)off),
+		};
+		memcpy(p, &f, sizeof(f));
+		p += sizeof(f);
+		memcpy(p, d + off, z);
+		p += z;
+
+		/* and update counters */
+		us->npk = p - us->send->pl;
+		us->svc = msg.svc;
+		/* if this fails the fragment's still queued */
+		(void)__close_pkt(us);
+	}
+	if (us->opt.max_delay) {
+		return __coal(us);
+	}
+	return 0;
+}
+
+int
+ud_pack(ud_sock_t sock, ud_svc_t svc, const void *data, size_t dlen)
+{
+	return ud_pack_msg(sock, (struct ud_msg_s){
+				.svc = svc, .data = data, .dlen = dlen});
+}
+
+static inline __attribute__((pure)) bool
+__ctrl_msg_p(ud_svc_t svc)
+{
+	return UD_CHN(svc) == UD_CHN_CTRL;
+}
+
+static struct __reasm_s*
+__reasm_slot(__sock_t us, const struct __frag_s *f, uint64_t now)
+{
+/* find the reassembly slot for fragment F, or make one */
+	const struct sockaddr_in6 *src = &us->src->sa.sa6;
+	struct __reasm_s *res = NULL;
+	uint16_t fid = be16toh(f->fid);
+
+	if (UNLIKELY(us->reasm == NULL) &&
+	    (us->reasm = calloc(NREASM, sizeof(*us->reasm))) == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < NREASM; i++) {
+		struct __reasm_s *r = us->reasm + i;
+
+		if (r->buf == NULL) {
+			/* free slot, remember it */
+			if (res == NULL || res->buf != NULL) {
+				res = r;
+			}
+			continue;
+		} else if (r->fid == fid &&
+			   r->src.sin6_port == src->sin6_port &&
+			   !memcmp(&r->src.sin6_addr, &src->sin6_addr,
+				   sizeof(src->sin6_addr))) {
+			/* found him */
+			return r;
+		} else if (r->last + REASM_TIMEOUT < now) {
+			/* timed out, kick him out */
+			free(r->buf);
+			r->buf = NULL;
+			res = r;
+		} else if (res == NULL ||
+			   (res->buf != NULL && r->last < res->last)) {
+			/* candidate for eviction */
+			res = r;
+		}
+	}
+	/* res is a free slot now, or the eldest one */
+	free(res->buf);
+	res->buf = NULL;
+	{
+		uint32_t tot = be32toh(f->tot);
+		uint16_t nfr = be16toh(f->nfr);
+		size_t z = tot + (nfr + 7U) / 8U;
+
+		if (UNLIKELY(tot > MAX_LMSG || nfr == 0U)) {
+			return NULL;
+		} else if (UNLIKELY((res->buf = calloc(z, 1U)) == NULL)) {
+			return NULL;
+		}
+		res->src = *src;
+		res->fid = fid;
+		res->svc = be16toh(f->svc);
+		res->nfr = nfr;
+		res->ngot = 0U;
+		res->tot = tot;
+	}
+	return res;
+}
+
+static int
+__reasm(struct ud_msg_s *restrict tgt, __sock_t us)
+{
+/* put fragment in TGT into its place, if the message is complete
+ * set up TGT to point to it and return 0, otherwise return -1 */
+	struct __frag_s f[1];
+	struct __reasm_s *r;
+	uint64_t now;
+	uint8_t *bs;
+	size_t z;
+	uint16_t fno;
+	uint32_t off;
+
+	if (UNLIKELY(tgt->dlen < sizeof(*f))) {
+		return -1;
+	}
+	memcpy(f, tgt->data, sizeof(*f));
+	if ((r = __reasm_slot(us, f, now = __now_ms())) == NULL) {
+		return -1;
+	}
+	/* check the fragment against what we know */
+	z = tgt->dlen - sizeof(*f);
+	fno = be16toh(f->fno);
+	off = be32toh(f->off);
+	bs = r->buf + r->tot;
+	if (UNLIKELY(fno >= r->nfr || be16toh(f->nfr) != r->nfr)) {
+		return -1;
+	} else if (UNLIKELY(off > r->tot || z > r->tot - off)) {
+		return -1;
+	} else if (bs[fno / 8U] & (1U << (fno % 8U))) {
+		/* seen that one already */
+		return -1;
+	}
+	/* copy and tick off */
+	memcpy(r->buf + off, (const uint8_t*)tgt->data + sizeof(*f), z);
+	bs[fno / 8U] |= (uint8_t)(1U << (fno % 8U));
+	r->last = now;
+	if (++r->ngot < r->nfr) {
+		return -1;
+	}
+	/* yay, complete, hand it out and free the slot */
+	tgt->svc = r->svc;
+	tgt->data = us->lbuf = r->buf;
+	tgt->dlen = r->tot;
+	r->buf = NULL;
+	return 0;
+}
+
+static int
+__chck_msg(struct ud_msg_s *restrict tgt, __sock_t us, bool wirep)
+{
+/* next message off the current packet, or the ones after it in the
+ * receive ring, going back to the wire only if WIREP */
+	ud_sock_t sock = (ud_sock_t)us;
+	uint8_t *restrict p;
+	size_t hz;
+
+more:
+	if (UNLIKELY(us->nck >= us->nrd)) {
+		/* we need another dose */
+		if (!wirep && us->nrd == 0U) {
+			/* ring's done, refilling would spoil it */
+			return -1;
+		} else if (UNLIKELY(ud_dscrd(sock)) < 0) {
+			/* nah, don't pack up new stuff,
+			 * we need to get rid of the old shit first
+			 * actually this should be configurable behaviour */
+			return -1;
+		} else if (us->nck >= us->nrd) {
+			/* no more data, just fuck off */
+			return -1;
+		}
+	}
+
+	/* now copy the blob */
+	p = us->recv->pl + us->nck;
+	switch (*p & 0x0fU) {
+	case UDPC_TYPE_DATA:
+		/* the message service is the packet's */
+		tgt->svc = be16toh(us->recv->hdr.cmd);
+		hz = 1U/*for UDPC_TYPE_DATA*/ + 1U/*for length*/;
+		break;
+	case UDPC_TYPE_SDATA:
+		/* v2 message, service comes after the length */
+		tgt->svc = (ud_svc_t)((p[2] << 8U) | p[3]);
+		hz = 1U/*for UDPC_TYPE_SDATA*/ + 1U/*length*/ + 2U/*svc*/;
+		break;
+	case UDPC_TYPE_FRAG:
+		/* service is in the fragment header */
+		hz = 1U/*for UDPC_TYPE_FRAG*/ + 1U/*length*/;
+		break;
+	case UDPC_TYPE_TICK:
+		/* like v2 messages, the tick is decoded below */
+		tgt->svc = (ud_svc_t)((p[2] << 8U) | p[3]);
+		hz = 1U/*for UDPC_TYPE_TICK*/ + 1U/*length*/ + 2U/*svc*/;
+		break;
+	default:
+		/* skip the rest of this packet */
+		us->nck = us->nrd;
+		return -1;
+	}
+	/* the length comes from 12 bits, the upper 4 of p[0] and 8 of p[1] */
+	tgt->dlen = ((p[0] & 0xf0U) << 4U) | p[1];
+	tgt->data = p + hz;
+
+	if (UNLIKELY(us->nck + hz + tgt->dlen > us->nrd)) {
+		/* message exceeds packet, bugger off */
+		us->nck = us->nrd;
+		return -1;
+	}
+
+	/* and update counters */
+	us->nck += hz + tgt->dlen;
+
+	if (UNLIKELY((*p & 0x0fU) == UDPC_TYPE_FRAG) && __reasm(tgt, us) < 0) {
+		/* message isn't complete yet, try the next one */
+		goto more;
+	} else if ((*p & 0x0fU) == UDPC_TYPE_TICK) {
+		struct ud_tick_s *b = __tick_last(us->rtk, &us->nrtk, tgt->svc);
+
+		if (UNLIKELY(__tick_dec(
+				     &us->rtick, tgt->data, tgt->dlen, b) < 0)) {
+			/* later deltas are off, skip the rest */
+			us->nck = us->nrd;
+			goto more;
+		}
+		tgt->data = &us->rtick;
+		tgt->dlen = sizeof(us->rtick);
+	}
+
+	/* check for control messages */
+	if (UNLIKELY(__ctrl_msg_p(tgt->svc))) {
+		(void)ud_chck_cmsg(tgt, sock);
+	}
+	return 0;
+}
+
+int
+ud_chck_msg(struct ud_msg_s *restrict tgt, ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+
+	if (UNLIKELY(us->lbuf != NULL)) {
+		/* large message from last time is void now */
+		free(us->lbuf);
+		us->lbuf = NULL;
+	}
+	if (__chck_msg(tgt, us, true) < 0) {
+		/* dry, a good time for overdue NAKs */
+		__nak_due(us);
+		return -1;
+	}
+	return 0;
+}
+
+ssize_t
+ud_chck_mmsg(
+	struct ud_msg_s *restrict tgt, struct ud_auxmsg_s *restrict aux,
+	size_t n, ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+	size_t nt = 0U;
+	size_t i;
+
+	if (UNLIKELY(us->lbuf != NULL)) {
+		/* large message from last time is void now */
+		free(us->lbuf);
+		us->lbuf = NULL;
+	}
+	/* only the first message may come off the wire, later ones
+	 * would overwrite the ring the earlier ones point into */
+	for (i = 0U; i < n && nt < NBTICK; i++) {
+		if (__chck_msg(tgt + i, us, i == 0U) < 0) {
+			break;
+		}
+		if (aux != NULL) {
+			(void)ud_get_aux(aux + i, sock);
+		}
+		if (tgt[i].data == &us->rtick) {
+			/* rtick is overwritten by the next tick */
+			if (UNLIKELY(us->btick == NULL) &&
+			    (us->btick = malloc(
+				     NBTICK * sizeof(*us->btick))) == NULL) {
+				/* just this one then */
+				i++;
+				break;
+			}
+			us->btick[nt] = us->rtick;
+			tgt[i].data = us->btick + nt++;
+		} else if (UNLIKELY(us->lbuf != NULL)) {
+			/* there's room for one large message */
+			i++;
+			break;
+		}
+	}
+	if (i == 0U) {
+		__nak_due(us);
+		return -1;
+	}
+	return (ssize_t)i;
 }
 
-/* actual I/O */
 int
-ud_flush(ud_sock_t sock)
+ud_chck_msg_spin(struct ud_msg_s *restrict tgt, ud_sock_t sock, int timeout)
 {
 	__sock_t us = (__sock_t)sock;
+	const uint64_t end = __now_us() + us->opt.spin;
 
-	if (LIKELY(us->npk > 0U)) {
-		ssize_t nwr;
-		const void *b = us->send.buf;
-		size_t z = us->npk + sizeof(us->send.hdr);
-		const struct sockaddr *sa = &us->dst->sa.sa;
-		socklen_t sz = us->dst->sz;
+	do {
+		if (ud_chck_msg(tgt, sock) >= 0) {
+			us->st.nspin_hit++;
+			return 0;
+		}
+	} while (__now_us() < end);
+
+	/* spun in vain, off to sleep */
+	us->st.nspin_miss++;
+	{
+		const uint64_t tend = __now_ms() + (timeout > 0 ? timeout : 0);
 
-		us->send.hdr.ini = htobe16(UD_PROTO_INI);
-		us->send.hdr.pno = htobe16(us->pno);
-		us->send.hdr.cmd = htobe16(us->svc);
-		us->send.hdr.magic = htobe16(0xda7a);
+		while (ud_wait(sock, timeout) > 0) {
+			uint64_t now;
 
-		if ((nwr = sendto(us->fd_send, b, z, 0, sa, sz)) < 0) {
-			return -1;
-		} else if ((size_t)nwr < z) {
-			/* should we try a resend? */
-			;
+			if (ud_chck_msg(tgt, sock) >= 0) {
+				return 0;
+			} else if (timeout < 0) {
+				continue;
+			} else if ((now = __now_ms()) >= tend) {
+				/* packets came but none of them did it */
+				break;
+			}
+			timeout = (int)(tend - now);
 		}
+	}
+	return -1;
+}
 
-		/* update indexes */
-		us->npk = 0U;
-		us->nwr = 0U;
+ssize_t
+ud_chck(ud_svc_t *svc, void *restrict tgt, size_t tsz, ud_sock_t sock)
+{
+	struct ud_msg_s msg = {0};
 
-		/* update our counters and stuff */
-		us->pno++;
+	if (ud_chck_msg(&msg, sock) < 0) {
+		return -1;
 	}
-	/* definitely reset svc field */
-	us->svc = 0U;
-	return 0;
+	/* otherwise copy to user buffer */
+	if (UNLIKELY(msg.dlen > tsz)) {
+		msg.dlen = tsz;
+	}
+	*svc = msg.svc;
+	memcpy(tgt, msg.data, msg.dlen);
+	return msg.dlen;
 }
 
 int
-ud_dscrd(ud_sock_t sock)
+ud_disp_on(ud_sock_t sock, ud_svc_t svc, ud_disp_f cb, void *clo)
 {
 	__sock_t us = (__sock_t)sock;
+	const unsigned int c = UD_CHN(svc);
+	const unsigned int s = svc % 0x100U;
+	struct __dchn_s *dc;
 
-	if (UNLIKELY(us->nrd == 0U)) {
-		/* oh, we shall read the shebang off the wire innit? */
-		void *restrict b = us->recv.buf;
-		size_t z = sizeof(us->recv.buf);
-		struct sockaddr *restrict sa = &us->src->sa.sa;
-		socklen_t *restrict sz = &us->src->sz;
-		ssize_t nrd;
+	if (UNLIKELY((dc = __disp_chn(us, c)) == NULL)) {
+		return -1;
+	} else if (cb != NULL) {
+		dc->e[s] = (struct __dent_s){cb, clo};
+		dc->own[s / 64U] |= 1ULL << (s % 64U);
+	} else {
+		/* back to the channel's handler */
+		dc->e[s] = dc->any;
+		dc->own[s / 64U] &= ~(1ULL << (s % 64U));
+	}
+	return 0;
+}
 
-		if ((nrd = recvfrom(us->fd, b, z, 0, sa, sz)) < 0) {
-			return -1;
-		} else if ((nrd -= sizeof(us->recv.hdr)) < 0) {
-			return -1;
-		} else if (be16toh(us->recv.hdr.ini) != UD_PROTO_INI) {
-			/* for transition purposes we don't fuck off
-			 * right here but instead we check if the magic
-			 * matches to ease migrating from older setups */
-			uint16_t magic = be16toh(us->recv.hdr.magic);
-
-			switch (magic) {
-			case 0xbeef/*UDPC_PKTFLO_NOW_ONE*/:
-			case 0xbeee/*UDPC_PKTFLO_NOW_MANY*/:
-			case 0xcaff/*UDPC_PKTFLO_SOON_ONE*/:
-			case 0xcafe/*UDPC_PKTFLO_SOON_MANY*/:
-			case 0xda7a/*UDPC_PKTFLO_DATA*/:
-				break;
-			default:
-				UDEBUG("magic fucked %04hx\n", magic);
-				return -1;
-			}
-		}
+int
+ud_disp_on_chn(ud_sock_t sock, uint8_t chn, ud_disp_f cb, void *clo)
+{
+	__sock_t us = (__sock_t)sock;
+	struct __dchn_s *dc;
 
-		/* update indexes */
-		us->nrd = nrd;
-	} else {
-		/* update indexes */
-		us->nrd = 0U;
+	if (UNLIKELY((dc = __disp_chn(us, chn)) == NULL)) {
+		return -1;
+	}
+	dc->any = (struct __dent_s){cb != NULL ? cb : __disp_nop, clo};
+	/* hand it down to everyone without a handler of their own */
+	for (unsigned int s = 0U; s < countof(dc->e); s++) {
+		if (!(dc->own[s / 64U] & (1ULL << (s % 64U)))) {
+			dc->e[s] = dc->any;
+		}
 	}
-	/* pretend we haven't checked anything */
-	us->nck = 0U;
 	return 0;
 }
 
-static inline bool
-__msg_fits_p(__sock_t s, size_t len)
+ssize_t
+ud_disp_run(ud_sock_t sock, size_t n)
 {
-	return s->npk + 2U + len <= sizeof(s->send.buf) - sizeof(s->send.hdr);
+	__sock_t us = (__sock_t)sock;
+	struct ud_msg_s msg[1];
+	size_t i;
+
+	if (UNLIKELY(us->disp == NULL)) {
+		/* no handlers, nothing to dispatch to */
+		return -1;
+	}
+	for (i = 0U; (!n || i < n) && ud_chck_msg(msg, sock) >= 0; i++) {
+		/* the table's only read here, handlers may change it */
+		const struct __dent_s *e =
+			us->disp->chn[UD_CHN(msg->svc)]->e + msg->svc % 0x100U;
+
+		e->cb(sock, msg, e->clo);
+	}
+	return i;
 }
 
-static inline bool
-__svc_same_p(__sock_t s, ud_svc_t svc)
+const struct sockaddr*
+ud_socket_addr(ud_sock_t s)
 {
-	return s->svc == 0U || svc == s->svc;
+	__sock_t us = (__sock_t)s;
+	return (const struct sockaddr*)&us->dst->sa;
 }
 
 int
-ud_pack_msg(ud_sock_t sock, struct ud_msg_s msg)
+ud_get_aux(struct ud_auxmsg_s *restrict tgt, ud_sock_t sock)
 {
 	__sock_t us = (__sock_t)sock;
-	uint8_t z = (uint8_t)msg.dlen;
-	const uint8_t *d = msg.data;
-	uint8_t *restrict p;
 
-	if (UNLIKELY(!__msg_fits_p(us, z) || !__svc_same_p(us, msg.svc))) {
-		/* send what we've got */
-		if (UNLIKELY(ud_flush(sock)) < 0) {
-			/* nah, don't pack up new stuff,
-			 * we need to get rid of the old shit first
-			 * actually this should be configurable behaviour */
-			return -1;
-		}
+	if (UNLIKELY(us->nrd == 0UL)) {
+		return -1;
 	}
+	/* zero-copy */
+	tgt->src = (const struct sockaddr*)&us->src->sa;
+	tgt->pno = be16toh(us->recv->hdr.pno);
+	tgt->svc = be16toh(us->recv->hdr.cmd);
+	tgt->len = us->nrd;
+	tgt->ts = us->rts;
+	return 0;
+}
 
-	/* update service slot, always */
-	us->svc = msg.svc;
+int
+ud_get_txaux(
+	struct ud_auxmsg_s *restrict UNUSED(tgt), ud_sock_t UNUSED(sock))
+{
+#if defined HAVE_TX_TSTAMP
+	__sock_t us = (__sock_t)sock;
+	uint8_t ALGN16(ctl[
+		CMSG_SPACE(sizeof(struct scm_timestamping)) +
+		CMSG_SPACE(sizeof(struct sock_extended_err) +
+			   sizeof(struct sockaddr_in6))]);
+	struct msghdr m = {
+		.msg_control = ctl,
+		.msg_controllen = sizeof(ctl),
+	};
+	struct timespec ts = {0};
+	bool idp = false;
+	uint32_t id = 0U;
 
-	/* now copy the blob */
-#define UDPC_TYPE_DATA	(0x0cU)
-	p = us->send.pl + us->npk;
-	{
-		uint8_t rs = (uint8_t)(z % 256U);
-		uint8_t xc = (uint8_t)(z / 256U);
+	if (!(us->opt.mode_opt & UD_MOPT_TSTAMP) || !(us->opt.mode & UD_PUB)) {
+		return -1;
+	} else if (recvmsg(us->fd_send, &m, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		/* nothing to report */
+		return -1;
+	}
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+	     c != NULL; c = CMSG_NXTHDR(&m, c)) {
+		if (c->cmsg_level == SOL_SOCKET &&
+		    c->cmsg_type == SCM_TIMESTAMPING) {
+			struct scm_timestamping tss;
 
-		*p++ = (uint8_t)(UDPC_TYPE_DATA | (xc << 4U));
-		*p++ = rs;
+			memcpy(&tss, CMSG_DATA(c), sizeof(tss));
+			/* software stamps go in the first slot */
+			ts = tss.ts[0U];
+		} else if (c->cmsg_level == IPPROTO_IPV6 &&
+			   c->cmsg_type == IPV6_RECVERR) {
+			struct sock_extended_err ee;
+
+			memcpy(&ee, CMSG_DATA(c), sizeof(ee));
+			if (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+				id = ee.ee_data;
+				idp = true;
+			}
+		}
 	}
-	memcpy(p, d, z);
-	p += z;
+	if (!idp) {
+		return -1;
+	}
+	tgt->src = (const struct sockaddr*)&us->dst->sa;
+	tgt->pno = us->txpno[id % NTXQ];
+	tgt->svc = 0U;
+	tgt->len = 0U;
+	tgt->ts = ts;
+	return 0;
+#else  /* !HAVE_TX_TSTAMP */
+	return -1;
+#endif	/* HAVE_TX_TSTAMP */
+}
 
-	/* and update counters */
-	us->npk = p - us->send.pl;
+
+int
+ud_get_stats(struct ud_stats_s *restrict tgt, ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+
+	*tgt = us->st;
 	return 0;
 }
 
 int
-ud_pack(ud_sock_t sock, ud_svc_t svc, const void *data, size_t dlen)
+ud_get_src_stats(
+	struct ud_stats_s *restrict tgt, ud_sock_t sock,
+	const struct sockaddr *src)
 {
-	return ud_pack_msg(sock, (struct ud_msg_s){
-				.svc = svc, .data = data, .dlen = dlen});
+	__sock_t us = (__sock_t)sock;
+	const struct __seq_s *q;
+
+	if (UNLIKELY(src == NULL || src->sa_family != AF_INET6)) {
+		return -1;
+	} else if ((q = __seq_slot(us, (const void*)src, false)) == NULL) {
+		/* never heard of him */
+		return -1;
+	}
+	*tgt = q->st;
+	tgt->nsrc = 1U;
+	return 0;
 }
 
-static inline __attribute__((pure)) bool
-__ctrl_msg_p(ud_svc_t svc)
+#if defined HAVE_LINUX_FILTER_H && defined SO_ATTACH_FILTER
+/* udp sockets see the udp header in front of ours */
+# define FILT_CMD	(8U + offsetof(struct ud_hdr_s, cmd))
+# define FILT_MAGIC	(8U + offsetof(struct ud_hdr_s, magic))
+/* fixed prologue and epilogue, 2 insns per service or channel */
+# define FILT_NINS(ns, nc)	(13U + 2U * ((ns) + (nc)))
+
+static size_t
+__filt_prog(struct sock_filter *restrict p,
+	    const ud_svc_t *svc, size_t nsvc, const uint8_t *chn, size_t nchn)
 {
-	return UD_CHN(svc) == UD_CHN_CTRL;
+	size_t i = 0U;
+
+	/* mixed v2 packets go as service 0, let them through */
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, FILT_CMD);
+	p[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0U, 0U, 5U);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, FILT_MAGIC);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xff00U);
+	p[i++] = (struct sock_filter)BPF_JUMP(
+		BPF_JMP | BPF_JEQ | BPF_K, UD_MAGIC_DATA2, 0U, 1U);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ~0U);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, FILT_CMD);
+	/* keep the service in X, check channels first */
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0U);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 8U);
+	/* control channel is ours, naks, parity, pings, etc. */
+	p[i++] = (struct sock_filter)BPF_JUMP(
+		BPF_JMP | BPF_JEQ | BPF_K, UD_CHN_CTRL, 0U, 1U);
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ~0U);
+	for (size_t j = 0U; j < nchn; j++) {
+		p[i++] = (struct sock_filter)BPF_JUMP(
+			BPF_JMP | BPF_JEQ | BPF_K, chn[j], 0U, 1U);
+		p[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ~0U);
+	}
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TXA, 0U);
+	for (size_t j = 0U; j < nsvc; j++) {
+		p[i++] = (struct sock_filter)BPF_JUMP(
+			BPF_JMP | BPF_JEQ | BPF_K, svc[j], 0U, 1U);
+		p[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ~0U);
+	}
+	/* fuck off */
+	p[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0U);
+	return i;
 }
+#endif	/* HAVE_LINUX_FILTER_H && SO_ATTACH_FILTER */
 
 int
-ud_chck_msg(struct ud_msg_s *restrict tgt, ud_sock_t sock)
+ud_set_filter(
+	ud_sock_t sock,
+	const ud_svc_t *svc, size_t nsvc, const uint8_t *chn, size_t nchn)
 {
+#if defined HAVE_LINUX_FILTER_H && defined SO_ATTACH_FILTER
 	__sock_t us = (__sock_t)sock;
-	ud_svc_t svc;
-	uint8_t *restrict p;
 
-	if (UNLIKELY(us->nck >= us->nrd)) {
-		/* we need another dose */
-		if (UNLIKELY(ud_dscrd(sock)) < 0) {
-			/* nah, don't pack up new stuff,
-			 * we need to get rid of the old shit first
-			 * actually this should be configurable behaviour */
-			return -1;
-		} else if (us->nck >= us->nrd) {
-			/* no more data, just fuck off */
+	if (UNLIKELY(!(us->opt.mode & UD_SUB))) {
+		return -1;
+	} else if (UNLIKELY(us->opt.mode_opt & UD_MOPT_RELIABLE)) {
+		/* we'd be NAKing what the kernel threw away */
+		return -1;
+	} else if (svc == NULL && chn == NULL) {
+		/* everything goes */
+		int z = 0;
+
+		if (setsockopt(us->fd, SOL_SOCKET, SO_DETACH_FILTER,
+			       &z, sizeof(z)) < 0 && errno != ENOENT) {
 			return -1;
 		}
+		us->filt = false;
+		return 0;
 	}
-
-	/* check for control messages */
-	if (UNLIKELY(__ctrl_msg_p(svc = be16toh(us->recv.hdr.cmd)))) {
-		(void)ud_chck_cmsg(tgt, sock);
-	}
-
-	/* now copy the blob */
-	p = us->recv.pl + us->nck;
-	if (UNLIKELY((*p & 0x0fU) != UDPC_TYPE_DATA)) {
-		us->nrd = us->nck = 0U;
+	/* a NULL set is an empty set */
+	nsvc = svc != NULL ? nsvc : 0U;
+	nchn = chn != NULL ? nchn : 0U;
+	if (FILT_NINS(nsvc, nchn) > BPF_MAXINSNS) {
 		return -1;
 	}
-	/* the length comes from 12 bits, the upper 4 of p[0] and 8 of p[1] */
-	tgt->dlen = ((p[0] & 0xf0U) >> 4U) + p[1];
-	tgt->data = p + 2;
-
-	/* and the message service */
-	tgt->svc = svc;
+	{
+		struct sock_filter p[FILT_NINS(nsvc, nchn)];
+		struct sock_fprog fp = {
+			.len = (unsigned short)__filt_prog(
+				p, svc, nsvc, chn, nchn),
+			.filter = p,
+		};
 
-	/* and update counters */
-	us->nck += tgt->dlen + 1U/*for UDPC_TYPE_DATA*/ + 1U/*for length*/;
+		/* attaching again swaps the old program out atomically */
+		if (setsockopt(us->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			       &fp, sizeof(fp)) < 0) {
+			return -1;
+		}
+	}
+	us->filt = true;
 	return 0;
+#else  /* !HAVE_LINUX_FILTER_H || !SO_ATTACH_FILTER */
+	return -1;
+#endif	/* HAVE_LINUX_FILTER_H && SO_ATTACH_FILTER */
 }
 
-ssize_t
-ud_chck(ud_svc_t *svc, void *restrict tgt, size_t tsz, ud_sock_t sock)
+int
+ud_wait(ud_sock_t sock, int timeout)
 {
-	struct ud_msg_s msg = {0};
+	__sock_t us = (__sock_t)sock;
+	struct pollfd fds[1];
+	const uint64_t end = timeout > 0 ? __now_ms() + timeout : 0U;
+	int res;
 
-	if (ud_chck_msg(&msg, sock) < 0) {
-		return -1;
+	if (us->shm != NULL) {
+		return __shm_wait(us, timeout);
 	}
-	/* otherwise copy to user buffer */
-	if (UNLIKELY(msg.dlen > tsz)) {
-		msg.dlen = tsz;
+	fds->fd = us->fd;
+	fds->events = POLLIN;
+	while ((res = poll(fds, countof(fds), __nak_tmo(us, timeout))) == 0) {
+		const uint64_t now = __now_ms();
+
+		if (!us->nakt) {
+			break;
+		}
+		/* woken for NAKs, send them and wait for the rest */
+		__nak_due(us);
+		if (timeout == 0 || (timeout > 0 && now >= end)) {
+			break;
+		} else if (timeout > 0) {
+			timeout = (int)(end - now);
+		}
 	}
-	*svc = msg.svc;
-	memcpy(tgt, msg.data, msg.dlen);
-	return msg.dlen;
+	return res;
 }
 
-const struct sockaddr*
-ud_socket_addr(ud_sock_t s)
+int
+ud_join_chn(ud_sock_t sock, uint8_t chn)
 {
-	__sock_t us = (__sock_t)s;
-	return (const struct sockaddr*)&us->dst->sa;
+	__sock_t us = (__sock_t)sock;
+	struct __grp_s *g;
+
+	if (UNLIKELY(us->grp == NULL || !(us->opt.mode & UD_SUB))) {
+		return -1;
+	} else if (chn == UD_CHN_CTRL) {
+		/* always on the main group */
+		return 0;
+	} else if (us->chn[chn / 64U] & (1ULL << (chn % 64U))) {
+		/* joined already */
+		return 0;
+	}
+	g = us->grp + chn % us->opt.ngroup;
+	if (g->nref == 0U &&
+	    setsockopt(us->fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+		       g->memb, sizeof(*g->memb)) < 0) {
+		return -1;
+	}
+	g->nref++;
+	us->chn[chn / 64U] |= 1ULL << (chn % 64U);
+	return 0;
 }
 
 int
-ud_get_aux(struct ud_auxmsg_s *restrict tgt, ud_sock_t sock)
+ud_leave_chn(ud_sock_t sock, uint8_t chn)
 {
 	__sock_t us = (__sock_t)sock;
+	struct __grp_s *g;
 
-	if (UNLIKELY(us->nrd == 0UL)) {
+	if (UNLIKELY(us->grp == NULL || !(us->opt.mode & UD_SUB))) {
 		return -1;
+	} else if (!(us->chn[chn / 64U] & (1ULL << (chn % 64U)))) {
+		/* never joined */
+		return 0;
 	}
-	/* zero-copy */
-	tgt->src = (const struct sockaddr*)&us->src->sa;
-	tgt->pno = be16toh(us->recv.hdr.pno);
-	tgt->svc = be16toh(us->recv.hdr.cmd);
-	tgt->len = us->nrd;
+	g = us->grp + chn % us->opt.ngroup;
+	if (--g->nref == 0U) {
+		/* last channel on that group */
+		mc6_leave_group(us->fd, g->memb);
+	}
+	us->chn[chn / 64U] &= ~(1ULL << (chn % 64U));
 	return 0;
 }
 
-
+
 /* now come private bits of the API, touch'n'go:
  * these may or may not disappear, change, reappear, or even go in the
  * public API one day */
@@ -710,7 +4044,8 @@ ud_get_aux(struct ud_auxmsg_s *restrict tgt, ud_sock_t sock)
 int
 ud_pack_cmsg(ud_sock_t sock, struct ud_msg_s msg)
 {
-	static union ud_ctrl_u ALGN16(ctrl);
+	/* on the stack, so sockets can be used from different threads */
+	union ud_ctrl_u ALGN16(ctrl);
 	__sock_t us = (__sock_t)sock;
 	uint8_t *p;
 
@@ -720,7 +4055,6 @@ ud_pack_cmsg(ud_sock_t sock, struct ud_msg_s msg)
 	}
 
 	/* now copy the blob */
-#define UDPC_TYPE_DATA	(0x0cU)
 	p = ctrl.pl;
 	*p++ = UDPC_TYPE_DATA;
 	*p++ = (uint8_t)msg.dlen;
@@ -738,14 +4072,29 @@ ud_pack_cmsg(ud_sock_t sock, struct ud_msg_s msg)
 		ctrl.hdr.ini = htobe16(UD_PROTO_INI);
 		ctrl.hdr.pno = htobe16(us->pno);
 		ctrl.hdr.cmd = htobe16(msg.svc);
-		ctrl.hdr.magic = htobe16(0xda7a);
+		ctrl.hdr.magic = htobe16(UD_MAGIC_DATA);
 
-		if ((nwr = sendto(us->fd_send, b, z, 0, sa, sz)) < 0) {
+		if (us->shm != NULL) {
+			/* node-local */
+			if (__shm_put(us, b, z) < 0) {
+				return -1;
+			}
+			__shm_wake(us->shm);
+		} else if ((nwr = sendto(us->fd_send, b, z, 0, sa, sz)) < 0) {
 			return -1;
 		} else if ((size_t)nwr < z) {
 			/* should we try a resend? */
 			;
 		}
+		__tx_note(us, b);
+		if (us->nhs > 0U) {
+			/* NAKs may ask for it like for any other pno */
+			__hist_add(us, b, z);
+		}
+		if (us->facc != NULL) {
+			/* parity covers every packet with a pno */
+			__fec_add(us, b, z);
+		}
 
 		/* update our counters and stuff */
 		us->pno++;
@@ -753,14 +4102,72 @@ ud_pack_cmsg(ud_sock_t sock, struct ud_msg_s msg)
 	return 0;
 }
 
+/* taps */
+int
+ud_tap(ud_sock_t sock)
+{
+	__sock_t us = (__sock_t)sock;
+
+	if (UNLIKELY(!(us->opt.mode & UD_SUB) || us->shm != NULL)) {
+		return -1;
+	}
+#if defined HAVE_LINUX_FILTER_H && defined SO_ATTACH_FILTER
+	{
+		/* the wire's no use to us now, have the kernel drop it all */
+		struct sock_filter p[] = {
+			BPF_STMT(BPF_RET | BPF_K, 0U),
+		};
+		struct sock_fprog fp = {
+			.len = countof(p),
+			.filter = p,
+		};
+
+		(void)setsockopt(us->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+				 &fp, sizeof(fp));
+	}
+#endif	/* HAVE_LINUX_FILTER_H && SO_ATTACH_FILTER */
+	us->tap = true;
+	us->nrf = 0U;
+	us->irs = 0U;
+	us->nrd = 0U;
+	us->nck = 0U;
+	return 0;
+}
+
 int
-ud_chck_cmsg(struct ud_msg_s *restrict UNUSED(tgt), ud_sock_t sock)
+ud_inject(
+	ud_sock_t sock, void *p, size_t z,
+	const struct sockaddr *src, const struct timespec *ts)
 {
 	__sock_t us = (__sock_t)sock;
+
+	if (UNLIKELY(!us->tap)) {
+		return -1;
+	} else if (UNLIKELY(src == NULL || src->sa_family != AF_INET6)) {
+		return -1;
+	}
+	us->isrc->sa.sa6 = *(const struct sockaddr_in6*)src;
+	us->isrc->sz = sizeof(us->isrc->sa.sa6);
+	us->src = us->isrc;
+	us->rts = ts != NULL ? *ts : (struct timespec){0};
+	/* pretend the ring is exhausted, so P is the last packet */
+	us->nrf = 0U;
+	us->irs = 0U;
+	us->nck = 0U;
+	if (__take(us, p, z) < 0) {
+		us->nrd = 0U;
+		return -1;
+	}
+	return 0;
+}
+
+int
+ud_chck_cmsg(struct ud_msg_s *restrict tgt, ud_sock_t sock)
+{
 	ud_svc_t svc;
 
 	/* check for control messages */
-	if (UNLIKELY(!__ctrl_msg_p(svc = be16toh(us->recv.hdr.cmd)))) {
+	if (UNLIKELY(!__ctrl_msg_p(svc = tgt->svc))) {
 		/* don't discard or update */
 		return -1;
 	}
@@ -774,6 +4181,9 @@ ud_chck_cmsg(struct ud_msg_s *restrict UNUSED(tgt), ud_sock_t sock)
 	case UD_SVC_PING:
 		ud_pack_pong(sock, 1);
 		break;
+	case UD_SVC_NAK:
+		__nak_chck((__sock_t)sock, tgt);
+		break;
 	}
 	return 0;
 }
@@ -40,6 +40,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <sys/types.h>
 
 #if defined __cplusplus
@@ -65,6 +66,9 @@ extern "C" {
 /* just offer a default address for some tools */
 #define UD_MCAST6_ADDR		UD_MCAST6_SITE_LOCAL
 
+/* first of the site-local groups channels are spread over */
+#define UD_MCAST6_CHN_BASE	"ff15::134:0"
+
 typedef struct ud_sock_s *ud_sock_t;
 typedef const struct ud_sock_s *ud_const_sock_t;
 
@@ -73,8 +77,13 @@ typedef uint16_t ud_svc_t;
 /**
  * Public type for unserding sockets. */
 struct ud_sock_s {
-	/** socket for I/O, can be used as if acquired by `socket()' */
+	/** socket for I/O, can be used as if acquired by `socket()',
+	 * -1 for node-local sockets, see `ud_wait()' */
 	const int fd;
+	/** timer, readable when packs are due for flushing, or when
+	 * paced packets may go, or when NAKs of reliable subscribers are
+	 * due (see `ud_chck_msg()'), or -1 */
+	const int tfd;
 	/** generic socket indicator */
 	const uint32_t fl;
 	/** data ptr the library won't touch, for external use by user */
@@ -94,6 +103,16 @@ struct ud_msg_s {
 	size_t dlen;
 };
 
+/**
+ * Tick record, see `ud_pack_tick()'. */
+struct ud_tick_s {
+	/** time stamp, in units of the publisher's choosing */
+	int64_t ts;
+	/** price and size, as fixed point integers */
+	int64_t px;
+	int64_t qty;
+};
+
 /**
  * Message with auxiliary data. */
 struct ud_auxmsg_s {
@@ -101,6 +120,33 @@ struct ud_auxmsg_s {
 	uint16_t pno;
 	ud_svc_t svc;
 	uint32_t len;
+	/** time the packet arrived, or left, as stamped by the kernel,
+	 * only with UD_MOPT_TSTAMP, 0 otherwise */
+	struct timespec ts;
+};
+
+/**
+ * Packet statistics, as seen by subscribers. */
+struct ud_stats_s {
+	/** number of packets received */
+	size_t npkt;
+	/** number of packets missing, judging by packet numbers */
+	size_t ngap;
+	/** number of packets received more than once */
+	size_t ndup;
+	/** number of packets received out of order */
+	size_t nreo;
+	/** number of sources seen */
+	size_t nsrc;
+	/** number of `ud_chck_msg_spin()' calls served by spinning */
+	size_t nspin_hit;
+	/** number of `ud_chck_msg_spin()' calls that had to block */
+	size_t nspin_miss;
+	/** number of packets dropped for checksum mismatches */
+	size_t ncrc;
+	/** number of packets the kernel dropped, for want of buffer space
+	 * mostly, as told along with packets that made it */
+	size_t novfl;
 };
 
 /**
@@ -114,8 +160,20 @@ struct ud_sockopt_s {
 	} mode;
 	/** mode options, can be |'d as needed */
 	enum {
-		UD_MOPT_NONE,
-		UD_MOPT_BIND_LOCALLY,
+		UD_MOPT_NONE = 0U,
+		UD_MOPT_BIND_LOCALLY = 1U,
+		/** publish protocol v2 packets, mixing services */
+		UD_MOPT_PROTO2 = 2U,
+		/** ask for and answer retransmissions of lost packets */
+		UD_MOPT_RELIABLE = 4U,
+		/** have the kernel time stamp packets, see `ud_get_aux()' */
+		UD_MOPT_TSTAMP = 8U,
+		/** node-local transport through shared memory */
+		UD_MOPT_SHM = 16U,
+		/** back slabs of `ud_socket_bulk()' by hugepages */
+		UD_MOPT_HUGE = 32U,
+		/** checksum packets, implies UD_MOPT_PROTO2 */
+		UD_MOPT_CRC = 64U,
 	} mode_opt;
 	/** address to send/subscribe to, UD_MCAST6_SITE_LOCAL if NULL */
 	const char *addr;
@@ -123,6 +181,48 @@ struct ud_sockopt_s {
 	const char *intf;
 	/** service to send/subscribe to, UD_NETWORK_SERVICE if 0 */
 	short unsigned int port;
+	/** number of datagrams to fetch off the wire in one go, 1 if 0,
+	 * datagrams are handed out one by one by `ud_chck_msg()' */
+	unsigned int nrecv;
+	/** number of packets to queue up before sending, 1 if 0,
+	 * queued packets go out in one go, or when calling `ud_flush()' */
+	unsigned int nsend;
+	/** link mtu to size packets for, 1500 if 0,
+	 * packets shrink further if the path mtu is found to be smaller */
+	unsigned int mtu;
+	/** number of packets to keep for retransmission, 256 if 0,
+	 * reliable publishers only */
+	unsigned int nhist;
+	/** number of packets covered by one parity packet, 0 for none,
+	 * subscribers recover lost packets from parity if non-0,
+	 * `ud_flush()' cuts the block short and sends its parity */
+	unsigned int nfec;
+	/** maximum time (in us) packs may sit unflushed, 0 for no limit */
+	unsigned int max_delay;
+	/** packet fill (in bytes) at which packs are flushed right away,
+	 * 0 if packets go when full, only used along with MAX_DELAY */
+	unsigned int min_fill;
+	/** number of multicast groups to spread channels over, 0 for none,
+	 * channel C goes to group GROUP_ADDR + C % NGROUP, at most 256 */
+	unsigned int ngroup;
+	/** first group of the range, UD_MCAST6_CHN_BASE if NULL,
+	 * `ud_socket()' fails with EINVAL unless it's a multicast address
+	 * with room for NGROUP groups from there */
+	const char *group_addr;
+	/** time (in us) subscribers spin for packets before blocking,
+	 * 0 for not at all, see `ud_chck_msg_spin()' */
+	unsigned int spin;
+	/** rate (in bytes/s) publishers pace packets at, 0 for no limit */
+	unsigned int rate;
+	/** rate (in packets/s) publishers pace packets at, 0 for no limit */
+	unsigned int pkt_rate;
+	/** number of packets paced publishers may send back to back,
+	 * NSEND if 0 */
+	unsigned int burst;
+	/** receive buffer size (in B, as reported by SO_RCVBUF) that
+	 * subscribers grow to when the kernel drops packets, 0 to leave
+	 * the buffer as it is */
+	unsigned int max_rcvbuf;
 };
 
 
@@ -136,35 +236,210 @@ struct ud_sockopt_s {
  * If ADDRESS and/or SERVICE in OPT is omitted, the site-local address
  * UD_MCAST6_SITE_LOCAL and/or UD_NETWORK_SERVICE is used.
  *
- * MODE must be one of the socket mode specifiers as defined above. */
+ * If NRECV in OPT is greater than 1 the socket keeps a ring of NRECV
+ * receive buffers that are filled in one system call, subsequent calls
+ * to `ud_chck_msg()' walk the ring before going back to the wire.
+ *
+ * Likewise, if NSEND in OPT is greater than 1 packets are not sent
+ * as soon as they are full but queued, the queue is sent in one system
+ * call when it's full or upon `ud_flush()'.
+ *
+ * Subscribers understand protocol v1 and v2 packets alike, publishers
+ * send v1 packets unless UD_MOPT_PROTO2 is given in MODE_OPT, in which
+ * case messages of different services can share a packet.
+ *
+ * With UD_MOPT_RELIABLE subscribers ask for packets they've missed
+ * by sending NAKs on the control channel, a NAK seen from someone else
+ * suppresses one's own.  Reliable PUBSUB sockets keep the last NHIST
+ * packets and retransmit them to the group when asked, NAKs are dealt
+ * with as part of `ud_chck_msg()' so publishers must keep reading.
+ * NAKs for losses no later packet reveals, like at the end of a burst,
+ * go when `ud_chck_msg()' runs dry or from `ud_wait()', and TFD turns
+ * readable when they're due.
+ *
+ * If NFEC in OPT is non-0 publishers follow every NFEC packets with
+ * a parity packet, from which subscribers (also with a non-0 NFEC)
+ * rebuild a single lost packet of those NFEC without asking anyone.
+ *
+ * With UD_MOPT_TSTAMP the kernel stamps received packets with the time
+ * of arrival, see `ud_get_aux()', and sent packets with the time they
+ * left, see `ud_get_txaux()'.  Stamps are taken in software.
+ *
+ * Publishers with a non-0 MAX_DELAY in OPT flush on their own, as soon
+ * as packets are MIN_FILL bytes full, or when packs have been waiting
+ * MAX_DELAY microseconds.  The latter is signalled by the TFD slot of
+ * the result object becoming readable, upon which `ud_flush()' should
+ * be called; packing after the deadline flushes too.
+ *
+ * With a non-0 NGROUP in OPT publishers send messages to the group
+ * of their channel, the upper octet of the service, and subscribers
+ * hear only the channels they join with `ud_join_chn()'.  The control
+ * channel stays on ADDR.  Such sockets can't be UD_MOPT_RELIABLE and
+ * can't have parity, and subscribers count packets sent to groups they
+ * haven't joined as missing.
+ *
+ * With UD_MOPT_SHM packets don't touch the network at all but go
+ * through a ring in shared memory, /dev/shm/unserding.PORT, that all
+ * node-local sockets on PORT share, ADDR is ignored.  The ring is
+ * accessible to its creator's uid only and goes away along with the
+ * last socket attached to it.  Publishing and reading take no system
+ * calls, except for waking up sleepers upon flushing.  There's no FD
+ * to poll, use `ud_wait()' instead.
+ * Subscribers too slow to keep up with the ring lose packets.  Such
+ * sockets can't be UD_MOPT_RELIABLE and can't have an NGROUP.
+ *
+ * With UD_MOPT_CRC publishers append a CRC32C of every packet, flagged
+ * in the magic of the (v2) packet.  Subscribers check flagged packets
+ * no matter what and drop those that don't match.
+ *
+ * Publishers with a non-0 RATE and/or PKT_RATE in OPT keep to those
+ * rates, allowing for BURST packets in a row after a quiet spell.
+ * Packets the rates hold back stay queued and the TFD slot of the
+ * result object becomes readable when they may go, upon which
+ * `ud_flush()' should be called.  Packing fails (with EAGAIN) once
+ * the queue is full.  RATE is also given to the kernel (as
+ * SO_MAX_PACING_RATE), which spreads bursts with the fq qdisc.
+ * Node-local sockets aren't paced.
+ *
+ * Subscribers count the packets the kernel had to drop, see
+ * `ud_get_stats()'.  With a non-0 MAX_RCVBUF in OPT they double their
+ * receive buffer whenever drops show, up to MAX_RCVBUF.  Growing past
+ * net.core.rmem_max takes CAP_NET_ADMIN.  The kernel counts packets
+ * dropped by `ud_set_filter()' alike, so filtered sockets count
+ * nothing and don't grow.
+ *
+ * Subscribers with a non-0 SPIN in OPT have the kernel busy poll the
+ * device queue for up to SPIN microseconds when reading, and
+ * `ud_chck_msg_spin()' spins that long before it goes to sleep.
+ *
+ * Packets are sized for an MTU of 1500 unless MTU in OPT says
+ * otherwise, e.g. 9000 for jumbo frames.  Subscribers take
+ * jumbo packets only if set up with an MTU at least as large.
+ *
+ * MODE must be one of the socket mode specifiers as defined above.
+ *
+ * All state lives in the socket object, different sockets can be used
+ * from different threads at the same time without locking.  A single
+ * socket must not be used by several threads at once. */
 extern ud_sock_t ud_socket(struct ud_sockopt_s opt);
 
 /**
- * Close a socket and free associated resources. */
+ * Close a socket and free associated resources.
+ * Packets still queued, like those held back by the rates, are
+ * flushed first, along with buffered packs.  For paced publishers
+ * this blocks until the rates allow it. */
 extern int ud_close(ud_sock_t sock);
 
+/**
+ * Open N sockets set up like OPT but on PORTS (all on OPT's port if
+ * NULL), putting them into TGT, or NULL where that failed.
+ * Rather than a mapping each the socket objects are packed into shared
+ * slabs, which are hugepage-backed with UD_MOPT_HUGE.  This is meant for
+ * subscribing to hundreds of ports at once.
+ * The sockets behave and can be closed like those of `ud_socket()'; a
+ * slab goes once its last socket is closed.
+ * Return the number of sockets opened. */
+extern size_t
+ud_socket_bulk(
+	ud_sock_t *restrict tgt, struct ud_sockopt_s opt,
+	const uint16_t *ports, size_t n);
+
+/**
+ * Close the N sockets in S, skipping NULLs, and set them to NULL.
+ * Return -1 if any of them failed to close, 0 otherwise. */
+extern int ud_close_bulk(ud_sock_t *s, size_t n);
+
 /* next up packing/unpacking messages */
 /**
  * Produce wire-representation of P (of size Z) in SOCK. */
 extern int ud_pack(ud_sock_t sock, ud_svc_t svc, const void *p, size_t z);
 
 /**
- * Produce wire-representation of MSG in SOCK. */
+ * Produce wire-representation of MSG in SOCK.
+ * Messages must fit into a packet, use `ud_pack_lmsg()' otherwise. */
 extern int ud_pack_msg(ud_sock_t sock, struct ud_msg_s msg);
 
 /**
- * Flush buffered packs immediately. */
+ * Produce wire-representation of the large message MSG in SOCK.
+ * MSG is split into fragments, one per packet, which subscribers
+ * reassemble and hand out through `ud_chck_msg()' as a whole.
+ * Messages small enough to fit into a packet are packed as usual.
+ * Upon failure (-1) fragments packed up to that point may still be
+ * sent, subscribers discard such incomplete messages once their
+ * reassembly times out (1s), so MSG has to be packed anew. */
+extern int ud_pack_lmsg(ud_sock_t sock, struct ud_msg_s msg);
+
+/**
+ * Produce wire-representation of tick T as message of service SVC.
+ * Ticks are delta-encoded against the last tick of SVC in the same
+ * packet as zigzag varints, the first tick of a service in a packet
+ * goes against 0, so lost packets never spoil others.
+ * Subscribers get these as messages of service SVC pointing to the
+ * decoded `struct ud_tick_s', which is valid until the next
+ * `ud_chck_msg()'. */
+extern int
+ud_pack_tick(ud_sock_t sock, ud_svc_t svc, const struct ud_tick_s *t);
+
+/**
+ * Flush buffered packs immediately, along with queued packets.
+ * Paced publishers hold back what the rates don't allow yet and
+ * return 0 nonetheless, those packets go upon later calls, see TFD,
+ * or, at the latest, in `ud_close()'. */
 extern int ud_flush(ud_sock_t sock);
 
+/**
+ * Give service SVC of publisher SOCK priority PRIO, 0 being normal.
+ * Packets of services with a non-0 priority go out as soon as they're
+ * closed, past queued packets and regardless of pacing, even when the
+ * queue is full.  They count against the rates all the same, so
+ * queued packets wait that much longer, and the kernel's pacing is
+ * lifted while there are any.  Their messages don't share packets
+ * with others, and large messages are queued like any other.
+ * Overtaken packets look lost to UD_MOPT_RELIABLE subscribers until
+ * they arrive, NAKs for them are ignored while they're still queued.
+ * At most 16 services can have priority, return -1 if SVC makes 17. */
+extern int ud_set_prio(ud_sock_t sock, ud_svc_t svc, int prio);
+
 /**
  * Read messages from SOCK and return a deserialised version in TGT. */
 extern ssize_t
 ud_chck(ud_svc_t *restrict svc, void *restrict tgt, size_t tsz, ud_sock_t sock);
 
 /**
- * Read messages from SOCK and return a deserialised version in TGT. */
+ * Read messages from SOCK and return a deserialised version in TGT.
+ * The data in TGT is valid until the next call. */
 extern int ud_chck_msg(struct ud_msg_s *restrict tgt, ud_sock_t sock);
 
+/**
+ * Wait up to TIMEOUT milliseconds, or forever if negative, for packets
+ * to arrive on SOCK, like `poll()'ing its FD would.
+ * Return a positive value if there's something to read, 0 on timeout,
+ * -1 on error. */
+extern int ud_wait(ud_sock_t sock, int timeout);
+
+/**
+ * Like `ud_chck_msg()' but keep trying for SPIN microseconds, as
+ * configured in `ud_socket()', and then block for up to TIMEOUT
+ * milliseconds, or forever if negative.
+ * The number of calls served by spinning and by blocking go into
+ * the socket's statistics. */
+extern int
+ud_chck_msg_spin(struct ud_msg_s *restrict tgt, ud_sock_t sock, int timeout);
+
+/**
+ * Like `ud_chck_msg()' but fill up to N messages into TGT at once and,
+ * unless NULL, their aux info into AUX, as `ud_get_aux()' would.
+ * Messages come from the packets read off the wire in one go, as many
+ * as NRECV in `ud_socket()', which is only gone back to if there's
+ * nothing left.  Nothing but decoded ticks is copied, TGT and AUX point
+ * into the socket's receive ring and stay valid until the next call.
+ * Up to 256 ticks fit in a batch, and a large message ends it.
+ * Return the number of messages in TGT, or -1 if there's none. */
+extern ssize_t
+ud_chck_mmsg(
+	struct ud_msg_s *restrict tgt, struct ud_auxmsg_s *restrict aux,
+	size_t n, ud_sock_t sock);
+
 /**
  * Discard buffered packs from previous `ud_chck()'. */
 extern int ud_dscrd(ud_sock_t sock);
@@ -173,10 +448,142 @@ extern int ud_dscrd(ud_sock_t sock);
  * For current messages in S fill in the auxmsg object TGT. */
 extern int ud_get_aux(struct ud_auxmsg_s *restrict tgt, ud_sock_t s);
 
+/**
+ * For publishers with UD_MOPT_TSTAMP fill in TGT with the PNO of a sent
+ * packet and the time it left this host, in order of sending.
+ * Return -1 if there's nothing (yet) to report.
+ * For UD_PUB sockets pending reports make FD signal an error condition
+ * when polled. */
+extern int ud_get_txaux(struct ud_auxmsg_s *restrict tgt, ud_sock_t s);
+
+/**
+ * Fill in TGT with packet statistics of SOCK, over all sources. */
+extern int ud_get_stats(struct ud_stats_s *restrict tgt, ud_sock_t sock);
+
+/**
+ * Fill in TGT with packet statistics of SOCK for packets from SRC,
+ * as obtained through `ud_get_aux()'.
+ * Return -1 if SRC is not (or no longer) tracked. */
+extern int
+ud_get_src_stats(
+	struct ud_stats_s *restrict tgt, ud_sock_t sock,
+	const struct sockaddr *src);
+
+/**
+ * Have the kernel drop packets on SOCK unless their service is in SVC
+ * (of size NSVC) or their channel, the upper octet of the service, is
+ * in CHN (of size NCHN).  Control channel packets and mixed protocol
+ * v2 packets always pass, the rest never leaves the kernel.
+ * Calling this again replaces the filter, passing NULL for both SVC
+ * and CHN removes it.
+ * Packets filtered count as missing in the statistics, filters can't
+ * be set on UD_MOPT_RELIABLE sockets for that reason. */
+extern int
+ud_set_filter(
+	ud_sock_t sock,
+	const ud_svc_t *svc, size_t nsvc, const uint8_t *chn, size_t nchn);
+
+/**
+ * Subscribe SOCK, set up with a non-0 NGROUP, to channel CHN.
+ * This joins CHN's multicast group, packets of other channels sharing
+ * that group arrive as well, use `ud_set_filter()' to get rid of them. */
+extern int ud_join_chn(ud_sock_t sock, uint8_t chn);
+
+/**
+ * Unsubscribe SOCK from channel CHN.
+ * The group is left once no joined channel shares it any more. */
+extern int ud_leave_chn(ud_sock_t sock, uint8_t chn);
+
 /**
  * Return the network SOCK is pubbing or subbed to. */
 extern const struct sockaddr *ud_socket_addr(ud_sock_t);
 
+
+/* dispatching messages by service */
+/**
+ * Handlers for messages dispatched by `ud_disp_run()', MSG is only
+ * valid during the call. */
+typedef void(*ud_disp_f)(ud_sock_t s, const struct ud_msg_s *msg, void *clo);
+
+/**
+ * Have messages of service SVC on SOCK dispatched to CB with CLO as
+ * closure, or, if CB is NULL, to the handler of SVC's channel.
+ * Handlers are looked up in a table by channel and service, so the
+ * number of them doesn't matter.  This may be called from handlers. */
+extern int ud_disp_on(ud_sock_t sock, ud_svc_t svc, ud_disp_f cb, void *clo);
+
+/**
+ * Have messages of channel CHN, the upper octet of the service, on
+ * SOCK dispatched to CB with CLO as closure unless their service has a
+ * handler of its own, or dropped if CB is NULL. */
+extern int
+ud_disp_on_chn(ud_sock_t sock, uint8_t chn, ud_disp_f cb, void *clo);
+
+/**
+ * Check SOCK for up to N messages, or as many as there are if N is 0,
+ * and dispatch them to their handlers.  Within handlers `ud_get_aux()'
+ * refers to the message being dispatched.
+ * Return the number of messages dispatched, or -1 if no handlers have
+ * been set up. */
+extern ssize_t ud_disp_run(ud_sock_t sock, size_t n);
+
+
+/* draining many sockets in one loop */
+typedef struct ud_poller_s *ud_poller_t;
+
+/**
+ * Callbacks for messages dispatched by `ud_poller_run()', MSG is only
+ * valid during the call. */
+typedef void(*ud_poller_f)(ud_sock_t s, const struct ud_msg_s *msg, void *clo);
+
+/**
+ * Return a poller over an epoll set of sockets, or NULL if that's not
+ * supported.  Every round no socket is drained of more than BUDGET
+ * messages (64 if 0), so hot sockets can't starve the rest.
+ * The poller must be closed by `ud_poller_close()'. */
+extern ud_poller_t ud_poller_open(unsigned int budget);
+
+/**
+ * Close the poller P, the sockets are left alone. */
+extern int ud_poller_close(ud_poller_t p);
+
+/**
+ * Return the descriptor of P, for use in other event loops.
+ * It polls readable when any of P's sockets is, or when sockets ran
+ * out of budget in the last round. */
+extern int ud_poller_fd(ud_poller_t p);
+
+/**
+ * Add S to P's set.  UD_MOPT_SHM sockets can't be polled.
+ * S's timer, if any, goes along and `ud_poller_run()' serves it, see
+ * the tfd slot of `struct ud_sock_s'. */
+extern int ud_poller_add(ud_poller_t p, ud_sock_t s);
+
+/**
+ * Remove S from P's set, this may be called from within callbacks.
+ * S must be removed before it's closed. */
+extern int ud_poller_del(ud_poller_t p, ud_sock_t s);
+
+/**
+ * Have messages of service SVC dispatched to CB with CLO as closure,
+ * or, if CB is NULL, not any more. */
+extern int
+ud_poller_on(ud_poller_t p, ud_svc_t svc, ud_poller_f cb, void *clo);
+
+/**
+ * Have messages whose services have no callback of their own dispatched
+ * to CB with CLO as closure, or dropped if CB is NULL. */
+extern int ud_poller_on_any(ud_poller_t p, ud_poller_f cb, void *clo);
+
+/**
+ * Wait up to TIMEOUT milliseconds, or forever if negative, for P's
+ * sockets to become readable, then drain those and dispatch their
+ * messages.  Sockets that ran out of budget are served first next round
+ * which then doesn't wait.  Sockets whose timer went off are flushed
+ * before they're drained.
+ * Return the number of messages dispatched, or -1 on error. */
+extern ssize_t ud_poller_run(ud_poller_t p, int timeout);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
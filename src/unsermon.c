@@ -72,6 +72,7 @@
 #include "ud-nifty.h"
 #include "ud-logger.h"
 #include "ud-module.h"
+#include "ud-tpacket.h"
 #include "boobs.h"
 #include "unsermon.h"
 
@@ -88,6 +89,12 @@
 
 static FILE *monout;
 
+/* sockets to decode captured traffic with */
+static struct mon_tap_s {
+	ev_io *beef;
+	size_t nbeef;
+} tap[1];
+
 
 /* DSO handling */
 static int
@@ -172,10 +179,12 @@ __mondec(ud_svc_t svc)
 }
 
 static inline size_t
-hrclock_print(char *buf, size_t len)
+hrclock_print(char *buf, size_t len, struct timespec tsp)
 {
-	struct timespec tsp;
-	clock_gettime(CLOCK_REALTIME, &tsp);
+	if (!tsp.tv_sec && !tsp.tv_nsec) {
+		/* no kernel stamp, use the current time */
+		clock_gettime(CLOCK_REALTIME, &tsp);
+	}
 	return snprintf(buf, len, "%ld.%09li", tsp.tv_sec, tsp.tv_nsec);
 }
 
@@ -188,16 +197,18 @@ mon_pkt_cb(ud_sock_t s, const struct ud_msg_s msg[static 1])
 	struct ud_auxmsg_s aux[1];
 	ud_mondec_f cb;
 
-	/* print a time stamp */
-	epi += hrclock_print(buf, sizeof(buf));
-	*epi++ = '\t';
-
 	if (ud_get_aux(aux, s) < 0) {
 		/* uh oh */
+		epi += hrclock_print(buf, sizeof(buf), (struct timespec){0});
+		*epi++ = '\t';
 		*epi++ = '?';
 		goto bang;
 	}
 
+	/* print a time stamp, the kernel's if there is one */
+	epi += hrclock_print(buf, sizeof(buf), aux->ts);
+	*epi++ = '\t';
+
 	/* otherwise */
 	{
 		/* obtain the address in human readable form */
@@ -214,17 +225,17 @@ mon_pkt_cb(ud_sock_t s, const struct ud_msg_s msg[static 1])
 		epi += snprintf(epi, 16, ":%hu", port);
 	}
 
-	/* next up, size */
+	/* next up, size, services come with the message since v2 */
 	epi += snprintf(
 		epi, 256, "\t%04x\t%04hx\t%04hx\t",
-		aux->len, aux->pno, aux->svc);
+		aux->len, aux->pno, msg->svc);
 
 	/* go for the actual message */
-	if ((cb = __mondec(aux->svc)) != NULL) {
-		epi += cb(epi, 512, aux->svc, msg);
+	if ((cb = __mondec(msg->svc)) != NULL) {
+		epi += cb(epi, 512, msg->svc, msg);
 	} else {
 		/* intercept special channels */
-		switch (aux->svc) {
+		switch (msg->svc) {
 		case UD_CTRL_SVC(UD_SVC_CMD):
 			epi += snprintf(epi, 256, "CMD request");
 			break;
@@ -418,6 +429,62 @@ mon_beef_cb(EV_P_ ev_io *w, int UNUSED(revents))
 	return;
 }
 
+static void
+mon_poll_msg(ud_sock_t s, const struct ud_msg_s *msg, void *UNUSED(clo))
+{
+	/* report activity */
+	mon_beef_actvty(s);
+	mon_pkt_cb(s, msg);
+	return;
+}
+
+static void
+mon_poll_cb(EV_P_ ev_io *w, int UNUSED(revents))
+{
+	(void)ud_poller_run(w->data, 0);
+	return;
+}
+
+static void
+mon_tpkt_frm(const struct ud_tpkt_frm_s *f, void *clo)
+{
+	const struct mon_tap_s *t = clo;
+
+	/* find the socket for the port */
+	for (size_t i = 0; i <= t->nbeef; i++) {
+		ud_sock_t s = t->beef[i].data;
+		const struct sockaddr_in6 *sa;
+
+		if (s == NULL) {
+			continue;
+		} else if ((sa = (const void*)ud_socket_addr(s)) == NULL) {
+			continue;
+		} else if (sa->sin6_port != f->dst.sin6_port) {
+			continue;
+		} else if (ud_inject(s, f->pl, f->plz,
+				     (const void*)&f->src, &f->ts) < 0) {
+			break;
+		}
+		/* report activity */
+		mon_beef_actvty(s);
+
+		for (struct ud_msg_s msg[1]; ud_chck_msg(msg, s) == 0;) {
+			mon_pkt_cb(s, msg);
+		}
+		break;
+	}
+	return;
+}
+
+static void
+mon_tpkt_cb(EV_P_ ev_io *w, int UNUSED(revents))
+{
+	ud_tpkt_t t = w->data;
+
+	(void)ud_tpkt_walk(t, mon_tpkt_frm, tap);
+	return;
+}
+
 static void
 sigint_cb(EV_P_ ev_signal *UNUSED(w), int UNUSED(revents))
 {
@@ -472,6 +539,12 @@ main(int argc, char *argv[])
 	ev_signal sigpipe_watcher[1];
 	ev_io *beef = NULL;
 	size_t nbeef;
+	/* capture ring, if any */
+	ud_tpkt_t tpkt = NULL;
+	ev_io tpkt_w[1];
+	/* one loop over all beef channels, NULL if we watch them one by one */
+	ud_poller_t mon_poll;
+	ev_io poll_w[1];
 	/* args */
 	struct gengetopt_args_info argi[1];
 
@@ -513,29 +586,80 @@ main(int argc, char *argv[])
 	{
 		ud_sock_t s;
 
-		if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) != NULL) {
+		if ((s = ud_socket((struct ud_sockopt_s){
+				UD_SUB,
+				.mode_opt = UD_MOPT_TSTAMP,
+				})) != NULL) {
 			beef->data = s;
 			ev_io_init(beef, mon_beef_cb, s->fd, EV_READ);
-			ev_io_start(EV_A_ beef);
 			log_rgstr(s);
 		}
 	}
 
-	/* go through all beef channels */
-	for (unsigned int i = 0, j = 0; i < argi->beef_given; i++) {
-		ud_sock_t s;
+	/* go through all beef channels, en bloc so they share slabs */
+	if (argi->beef_given) {
+		uint16_t ports[argi->beef_given];
+		ud_sock_t s[argi->beef_given];
 
-		if ((s = ud_socket((struct ud_sockopt_s){
+		for (unsigned int i = 0; i < argi->beef_given; i++) {
+			ports[i] = (uint16_t)argi->beef_arg[i];
+		}
+		(void)ud_socket_bulk(s, (struct ud_sockopt_s){
 				UD_SUB,
-				.port = (uint16_t)argi->beef_arg[i],
-				})) == NULL) {
+				.mode_opt = UD_MOPT_TSTAMP,
+			}, ports, argi->beef_given);
+
+		for (unsigned int i = 0, j = 0; i < argi->beef_given; i++) {
+			if (s[i] == NULL) {
+				continue;
+			}
+			beef[++j].data = s[i];
+			ev_io_init(beef + j, mon_beef_cb, s[i]->fd, EV_READ);
+			log_rgstr(s[i]);
+			nbeef = j;
+		}
+	}
+
+	/* drain them all in one loop, or one watcher each if we can't */
+	if ((mon_poll = ud_poller_open(0U)) != NULL) {
+		ud_poller_on_any(mon_poll, mon_poll_msg, NULL);
+		poll_w->data = mon_poll;
+		ev_io_init(poll_w, mon_poll_cb, ud_poller_fd(mon_poll), EV_READ);
+		ev_io_start(EV_A_ poll_w);
+	}
+	for (unsigned int i = 0; i <= nbeef; i++) {
+		ud_sock_t s = beef[i].data;
+
+		if (s == NULL) {
 			continue;
+		} else if (mon_poll == NULL || ud_poller_add(mon_poll, s) < 0) {
+			ev_io_start(EV_A_ beef + i);
 		}
-		beef[++j].data = s;
-		ev_io_init(beef + j, mon_beef_cb, s->fd, EV_READ);
-		ev_io_start(EV_A_ beef + j);
-		log_rgstr(s);
-		nbeef = j;
+	}
+
+	/* capture off a ring rather than reading the sockets */
+	if (argi->tpacket_given &&
+	    (tpkt = ud_tpkt_open(argi->tpacket_arg)) == NULL) {
+		logger(LOG_ERR, "cannot capture on %s, reading sockets instead",
+		       argi->tpacket_arg);
+	} else if (tpkt != NULL) {
+		for (unsigned int i = 0; i <= nbeef; i++) {
+			ud_sock_t s = beef[i].data;
+
+			if (s != NULL) {
+				/* sockets just keep the groups joined now */
+				ev_io_stop(EV_A_ beef + i);
+				if (mon_poll != NULL) {
+					(void)ud_poller_del(mon_poll, s);
+				}
+				(void)ud_tap(s);
+			}
+		}
+		tap->beef = beef;
+		tap->nbeef = nbeef;
+		tpkt_w->data = tpkt;
+		ev_io_init(tpkt_w, mon_tpkt_cb, ud_tpkt_fd(tpkt), EV_READ);
+		ev_io_start(EV_A_ tpkt_w);
 	}
 
 	/* load some default services here, this might vanish at any time */
@@ -551,14 +675,26 @@ main(int argc, char *argv[])
 
 	logger(LOG_NOTICE, "shutting down unsermon");
 
+	if (tpkt != NULL) {
+		ev_io_stop(EV_A_ tpkt_w);
+		ud_tpkt_close(tpkt);
+	}
+
 	/* detaching beef channels */
 	for (unsigned int i = 0; i <= nbeef; i++) {
 		ud_sock_t s = beef[i].data;
 
 		log_dergstr(s);
 		ev_io_stop(EV_A_ beef + i);
+		if (mon_poll != NULL) {
+			(void)ud_poller_del(mon_poll, s);
+		}
 		ud_close(s);
 	}
+	if (mon_poll != NULL) {
+		ev_io_stop(EV_A_ poll_w);
+		ud_poller_close(mon_poll);
+	}
 	/* free beef resources */
 	free(beef);
 
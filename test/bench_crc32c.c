@@ -0,0 +1,168 @@
+/*** bench_crc32c.c -- what packet checksums cost */
+#include <unserding.h>
+#include <ud-crc32c.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+
+/* best of this many runs */
+#define NRUNS			(5U)
+#define NPKT			(100000U)
+#define PORT			(8832U)
+/* publishing runs with checksums and without, interleaved, the
+ * kernel's noise is way larger than what we're after, so lots of
+ * short ones and the median of their ratios */
+#define NPAIR			(401U)
+#define NPAIR_PKT		(2000U)
+
+/* fits packets on the minimum mtu, checksum and all */
+static uint8_t buf[1024U];
+
+static double
+now(void)
+{
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsp);
+	return (double)tsp.tv_sec + (double)tsp.tv_nsec * 1e-9;
+}
+
+static double
+cpu_now(void)
+{
+/* time spent by us, kernel included, but not waiting for it */
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tsp);
+	return (double)tsp.tv_sec + (double)tsp.tv_nsec * 1e-9;
+}
+
+static int
+cmp_dbl(const void *a, const void *b)
+{
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static double
+bench_raw(uint32_t(*f)(const void*, size_t))
+{
+/* return GB/s of F over packet sized buffers */
+	volatile uint32_t sink = 0U;
+	double best = 0.;
+
+	for (size_t r = 0; r < NRUNS; r++) {
+		double t0 = now();
+		double gbs;
+
+		for (size_t i = 0; i < NPKT; i++) {
+			sink += f(buf, sizeof(buf));
+		}
+		gbs = (double)NPKT * sizeof(buf) / (now() - t0) / 1e9;
+		best = gbs > best ? gbs : best;
+	}
+	(void)sink;
+	return best;
+}
+
+static double
+bench_pub(ud_sock_t s)
+{
+/* return cpu seconds per packet published on S */
+	double t0 = cpu_now();
+
+	for (size_t i = 0; i < NPAIR_PKT; i++) {
+		/* a message a packet, the worst case */
+		while (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0x0101U,
+				.data = buf,
+				.dlen = sizeof(buf),
+			}) < 0) {
+			/* kernel's choking, wait for it */
+			struct pollfd fds[1] = {{s->fd, POLLOUT, 0}};
+
+			if (poll(fds, 1U, 1000) <= 0) {
+				perror("couldn't pack message");
+				return -1.;
+			}
+		}
+		if (i % 64U == 63U) {
+			(void)ud_flush(s);
+		}
+	}
+	(void)ud_flush(s);
+	return (cpu_now() - t0) / (double)NPAIR_PKT;
+}
+
+static ud_sock_t
+pub(unsigned int mopt)
+{
+	ud_sock_t s;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = mopt,
+			.port = PORT,
+			.nsend = 64U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+	}
+	return s;
+}
+
+int
+main(void)
+{
+	static double r[NPAIR];
+	static double t[NPAIR];
+	ud_sock_t s[2U];
+	double hw, sw, loss;
+	int res = 0;
+
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)(i * 7U);
+	}
+
+	hw = bench_raw(ud_crc32c);
+	sw = bench_raw(ud_crc32c_sw);
+	printf("crc32c  %.2f GB/s, in software %.2f GB/s\n", hw, sw);
+
+	if ((s[0U] = pub(UD_MOPT_PROTO2)) == NULL) {
+		return 1;
+	} else if ((s[1U] = pub(UD_MOPT_PROTO2 | UD_MOPT_CRC)) == NULL) {
+		ud_close(s[0U]);
+		return 1;
+	}
+	for (size_t i = 0; i < NPAIR; i++) {
+		/* take turns going first, drifts cancel out */
+		const size_t k = i % 2U;
+		double x[2U];
+
+		if ((x[k] = bench_pub(s[k])) <= 0. ||
+		    (x[!k] = bench_pub(s[!k])) <= 0.) {
+			res = 1;
+			goto out;
+		}
+		t[i] = x[0U];
+		r[i] = x[1U] / x[0U];
+	}
+	qsort(t, NPAIR, sizeof(*t), cmp_dbl);
+	qsort(r, NPAIR, sizeof(*r), cmp_dbl);
+	loss = 100. * (r[NPAIR / 2U] - 1.);
+	printf("publishing  %.0f ns/pkt of cpu time\n", t[NPAIR / 2U] * 1e9);
+	printf("checksums cost %.2f%% of that, quartiles %.2f%% to %.2f%%\n",
+	       loss, 100. * (r[NPAIR / 4U] - 1.),
+	       100. * (r[3U * NPAIR / 4U] - 1.));
+	res = loss < 1. ? 0 : 1;
+out:
+	ud_close(s[1U]);
+	ud_close(s[0U]);
+	return res;
+}
+
+/* bench_crc32c.c ends here */
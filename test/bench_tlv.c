@@ -0,0 +1,159 @@
+/*** bench_tlv.c -- indexing tlvs, vectorised and tlv by tlv */
+#include <unserding.h>
+#include <ud-private.h>
+#include <ud-tlv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* best of this many runs */
+#define NRUNS			(5U)
+#define NPKT			(200000U)
+
+/* ethernet and jumbo payloads */
+static const size_t pktz[] = {1400U, 8900U};
+/* message sizes, v2 tlvs have 4 octets on top */
+static const size_t msgz[] = {4U, 16U, 64U, 1000U};
+
+/* v2 header, protocol initial, pno, service, magic, then the payload */
+static uint8_t wire[8U + 9000U] = {
+	0x55U, 0x44U, 0U, 0U, 0xffU, 0xffU, 0xd2U, 0x00U,
+};
+static uint8_t *const pkt = wire + 8U;
+static uint16_t off[9000U / 4U];
+/* the library's own loop, fed by hand */
+static ud_sock_t tap;
+static uint16_t pno;
+
+static double
+now(void)
+{
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsp);
+	return (double)tsp.tv_sec + (double)tsp.tv_nsec * 1e-9;
+}
+
+static size_t
+fill(size_t z, size_t mz)
+{
+/* pack Z octets with v2 messages of size MZ, return their number */
+	size_t n = 0U;
+	size_t i = 0U;
+
+	for (; i + 4U + mz <= z; i += 4U + mz, n++) {
+		pkt[i + 0U] = (uint8_t)(0x0dU/*SDATA*/ | ((mz >> 8U) << 4U));
+		pkt[i + 1U] = (uint8_t)(mz & 0xffU);
+		/* an ordinary service, control ones have side effects */
+		pkt[i + 2U] = 0x01U;
+		pkt[i + 3U] = 0x01U;
+		memset(pkt + i + 4U, (int)n, mz);
+	}
+	/* like the receive path, nothing past the last message */
+	return n;
+}
+
+static double
+bench(size_t(*f)(uint16_t*, size_t, const void*, size_t), size_t z, size_t n)
+{
+/* return ns per tlv */
+	double best = 1e9;
+
+	for (size_t r = 0; r < NRUNS; r++) {
+		double t0 = now();
+		double ns;
+		size_t tot = 0U;
+
+		for (size_t i = 0; i < NPKT; i++) {
+			/* pretend it's a new packet each time */
+			__asm__ volatile("" : : "r"(pkt) : "memory");
+			tot += f(off, countof(off), pkt, z);
+		}
+		if (tot != NPKT * n) {
+			fprintf(stderr, "indexer b0rked: %zu\n", tot / NPKT);
+			return -1.;
+		}
+		ns = (now() - t0) * 1e9 / (double)tot;
+		best = ns < best ? ns : best;
+	}
+	return best;
+}
+
+static double
+bench_lib(size_t z, size_t n)
+{
+/* return ns per message through ud_chck_msg(), packet intake included */
+	const struct sockaddr_in6 src = {
+		.sin6_family = AF_INET6,
+		.sin6_port = htons(4242U),
+		.sin6_addr = {{{0xfdU, [15U] = 0x01U}}},
+	};
+	double best = 1e9;
+
+	for (size_t r = 0; r < NRUNS; r++) {
+		struct ud_msg_s msg[1];
+		double t0 = now();
+		double ns;
+		size_t tot = 0U;
+
+		for (size_t i = 0; i < NPKT; i++, pno++) {
+			/* pnos keep counting, or it'd look like a restart */
+			wire[2U] = (uint8_t)(pno >> 8U);
+			wire[3U] = (uint8_t)(pno & 0xffU);
+			(void)ud_inject(tap, wire, 8U + z, (const void*)&src, NULL);
+			while (ud_chck_msg(msg, tap) >= 0) {
+				tot++;
+			}
+		}
+		if (tot != NPKT * n) {
+			fprintf(stderr, "decoder b0rked: %zu\n", tot / NPKT);
+			return -1.;
+		}
+		ns = (now() - t0) * 1e9 / (double)tot;
+		best = ns < best ? ns : best;
+	}
+	return best;
+}
+
+int
+main(void)
+{
+	int res = 0;
+
+	if ((tap = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		return 1;
+	} else if (ud_tap(tap) < 0) {
+		perror("cannot tap subscriber");
+		ud_close(tap);
+		return 1;
+	}
+
+	printf("payload  msgz   ntlv  "
+	       "ud_chck_msg ns/msg   walk ns/tlv   vector ns/tlv\n");
+	for (size_t i = 0; i < countof(pktz) && !res; i++) {
+		for (size_t j = 0; j < countof(msgz); j++) {
+			size_t z = pktz[i] / (4U + msgz[j]) * (4U + msgz[j]);
+			size_t n = fill(z, msgz[j]);
+			double lib = bench_lib(z, n);
+			double sw = bench(ud_tlv_index_sw, z, n);
+			double vx = bench(ud_tlv_index, z, n);
+
+			if (lib < 0. || sw < 0. || vx < 0.) {
+				res = 1;
+				break;
+			}
+			printf("%7zu %5zu %6zu %20.2f %13.2f %15.2f\n",
+			       z, msgz[j], n, lib, sw, vx);
+		}
+	}
+	ud_close(tap);
+	return res;
+}
+
+/* bench_tlv.c ends here */
@@ -0,0 +1,115 @@
+/*** test_pubsub_16.c -- testing large messages */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static char secret[10000U];
+
+static int
+poll_send(ud_sock_t s)
+{
+	struct pollfd fds[1];
+	int rc;
+	int timeout = 2000;
+
+	fds->fd = s->fd;
+	fds->events = POLLOUT;
+
+	if ((rc = poll(fds, countof(fds), timeout)) <= 0) {
+		perror("socket not ready for sending");
+		return -1;
+	} else if (!(fds->revents & POLLOUT)) {
+		perror("socket not ready for sending, despite poll");
+		return -1;
+	} else if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) >= 0) {
+		perror("packed a message that doesn't fit");
+		return -1;
+	} else if (ud_pack_lmsg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		return -1;
+	}
+	return ud_flush(s);
+}
+
+static int
+poll_recv(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	int timeout = 2000;
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	/* fragments trickle in, keep going until we've got the lot */
+	for (int rc; (rc = poll(fds, countof(fds), timeout)) > 0;) {
+		if (!(fds->revents & POLLIN)) {
+			perror("socket not ready for recving, despite poll");
+			return -1;
+		} else if (ud_chck_msg(msg, s) < 0) {
+			/* not yet */
+			continue;
+		} else if (msg->svc != 0xffff) {
+			perror("not the test message we sent");
+			return -1;
+		} else if (msg->dlen != sizeof(secret)) {
+			perror("data lengths do not coincide");
+			return -1;
+		} else if (memcmp(msg->data, secret, sizeof(secret))) {
+			perror("data contents do not coincide");
+			return -1;
+		}
+		return 0;
+	}
+	perror("socket timed out");
+	return -1;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.nrecv = 4U,
+		})) == NULL) {
+		perror("cannot initialise ud socket");
+		return 1;
+	}
+
+	assert(s->fd > 0);
+
+	for (size_t i = 0; i < sizeof(secret); i++) {
+		secret[i] = (char)(i * 7U);
+	}
+
+	if (poll_send(s) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	if (poll_recv(s) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_16.c ends here */
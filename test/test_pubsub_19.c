@@ -0,0 +1,141 @@
+/*** test_pubsub_19.c -- testing retransmissions of lost packets */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* more than a starved receive buffer can take */
+#define NBURST			(32U)
+
+static char secret[1024U];
+
+static int
+send_one(ud_sock_t s)
+{
+	if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		return -1;
+	} else if (ud_flush(s) < 0) {
+		perror("couldn't flush secret message");
+		return -1;
+	}
+	return 0;
+}
+
+static size_t
+drain(ud_sock_t s, int timeout)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	size_t res = 0U;
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	while (poll(fds, countof(fds), timeout) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			res += msg->svc == 0xffff;
+		}
+	}
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_stats_s st[1];
+	int rcvz;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.mode_opt = UD_MOPT_RELIABLE,
+			.nhist = 2U * NBURST,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.mode_opt = UD_MOPT_RELIABLE,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	}
+
+	assert(p->fd > 0);
+	assert(s->fd > 0);
+
+	/* starve the subscriber so it loses packets */
+	rcvz = 1;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+
+	for (size_t i = 0; i < NBURST; i++) {
+		if (send_one(p) < 0) {
+			res = 1;
+			goto fuck;
+		}
+	}
+	(void)drain(s, 100);
+	(void)drain(p, 100);
+
+	/* feed it properly again */
+	rcvz = 1024 * 1024;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+
+	/* the next packet uncovers the gap ... */
+	if (send_one(p) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	(void)drain(s, 100);
+	/* ... and once the back-off is over the one after triggers the NAK */
+	nanosleep(&(struct timespec){0, 20000000L}, NULL);
+	if (send_one(p) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	(void)drain(s, 100);
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+		goto fuck;
+	} else if (st->ngap == 0U) {
+		fputs("no packets lost, test inconclusive\n", stderr);
+		goto fuck;
+	}
+
+	/* the publisher answers the NAK as it reads */
+	(void)drain(p, 100);
+	/* and the subscriber should have the lot now */
+	(void)drain(s, 100);
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+		goto fuck;
+	} else if (st->ngap > 0U) {
+		fprintf(stderr, "%zu packets still missing\n", st->ngap);
+		res = 1;
+		goto fuck;
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_19.c ends here */
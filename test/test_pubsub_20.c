@@ -0,0 +1,292 @@
+/*** test_pubsub_20.c -- testing recovery of lost packets from parity */
+#include <unserding.h>
+#include <ud-private.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* packets per parity packet */
+#define NFEC			(4U)
+
+/* a message fills a packet */
+static char secret[1300U];
+static unsigned int got;
+
+static int
+send_one(ud_sock_t s, unsigned int i)
+{
+/* with a send queue of 1 that sends the packet before */
+	secret[0U] = (char)i;
+	if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+take(const struct ud_msg_s *msg)
+{
+	const char *d = msg->data;
+
+	if (msg->svc != 0xffff || msg->dlen != sizeof(secret)) {
+		return;
+	} else if (memcmp(d + 1U, secret + 1U, msg->dlen - 1U)) {
+		return;
+	}
+	got |= 1U << d[0U];
+	return;
+}
+
+static void
+drain(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	while (poll(fds, countof(fds), 100) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			take(msg);
+		}
+	}
+	return;
+}
+
+static ssize_t
+capture(ud_sock_t c, void *buf, size_t bsz, struct sockaddr_in6 *from)
+{
+/* next packet captured on C sent by FROM, or by anyone if FROM's unset */
+	struct pollfd fds[1] = {{c->fd, POLLIN, 0}};
+
+	while (poll(fds, countof(fds), 1000) > 0) {
+		struct sockaddr_in6 src;
+		socklen_t srcz = sizeof(src);
+		ssize_t nrd;
+
+		if ((nrd = recvfrom(c->fd, buf, bsz, 0,
+				    (struct sockaddr*)&src, &srcz)) <= 0) {
+			break;
+		} else if (!from->sin6_port) {
+			*from = src;
+			return nrd;
+		} else if (src.sin6_port == from->sin6_port) {
+			return nrd;
+		}
+	}
+	return -1;
+}
+
+static int
+twins(void)
+{
+/* packets that arrive twice mustn't spoil the parity of their block */
+	/* two blocks and their parities */
+	static char pkt[2U * (NFEC + 1U)][1500U];
+	size_t pktz[2U * (NFEC + 1U)];
+	struct sockaddr_in6 from = {.sin6_family = AF_INET6};
+	struct ud_msg_s msg[1];
+	ud_sock_t p;
+	ud_sock_t c;
+	ud_sock_t t;
+	int res = -1;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.nfec = NFEC,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if ((c = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise capture socket");
+		ud_close(p);
+		return -1;
+	} else if ((t = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nfec = NFEC,
+		})) == NULL || ud_tap(t) < 0) {
+		perror("cannot initialise tapped subscriber");
+		ud_close(c);
+		ud_close(p);
+		return -1;
+	}
+
+	for (unsigned int i = 0U; i < 2U * NFEC; i++) {
+		if (send_one(p, i) < 0) {
+			goto out;
+		} else if (i % NFEC == NFEC - 1U && ud_flush(p) < 0) {
+			perror("couldn't flush secret messages");
+			goto out;
+		}
+	}
+	/* the first tells who the publisher is */
+	for (size_t i = 0U; i < countof(pkt); i++) {
+		ssize_t nrd;
+
+		if ((nrd = capture(c, pkt[i], sizeof(pkt[i]), &from)) < 0) {
+			fprintf(stderr, "packet %zu not captured\n", i);
+			goto out;
+		}
+		pktz[i] = nrd;
+	}
+
+	/* the first block in full, its parity has us accumulate, then
+	 * 0, 1, 1 again, 3 and the parity of the second, 2 must be rebuilt */
+	{
+		static const unsigned int ord[] = {
+			0U, 1U, 2U, 3U, NFEC,
+			NFEC + 1U + 0U, NFEC + 1U + 1U, NFEC + 1U + 1U,
+			NFEC + 1U + 3U, 2U * NFEC + 1U,
+		};
+
+		got = 0U;
+		for (size_t i = 0U; i < countof(ord); i++) {
+			static char buf[1500U];
+
+			/* the twin's refused, what's decoded tells */
+			memcpy(buf, pkt[ord[i]], pktz[ord[i]]);
+			(void)ud_inject(t, buf, pktz[ord[i]], (void*)&from, NULL);
+			while (ud_chck_msg(msg, t) >= 0) {
+				take(msg);
+			}
+		}
+	}
+	if (got != (1U << 2U * NFEC) - 1U) {
+		fprintf(stderr, "twins spoilt parity, got %x\n", got);
+		goto out;
+	}
+	res = 0;
+out:
+	ud_close(t);
+	ud_close(c);
+	ud_close(p);
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_stats_s st[1];
+	const struct sockaddr *dst;
+	int rcvz;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.nfec = NFEC,
+			.nsend = 1U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nfec = NFEC,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	} else if ((dst = ud_socket_addr(s)) == NULL) {
+		fputs("subscriber has no address\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	assert(p->fd > 0);
+	assert(s->fd > 0);
+
+	for (size_t i = 0; i < sizeof(secret); i++) {
+		secret[i] = (char)(i * 11U);
+	}
+
+	/* first block, so the subscriber knows about parity */
+	for (unsigned int i = 0U; i < NFEC; i++) {
+		if (send_one(p, i) < 0) {
+			res = 1;
+			goto fuck;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush secret messages");
+		res = 1;
+		goto fuck;
+	}
+	drain(s);
+
+	/* second block, starve the subscriber so it gets the first packet
+	 * but not the second */
+	rcvz = 1;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+	for (unsigned int i = 0U; i < 3U; i++) {
+		if (send_one(p, NFEC + i) < 0) {
+			res = 1;
+			goto fuck;
+		}
+	}
+	drain(s);
+	rcvz = 1024 * 1024;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+	if (send_one(p, NFEC + 3U) < 0) {
+		res = 1;
+		goto fuck;
+	} else if (ud_flush(p) < 0) {
+		perror("couldn't flush secret messages");
+		res = 1;
+		goto fuck;
+	}
+	drain(s);
+
+	/* half a block, the first packet's lost behind some junk, the
+	 * flush must not keep the parity back */
+	rcvz = 1;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+	(void)sendto(s->fd, "JUNK", 4U, 0, dst, sizeof(struct sockaddr_in6));
+	if (send_one(p, 2U * NFEC + 0U) < 0 ||
+	    send_one(p, 2U * NFEC + 1U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	drain(s);
+	rcvz = 1024 * 1024;
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &rcvz, sizeof(rcvz));
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush secret messages");
+		res = 1;
+		goto fuck;
+	}
+	drain(s);
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (st->ngap > 0U) {
+		fprintf(stderr, "%zu packets still missing\n", st->ngap);
+		res = 1;
+	} else if (got != (1U << (2U * NFEC + 2U)) - 1U) {
+		fprintf(stderr, "messages missing %x\n", got);
+		res = 1;
+	}
+
+	if (twins() < 0) {
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_20.c ends here */
@@ -0,0 +1,112 @@
+/*** test_pubsub_21.c -- testing flush deadlines */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static int
+pack_one(ud_sock_t s)
+{
+	if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+poll_recv(ud_sock_t s, int timeout)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	if (poll(fds, countof(fds), timeout) <= 0) {
+		return -1;
+	} else if (ud_chck_msg(msg, s) < 0) {
+		return -1;
+	} else if (msg->svc != 0xffff) {
+		return -1;
+	} else if (msg->dlen != sizeof(secret)) {
+		return -1;
+	} else if (memcmp(msg->data, secret, sizeof(secret))) {
+		return -1;
+	}
+	return 0;
+}
+
+static int
+poll_due(ud_sock_t s)
+{
+	struct pollfd fds[1];
+
+	fds->fd = s->tfd;
+	fds->events = POLLIN;
+
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		perror("deadline never came");
+		return -1;
+	} else if (ud_flush(s) < 0) {
+		perror("couldn't flush secret message");
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.max_delay = 20000U,
+		})) == NULL) {
+		perror("cannot initialise ud socket");
+		return 1;
+	}
+
+	assert(s->fd > 0);
+	assert(s->tfd > 0);
+
+	if (pack_one(s) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* nothing must go out before the deadline */
+	if (poll_recv(s, 0) == 0) {
+		fputs("message went out before the deadline\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	if (poll_due(s) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	if (poll_recv(s, 2000) < 0) {
+		fputs("message didn't go out on the deadline\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_21.c ends here */
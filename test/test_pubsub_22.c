@@ -0,0 +1,170 @@
+/*** test_pubsub_22.c -- testing sockets in concurrent threads */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NTHREADS		(8U)
+#define NROUNDS			(200U)
+
+/* services we use, pings make every socket reply with a pong */
+#define SVC_TEST		(0xffffU)
+#define SVC_PING		(0xff04U)
+#define SVC_PONG		(0xff05U)
+
+static char hname[_POSIX_HOST_NAME_MAX];
+static size_t hnamez;
+
+struct thr_s {
+	unsigned int id;
+	pthread_t thr;
+	/* number of messages seen, number of broken ones */
+	size_t nmsg;
+	size_t nbad;
+	int res;
+};
+
+static int
+chck_msg(const struct ud_msg_s *msg)
+{
+/* check MSG for consistency, return -1 if b0rked */
+	const uint8_t *d = msg->data;
+
+	switch (msg->svc) {
+	case SVC_TEST: {
+		/* thread id, round, then the round repeated */
+		if (msg->dlen != 64U) {
+			return -1;
+		}
+		for (size_t i = 2U; i < msg->dlen; i++) {
+			if (d[i] != d[1U]) {
+				return -1;
+			}
+		}
+		break;
+	}
+	case SVC_PONG:
+		/* 4 bytes pid, 1 byte length, hostname */
+		if (msg->dlen < 5U || msg->dlen != 5U + d[4U]) {
+			return -1;
+		} else if (d[4U] != hnamez || memcmp(d + 5U, hname, hnamez)) {
+			return -1;
+		} else if ((uint32_t)(d[0U] << 24U | d[1U] << 16U |
+				      d[2U] << 8U | d[3U]) != (uint32_t)getpid()) {
+			return -1;
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void
+drain(struct thr_s *t, ud_sock_t s, int timeout)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	while (poll(fds, countof(fds), timeout) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			t->nmsg++;
+			t->nbad += chck_msg(msg) < 0;
+		}
+	}
+	return;
+}
+
+static void*
+thr_main(void *clo)
+{
+	struct thr_s *t = clo;
+	ud_sock_t s;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.nrecv = 16U,
+			.nsend = 4U,
+		})) == NULL) {
+		t->res = -1;
+		return NULL;
+	}
+
+	for (unsigned int i = 0U; i < NROUNDS; i++) {
+		uint8_t buf[64U];
+
+		memset(buf, (uint8_t)i, sizeof(buf));
+		buf[0U] = (uint8_t)t->id;
+		if (ud_pack_msg(s, (struct ud_msg_s){
+					.svc = SVC_TEST,
+					.data = buf,
+					.dlen = sizeof(buf),
+				}) < 0) {
+			;
+		} else if (ud_pack_msg(s, (struct ud_msg_s){
+					.svc = SVC_PING,
+					.data = buf,
+					.dlen = 1U,
+				}) < 0) {
+			;
+		}
+		(void)ud_flush(s);
+		/* this answers pings with pongs, concurrently */
+		drain(t, s, 0);
+	}
+	drain(t, s, 100);
+
+	t->res = ud_close(s);
+	return NULL;
+}
+
+int
+main(void)
+{
+	struct thr_s t[NTHREADS];
+	int res = 0;
+
+	if (gethostname(hname, sizeof(hname)) < 0) {
+		perror("cannot obtain hostname");
+		return 1;
+	}
+	hname[sizeof(hname) - 1U] = '\0';
+	hnamez = strlen(hname);
+
+	for (unsigned int i = 0U; i < NTHREADS; i++) {
+		t[i] = (struct thr_s){.id = i};
+		if (pthread_create(&t[i].thr, NULL, thr_main, t + i)) {
+			perror("cannot create thread");
+			return 1;
+		}
+	}
+	for (unsigned int i = 0U; i < NTHREADS; i++) {
+		pthread_join(t[i].thr, NULL);
+	}
+
+	for (unsigned int i = 0U; i < NTHREADS; i++) {
+		if (t[i].res < 0) {
+			fprintf(stderr, "thread %u failed\n", i);
+			res = 1;
+		} else if (t[i].nmsg == 0U) {
+			fprintf(stderr, "thread %u received nothing\n", i);
+			res = 1;
+		} else if (t[i].nbad > 0U) {
+			fprintf(stderr, "thread %u received %zu broken messages\n",
+				i, t[i].nbad);
+			res = 1;
+		}
+	}
+	return res;
+}
+
+/* test_pubsub_22.c ends here */
@@ -0,0 +1,92 @@
+/*** test_pubsub_23.c -- testing kernel time stamps */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+int
+main(void)
+{
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct ud_auxmsg_s aux[1];
+	struct pollfd fds[1];
+	struct timespec now;
+	int rc;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.mode_opt = UD_MOPT_TSTAMP,
+		})) == NULL) {
+		perror("cannot initialise ud socket");
+		return 1;
+	}
+
+	assert(s->fd > 0);
+
+	if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		res = 1;
+		goto fuck;
+	} else if (ud_flush(s) < 0) {
+		perror("couldn't flush secret message");
+		res = 1;
+		goto fuck;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		fputs("message never arrived\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (ud_chck_msg(msg, s) < 0) {
+		fputs("couldn't receive message\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (ud_get_aux(aux, s) < 0) {
+		fputs("couldn't obtain aux data\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (!aux->ts.tv_sec && !aux->ts.tv_nsec) {
+		fputs("no receive time stamp\n", stderr);
+		res = 1;
+	} else if (aux->ts.tv_sec > now.tv_sec) {
+		fputs("receive time stamp from the future\n", stderr);
+		res = 1;
+	}
+
+	/* the send stamp is queued along with the packet, give it a bit */
+	for (size_t i = 0; i < 10U && (rc = ud_get_txaux(aux, s)) < 0; i++) {
+		nanosleep(&(struct timespec){0, 10000000L}, NULL);
+	}
+	if (rc < 0) {
+#if defined __linux__
+		fputs("no send time stamp\n", stderr);
+		res = 1;
+#endif	/* __linux__ */
+	} else if (!aux->ts.tv_sec && !aux->ts.tv_nsec) {
+		fputs("empty send time stamp\n", stderr);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_23.c ends here */
@@ -0,0 +1,115 @@
+/*** test_pubsub_24.c -- testing in-kernel service filters */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static const char secret[] = "JUST A PLAIN STRING";
+/* services we send, one per bit in the result of drain() */
+static const ud_svc_t svcs[] = {0x0101U, 0x0102U, 0x0305U};
+
+static int
+send_all(ud_sock_t s)
+{
+	for (size_t i = 0U; i < countof(svcs); i++) {
+		if (ud_pack_msg(s, (struct ud_msg_s){
+					.svc = svcs[i],
+					.data = secret,
+					.dlen = sizeof(secret),
+				}) < 0) {
+			perror("couldn't pack secret message");
+			return -1;
+		} else if (ud_flush(s) < 0) {
+			perror("couldn't flush secret message");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static unsigned int
+drain(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	unsigned int res = 0U;
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	while (poll(fds, countof(fds), 100) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			for (size_t i = 0U; i < countof(svcs); i++) {
+				res |= (msg->svc == svcs[i]) << i;
+			}
+		}
+	}
+	return res;
+}
+
+static int
+check(ud_sock_t s, unsigned int exp)
+{
+	unsigned int got;
+
+	if (send_all(s) < 0) {
+		return -1;
+	} else if ((got = drain(s)) != exp) {
+		fprintf(stderr, "expected services %x, got %x\n", exp, got);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){UD_PUBSUB})) == NULL) {
+		perror("cannot initialise ud socket");
+		return 1;
+	}
+
+	assert(s->fd > 0);
+
+	/* one service and one whole channel */
+	if (ud_set_filter(s, svcs, 1U, (const uint8_t[]){0x03U}, 1U) < 0) {
+		perror("cannot set filter");
+		res = 1;
+		goto fuck;
+	} else if (check(s, 1U | 4U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* swap it for another one */
+	if (ud_set_filter(s, svcs + 1U, 1U, NULL, 0U) < 0) {
+		perror("cannot replace filter");
+		res = 1;
+		goto fuck;
+	} else if (check(s, 2U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* and away with it */
+	if (ud_set_filter(s, NULL, 0U, NULL, 0U) < 0) {
+		perror("cannot remove filter");
+		res = 1;
+		goto fuck;
+	} else if (check(s, 7U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_24.c ends here */
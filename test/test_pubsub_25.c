@@ -0,0 +1,189 @@
+/*** test_pubsub_25.c -- testing channels on multicast groups of their own */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NGROUP			(4U)
+
+static const char secret[] = "JUST A PLAIN STRING";
+/* services we send, one per bit in the result of drain(),
+ * channels 1 and 5 share a group, channel 2 has one of its own */
+static const ud_svc_t svcs[] = {0x0101U, 0x0202U, 0x0505U};
+
+static int
+send_all(ud_sock_t s)
+{
+	for (size_t i = 0U; i < countof(svcs); i++) {
+		if (ud_pack_msg(s, (struct ud_msg_s){
+					.svc = svcs[i],
+					.data = secret,
+					.dlen = sizeof(secret),
+				}) < 0) {
+			perror("couldn't pack secret message");
+			return -1;
+		}
+	}
+	if (ud_flush(s) < 0) {
+		perror("couldn't flush secret messages");
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned int
+drain(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	unsigned int res = 0U;
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+
+	while (poll(fds, countof(fds), 100) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			for (size_t i = 0U; i < countof(svcs); i++) {
+				res |= (msg->svc == svcs[i]) << i;
+			}
+		}
+	}
+	return res;
+}
+
+static int
+check(ud_sock_t p, ud_sock_t s, unsigned int exp)
+{
+	unsigned int got;
+
+	if (send_all(p) < 0) {
+		return -1;
+	} else if ((got = drain(s)) != exp) {
+		fprintf(stderr, "expected services %x, got %x\n", exp, got);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+ranges(void)
+{
+/* group ranges that must be turned down, and one that mustn't */
+	static const char *const bad[] = {
+		/* typo */
+		"ff15::134:g",
+		/* no multicast */
+		"fd00::134:0",
+		/* runs out of addresses */
+		"ff15:ffff:ffff:ffff:ffff:ffff:ffff:fffe",
+	};
+	ud_sock_t s;
+	int res = 0;
+
+	for (size_t i = 0U; i < countof(bad); i++) {
+		errno = 0;
+		if ((s = ud_socket((struct ud_sockopt_s){
+				UD_SUB,
+				.ngroup = NGROUP,
+				.group_addr = bad[i],
+			})) != NULL) {
+			fprintf(stderr, "group range %s taken\n", bad[i]);
+			ud_close(s);
+			res = -1;
+		} else if (errno != EINVAL) {
+			fprintf(stderr, "group range %s: %s\n",
+				bad[i], strerror(errno));
+			res = -1;
+		}
+	}
+	/* carries over into the next octets */
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.ngroup = NGROUP,
+			.group_addr = "ff15::1:ffff",
+		})) == NULL) {
+		perror("group range ff15::1:ffff not taken");
+		res = -1;
+	} else {
+		ud_close(s);
+	}
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	int res = 0;
+
+	if (ranges() < 0) {
+		return 1;
+	}
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 4U,
+			.ngroup = NGROUP,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 4U,
+			.ngroup = NGROUP,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	}
+
+	assert(p->fd > 0);
+	assert(s->fd > 0);
+
+	/* nothing joined, nothing heard */
+	if (check(p, s, 0U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* channel 1 brings channel 5 along */
+	if (ud_join_chn(s, 0x01U) < 0) {
+		perror("cannot join channel");
+		res = 1;
+		goto fuck;
+	} else if (check(p, s, 1U | 4U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	if (ud_join_chn(s, 0x02U) < 0) {
+		perror("cannot join channel");
+		res = 1;
+		goto fuck;
+	} else if (check(p, s, 7U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* channel 5 was never joined, channel 1 takes the group with it */
+	if (ud_leave_chn(s, 0x05U) < 0 || ud_leave_chn(s, 0x01U) < 0) {
+		perror("cannot leave channel");
+		res = 1;
+		goto fuck;
+	} else if (check(p, s, 2U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_25.c ends here */
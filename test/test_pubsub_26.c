@@ -0,0 +1,199 @@
+/*** test_pubsub_26.c -- testing the node-local transport */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NMSG			(1000U)
+
+static const char secret[] = "JUST A PLAIN STRING";
+static short unsigned int port;
+
+static int
+send_some(ud_sock_t s, unsigned int n)
+{
+	for (unsigned int i = 0U; i < n; i++) {
+		if (ud_pack_msg(s, (struct ud_msg_s){
+					.svc = 0xffff/*TEST SERVICE*/,
+					.data = secret,
+					.dlen = sizeof(secret),
+				}) < 0) {
+			perror("couldn't pack secret message");
+			return -1;
+		}
+	}
+	if (ud_flush(s) < 0) {
+		perror("couldn't flush secret messages");
+		return -1;
+	}
+	return 0;
+}
+
+static size_t
+drain(ud_sock_t s, int timeout)
+{
+	struct ud_msg_s msg[1];
+	size_t res = 0U;
+
+	while (ud_wait(s, timeout) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			res += msg->svc == 0xffff &&
+				msg->dlen == sizeof(secret) &&
+				!memcmp(msg->data, secret, sizeof(secret));
+		}
+	}
+	return res;
+}
+
+static int
+child(void)
+{
+	ud_sock_t p;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_SHM,
+			.port = port,
+		})) == NULL) {
+		return 1;
+	}
+	/* let the parent go to sleep first */
+	nanosleep(&(struct timespec){0, 50000000L}, NULL);
+	if (send_some(p, 1U) < 0) {
+		res = 1;
+	}
+	res -= ud_close(p);
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_stats_s st[1];
+	char nm[64U];
+	size_t n;
+	pid_t c;
+	int res = 0;
+
+	/* a port of our own so we don't see anyone else's packets */
+	port = (short unsigned int)(20000U + getpid() % 20000U);
+	snprintf(nm, sizeof(nm), "/dev/shm/unserding.%hu", port);
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_SHM,
+			.port = port,
+			.nsend = 8U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.mode_opt = UD_MOPT_SHM,
+			.port = port,
+			.nrecv = 16U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	}
+
+	assert(p->fd < 0);
+	assert(s->fd < 0);
+
+	{
+		struct stat st_r;
+
+		if (stat(nm, &st_r) < 0) {
+			perror("no ring");
+			res = 1;
+			goto fuck;
+		} else if ((st_r.st_mode & 0777) != 0600) {
+			fprintf(stderr, "ring has mode %o\n",
+				(unsigned int)st_r.st_mode & 0777U);
+			res = 1;
+		}
+	}
+
+	if (ud_wait(s, 0) != 0) {
+		fputs("ring not empty to begin with\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	for (unsigned int i = 0U; i < NMSG; i += 10U) {
+		if (send_some(p, 10U) < 0) {
+			res = 1;
+			goto fuck;
+		} else if ((n = drain(s, 0)) != 10U) {
+			fprintf(stderr, "expected 10 messages, got %zu\n", n);
+			res = 1;
+			goto fuck;
+		}
+	}
+
+	/* another process, waking us up */
+	switch ((c = fork())) {
+	case -1:
+		perror("cannot fork");
+		res = 1;
+		goto fuck;
+	case 0:
+		_exit(child());
+	default:
+		break;
+	}
+	if (ud_wait(s, 2000) <= 0) {
+		fputs("never woken up\n", stderr);
+		res = 1;
+	} else if ((n = drain(s, 0)) != 1U) {
+		fprintf(stderr, "expected 1 message from the child, got %zu\n", n);
+		res = 1;
+	}
+	{
+		int st_c;
+
+		if (waitpid(c, &st_c, 0) < 0 || st_c) {
+			fputs("child failed\n", stderr);
+			res = 1;
+		} else if (access(nm, F_OK) < 0) {
+			fputs("child took the ring with it\n", stderr);
+			res = 1;
+		}
+	}
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (st->ngap > 0U) {
+		fprintf(stderr, "%zu packets missing\n", st->ngap);
+		res = 1;
+	} else if (st->nsrc != 2U) {
+		fprintf(stderr, "expected 2 sources, got %zu\n", st->nsrc);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	if (access(nm, F_OK) < 0) {
+		fputs("ring gone before its last socket\n", stderr);
+		res = 1;
+	}
+	res -= ud_close(p);
+	if (access(nm, F_OK) == 0 || errno != ENOENT) {
+		fputs("ring outlived its sockets\n", stderr);
+		unlink(nm);
+		res = 1;
+	}
+	return res;
+}
+
+/* test_pubsub_26.c ends here */
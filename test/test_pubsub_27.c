@@ -0,0 +1,141 @@
+/*** test_pubsub_27.c -- testing spinning subscribers */
+#include <unserding.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* junk packets every CHATTER_IVL ms for CHATTER_DUR ms */
+#define CHATTER_IVL		(10)
+#define CHATTER_DUR		(1000)
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static void
+chatter(ud_sock_t s)
+{
+/* keep S busy with packets that aren't ours */
+	const struct sockaddr *dst = ud_socket_addr(s);
+	const struct timespec ivl = {0, CHATTER_IVL * 1000000L};
+
+	for (int i = 0; i < CHATTER_DUR / CHATTER_IVL; i++) {
+		(void)sendto(s->fd, "JUNK", 4U, 0,
+			     dst, sizeof(struct sockaddr_in6));
+		nanosleep(&ivl, NULL);
+	}
+	return;
+}
+
+static int
+chattered(ud_sock_t s)
+{
+/* packets that aren't messages mustn't keep the timeout from expiring */
+	struct ud_msg_s msg[1];
+	struct timespec t0, t1;
+	long int ms;
+	pid_t c;
+
+	switch ((c = fork())) {
+	case -1:
+		perror("cannot fork");
+		return -1;
+	case 0:
+		chatter(s);
+		_exit(0);
+	default:
+		break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (ud_chck_msg_spin(msg, s, 100) >= 0) {
+		fputs("junk taken for message\n", stderr);
+		ms = -1;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ms = (t1.tv_sec - t0.tv_sec) * 1000L +
+			(t1.tv_nsec - t0.tv_nsec) / 1000000L;
+		if (ms >= CHATTER_DUR / 2) {
+			fprintf(stderr, "100ms timeout took %ldms\n", ms);
+			ms = -1;
+		}
+	}
+	(void)waitpid(c, NULL, 0);
+	return ms < 0 ? -1 : 0;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct ud_stats_s st[1];
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.spin = 1000U,
+		})) == NULL) {
+		perror("cannot initialise ud socket");
+		return 1;
+	}
+
+	assert(s->fd > 0);
+
+	if (ud_pack_msg(s, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		res = 1;
+		goto fuck;
+	} else if (ud_flush(s) < 0) {
+		perror("couldn't flush secret message");
+		res = 1;
+		goto fuck;
+	}
+
+	/* looped back well within the spin budget */
+	if (ud_chck_msg_spin(msg, s, 2000) < 0) {
+		fputs("message never arrived\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (msg->svc != 0xffff || msg->dlen != sizeof(secret) ||
+		   memcmp(msg->data, secret, sizeof(secret))) {
+		fputs("message garbled\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	/* nothing else coming */
+	if (ud_chck_msg_spin(msg, s, 10) >= 0) {
+		fputs("message out of nowhere\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (st->nspin_hit + st->nspin_miss != 2U) {
+		fprintf(stderr, "expected 2 spins, got %zu hits %zu misses\n",
+			st->nspin_hit, st->nspin_miss);
+		res = 1;
+	} else if (st->nspin_miss < 1U) {
+		fputs("spinning into nothing must miss\n", stderr);
+		res = 1;
+	}
+
+	if (chattered(s) < 0) {
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_27.c ends here */
@@ -0,0 +1,115 @@
+/*** test_pubsub_28.c -- testing decoding of captured packets */
+#include <unserding.h>
+#include <ud-private.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	/* plays the capture device, we read its datagrams raw */
+	ud_sock_t c;
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	struct sockaddr_in6 src;
+	socklen_t srcz = sizeof(src);
+	char buf[1500U];
+	ssize_t nrd;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){UD_PUB})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	} else if ((c = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise capture socket");
+		ud_close(s);
+		ud_close(p);
+		return 1;
+	}
+
+	assert(s->fd > 0);
+	assert(c->fd > 0);
+
+	if (ud_tap(s) < 0) {
+		perror("cannot tap subscriber");
+		res = 1;
+		goto fuck;
+	}
+
+	if (ud_pack_msg(p, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		res = 1;
+		goto fuck;
+	} else if (ud_flush(p) < 0) {
+		perror("couldn't flush secret message");
+		res = 1;
+		goto fuck;
+	}
+
+	/* the tapped socket must not see anything itself */
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	if (poll(fds, countof(fds), 100) > 0 && ud_chck_msg(msg, s) >= 0) {
+		fputs("tapped socket received a message\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	/* capture */
+	fds->fd = c->fd;
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		fputs("nothing captured\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if ((nrd = recvfrom(c->fd, buf, sizeof(buf), 0,
+				   (struct sockaddr*)&src, &srcz)) <= 0) {
+		perror("cannot read captured packet");
+		res = 1;
+		goto fuck;
+	}
+
+	/* and decode */
+	if (ud_inject(s, buf, nrd, (struct sockaddr*)&src, NULL) < 0) {
+		perror("cannot inject captured packet");
+		res = 1;
+	} else if (ud_chck_msg(msg, s) < 0) {
+		fputs("no message in captured packet\n", stderr);
+		res = 1;
+	} else if (msg->svc != 0xffff) {
+		fprintf(stderr, "wrong service %hx\n", msg->svc);
+		res = 1;
+	} else if (msg->dlen != sizeof(secret) ||
+		   memcmp(msg->data, secret, sizeof(secret))) {
+		fputs("message b0rked\n", stderr);
+		res = 1;
+	} else if (ud_chck_msg(msg, s) >= 0) {
+		fputs("spurious message in captured packet\n", stderr);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(c);
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_28.c ends here */
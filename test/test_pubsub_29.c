@@ -0,0 +1,122 @@
+/*** test_pubsub_29.c -- testing bulk opened sockets */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NSOCK			(256U)
+#define PORT0			(8700U)
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static int
+send_recv(ud_sock_t s, uint16_t port)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	ud_sock_t p;
+	int res = -1;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.port = port,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if (ud_pack_msg(p, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		goto out;
+	} else if (ud_flush(p) < 0) {
+		perror("couldn't flush secret message");
+		goto out;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		fprintf(stderr, "nothing received on port %hu\n", port);
+	} else if (ud_chck_msg(msg, s) < 0) {
+		fprintf(stderr, "no message on port %hu\n", port);
+	} else if (msg->svc != 0xffff || msg->dlen != sizeof(secret) ||
+		   memcmp(msg->data, secret, sizeof(secret))) {
+		fprintf(stderr, "message b0rked on port %hu\n", port);
+	} else {
+		res = 0;
+	}
+out:
+	ud_close(p);
+	return res;
+}
+
+static int
+check(unsigned int mopt)
+{
+	uint16_t ports[NSOCK];
+	ud_sock_t s[NSOCK];
+	size_t n;
+	int res = 0;
+
+	for (size_t i = 0; i < NSOCK; i++) {
+		ports[i] = (uint16_t)(PORT0 + i);
+	}
+	if ((n = ud_socket_bulk(s, (struct ud_sockopt_s){
+				UD_SUB,
+				.mode_opt = mopt,
+			}, ports, NSOCK)) != NSOCK) {
+		fprintf(stderr, "only %zu out of %u sockets opened\n", n, NSOCK);
+		res = 1;
+		goto out;
+	}
+
+	/* every socket must be on its port */
+	for (size_t i = 0; i < NSOCK; i++) {
+		const struct sockaddr_in6 *sa = (const void*)ud_socket_addr(s[i]);
+
+		if (sa == NULL || ntohs(sa->sin6_port) != ports[i]) {
+			fprintf(stderr, "socket %zu on the wrong port\n", i);
+			res = 1;
+			goto out;
+		}
+	}
+
+	/* close every other one, the rest must carry on */
+	for (size_t i = 0; i < NSOCK; i += 2U) {
+		res -= ud_close(s[i]);
+		s[i] = NULL;
+	}
+	if (send_recv(s[NSOCK / 2U + 1U], ports[NSOCK / 2U + 1U]) < 0) {
+		res = 1;
+	}
+
+out:
+	res -= ud_close_bulk(s, NSOCK);
+	return res;
+}
+
+int
+main(void)
+{
+	int res = 0;
+
+	if (check(UD_MOPT_NONE)) {
+		fputs("bulk sockets failed\n", stderr);
+		res = 1;
+	}
+	/* must fall back to normal pages without hugepages */
+	if (check(UD_MOPT_HUGE)) {
+		fputs("bulk sockets on hugepages failed\n", stderr);
+		res = 1;
+	}
+	return res;
+}
+
+/* test_pubsub_29.c ends here */
@@ -0,0 +1,224 @@
+/*** test_pubsub_30.c -- testing the poller's budgets and dispatch */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define NHOT			(200U)
+#define BUDGET			(8U)
+
+#define PORT_HOT		(8801U)
+#define PORT_COLD		(8802U)
+#define SVC_HOT			(0x0101U)
+#define SVC_COLD		(0x0202U)
+/* on the cold channel but without a callback of its own */
+#define SVC_TEPID		(0x0203U)
+/* coalescing publishers hold packs this long (in us) */
+#define MAX_DELAY		(20000U)
+
+static size_t nhot;
+static size_t ncold;
+static size_t nother;
+
+static void
+hot_cb(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	nhot += msg->svc == SVC_HOT && clo == &nhot;
+	(void)s;
+	return;
+}
+
+static void
+cold_cb(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	ncold += msg->svc == SVC_COLD && clo == &ncold;
+	(void)s;
+	return;
+}
+
+static void
+any_cb(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	nother++;
+	(void)s;
+	(void)msg;
+	(void)clo;
+	return;
+}
+
+static int
+publish(uint16_t port, ud_svc_t svc, size_t n)
+{
+	ud_sock_t p;
+	uint8_t buf[16U] = {0};
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.port = port,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 16U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (ud_pack_msg(p, (struct ud_msg_s){
+					.svc = svc,
+					.data = buf,
+					.dlen = sizeof(buf),
+				}) < 0) {
+			perror("couldn't pack message");
+			res = -1;
+			break;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+	}
+	res -= ud_close(p);
+	return res;
+}
+
+static int
+coalesce(ud_poller_t p)
+{
+/* a coalescing publisher's flushes are due to the poller alone */
+	ud_sock_t q;
+	uint8_t buf[16U] = {0};
+	int res = 0;
+
+	if ((q = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.port = PORT_COLD,
+			.mode_opt = UD_MOPT_PROTO2,
+			.max_delay = MAX_DELAY,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if (ud_poller_add(p, q) < 0) {
+		perror("cannot add publisher to poller");
+		ud_close(q);
+		return -1;
+	}
+	ncold = 0U;
+	if (ud_pack_msg(q, (struct ud_msg_s){
+				.svc = SVC_COLD,
+				.data = buf,
+				.dlen = sizeof(buf),
+			}) < 0) {
+		perror("couldn't pack message");
+		res = -1;
+	}
+	for (size_t i = 0; i < 20U && !ncold; i++) {
+		(void)ud_poller_run(p, 50);
+	}
+	if (!res && ncold != 1U) {
+		fputs("coalesced message never flushed\n", stderr);
+		res = -1;
+	}
+	(void)ud_poller_del(p, q);
+	res -= ud_close(q);
+	return res;
+}
+
+int
+main(void)
+{
+	ud_poller_t p;
+	ud_sock_t s[2U];
+	ssize_t n;
+	int res = 0;
+
+	if ((p = ud_poller_open(BUDGET)) == NULL) {
+		perror("cannot open poller");
+		return 1;
+	} else if ((s[0U] = ud_socket((struct ud_sockopt_s){
+				UD_SUB,
+				.port = PORT_HOT,
+				.nrecv = 16U,
+			})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_poller_close(p);
+		return 1;
+	} else if ((s[1U] = ud_socket((struct ud_sockopt_s){
+				UD_SUB,
+				.port = PORT_COLD,
+			})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(s[0U]);
+		ud_poller_close(p);
+		return 1;
+	}
+
+	if (ud_poller_add(p, s[0U]) < 0 || ud_poller_add(p, s[1U]) < 0) {
+		perror("cannot add sockets to poller");
+		res = 1;
+		goto fuck;
+	}
+	ud_poller_on(p, SVC_HOT, hot_cb, &nhot);
+	ud_poller_on(p, SVC_COLD, cold_cb, &ncold);
+	ud_poller_on_any(p, any_cb, NULL);
+
+	if (publish(PORT_HOT, SVC_HOT, NHOT) < 0 ||
+	    publish(PORT_COLD, SVC_COLD, 1U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	/* let both arrive */
+	nanosleep(&(struct timespec){0, 100000000L}, NULL);
+
+	/* the hot socket must not hog the first round */
+	if ((n = ud_poller_run(p, 2000)) < 0) {
+		perror("poller failed");
+		res = 1;
+		goto fuck;
+	} else if (nhot != BUDGET || ncold != 1U) {
+		fprintf(stderr, "first round: %zu hot, %zu cold\n", nhot, ncold);
+		res = 1;
+		goto fuck;
+	}
+
+	/* the rest without waiting */
+	for (size_t i = 0; i < NHOT && ud_poller_run(p, 100) > 0; i++);
+	if (nhot != NHOT) {
+		fprintf(stderr, "%zu out of %u hot messages\n", nhot, NHOT);
+		res = 1;
+	} else if (nother > 0U) {
+		fprintf(stderr, "%zu stray messages\n", nother);
+		res = 1;
+	}
+
+	/* channel's got callbacks but not for this one, catch-all's */
+	if (publish(PORT_COLD, SVC_TEPID, 1U) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	for (size_t i = 0; i < 10U && !nother; i++) {
+		(void)ud_poller_run(p, 100);
+	}
+	if (nother != 1U) {
+		fprintf(stderr, "%zu messages for the catch-all\n", nother);
+		res = 1;
+	}
+
+	if (coalesce(p) < 0) {
+		res = 1;
+	}
+
+	/* closing the socket after removal */
+	if (ud_poller_del(p, s[0U]) < 0 || ud_poller_del(p, s[0U]) == 0) {
+		fputs("removal from poller b0rked\n", stderr);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_poller_close(p);
+	res -= ud_close(s[1U]);
+	res -= ud_close(s[0U]);
+	return res;
+}
+
+/* test_pubsub_30.c ends here */
@@ -0,0 +1,135 @@
+/*** test_pubsub_31.c -- testing delta-encoded ticks */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NTICKS			(300U)
+/* raw ticks would take a packet per 50 or so */
+#define MAX_NPKT		(NTICKS / 100U)
+
+#define SVC_A			(0x0101U)
+#define SVC_B			(0x0102U)
+
+static struct ud_tick_s
+mk_tick(size_t i)
+{
+	return (struct ud_tick_s){
+		.ts = 1380000000000000000LL + (int64_t)i * 1000LL,
+		.px = 1234500 + (int64_t)(i % 7U) - 3,
+		.qty = (int64_t)(i % 5U) * 100,
+	};
+}
+
+static const struct ud_tick_s extr[] = {
+	{INT64_MIN, INT64_MAX, 0},
+	{INT64_MAX, INT64_MIN, -1},
+	{0, -1, INT64_MIN},
+};
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct ud_stats_s st[1];
+	struct pollfd fds[1];
+	size_t na = 0U;
+	size_t nb = 0U;
+	size_t nx = 0U;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 16U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 16U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	}
+
+	/* two services interleaved, each delta'd against its own */
+	for (size_t i = 0; i < NTICKS; i++) {
+		struct ud_tick_s t = mk_tick(i);
+
+		if (ud_pack_tick(p, (i & 1U) ? SVC_B : SVC_A, &t) < 0) {
+			perror("couldn't pack tick");
+			res = 1;
+			goto fuck;
+		}
+	}
+	/* deltas that wrap */
+	for (size_t i = 0; i < countof(extr); i++) {
+		if (ud_pack_tick(p, 0xffff/*TEST SERVICE*/, extr + i) < 0) {
+			perror("couldn't pack tick");
+			res = 1;
+			goto fuck;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush ticks");
+		res = 1;
+		goto fuck;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			const struct ud_tick_s *t = msg->data;
+			struct ud_tick_s x;
+
+			if (msg->dlen != sizeof(*t)) {
+				continue;
+			}
+			switch (msg->svc) {
+			case SVC_A:
+				x = mk_tick(2U * na++);
+				break;
+			case SVC_B:
+				x = mk_tick(2U * nb++ + 1U);
+				break;
+			case 0xffff:
+				x = extr[nx++ % countof(extr)];
+				break;
+			default:
+				continue;
+			}
+			if (memcmp(t, &x, sizeof(x))) {
+				fprintf(stderr, "tick b0rked: %lld %lld %lld\n",
+					(long long)t->ts, (long long)t->px,
+					(long long)t->qty);
+				res = 1;
+			}
+		}
+	}
+
+	if (na + nb != NTICKS || nx != countof(extr)) {
+		fprintf(stderr, "ticks missing: %zu %zu %zu\n", na, nb, nx);
+		res = 1;
+	} else if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (st->npkt > MAX_NPKT) {
+		fprintf(stderr, "ticks took %zu packets\n", st->npkt);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_31.c ends here */
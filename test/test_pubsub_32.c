@@ -0,0 +1,147 @@
+/*** test_pubsub_32.c -- testing packet checksums */
+#include <unserding.h>
+#include <ud-private.h>
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static int
+chck_one(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+
+	if (ud_chck_msg(msg, s) < 0) {
+		return -1;
+	} else if (msg->svc != 0xffff) {
+		return -1;
+	} else if (msg->dlen != sizeof(secret)) {
+		return -1;
+	} else if (memcmp(msg->data, secret, sizeof(secret))) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	/* plays the capture device, we read its datagrams raw */
+	ud_sock_t c;
+	struct ud_msg_s msg[1];
+	struct ud_stats_s st[1];
+	struct pollfd fds[1];
+	struct sockaddr_in6 src;
+	socklen_t srcz = sizeof(src);
+	char pkt[1500U];
+	char buf[1500U];
+	ssize_t nrd;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_CRC,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	} else if ((c = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise capture socket");
+		ud_close(s);
+		ud_close(p);
+		return 1;
+	}
+
+	assert(s->fd > 0);
+	assert(c->fd > 0);
+
+	if (ud_pack_msg(p, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0) {
+		perror("couldn't pack secret message");
+		res = 1;
+		goto fuck;
+	} else if (ud_flush(p) < 0) {
+		perror("couldn't flush secret message");
+		res = 1;
+		goto fuck;
+	}
+
+	/* checksummed packets must go through as usual */
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	if (poll(fds, countof(fds), 2000) <= 0 || chck_one(s) < 0) {
+		fputs("checksummed message didn't go through\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	/* capture the very packet */
+	fds->fd = c->fd;
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		fputs("nothing captured\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if ((nrd = recvfrom(c->fd, pkt, sizeof(pkt), 0,
+				   (struct sockaddr*)&src, &srcz)) <= 0) {
+		perror("cannot read captured packet");
+		res = 1;
+		goto fuck;
+	} else if (ud_tap(s) < 0) {
+		perror("cannot tap subscriber");
+		res = 1;
+		goto fuck;
+	}
+
+	/* flip a bit in the payload, the message must not come out */
+	memcpy(buf, pkt, nrd);
+	buf[nrd / 2] ^= 0x10;
+	if (ud_inject(s, buf, nrd, (struct sockaddr*)&src, NULL) == 0 &&
+	    chck_one(s) == 0) {
+		fputs("corrupt message went through\n", stderr);
+		res = 1;
+	}
+	/* same for truncated packets */
+	memcpy(buf, pkt, nrd);
+	if (ud_inject(s, buf, 10U, (struct sockaddr*)&src, NULL) == 0 &&
+	    ud_chck_msg(msg, s) == 0) {
+		fputs("truncated packet went through\n", stderr);
+		res = 1;
+	}
+	/* whereas the original one passes */
+	memcpy(buf, pkt, nrd);
+	if (ud_inject(s, buf, nrd, (struct sockaddr*)&src, NULL) < 0 ||
+	    chck_one(s) < 0) {
+		fputs("original message didn't go through\n", stderr);
+		res = 1;
+	}
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (st->ncrc != 2U) {
+		fprintf(stderr, "%zu checksum mismatches\n", st->ncrc);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(c);
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_32.c ends here */
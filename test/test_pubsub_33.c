@@ -0,0 +1,368 @@
+/*** test_pubsub_33.c -- testing paced publishers and priorities */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NBULK			(24U)
+#define BURST			(4U)
+#define PKT_RATE		(200U)
+#define RATE			(100000U)
+
+#define SVC_BULK		(0x0101U)
+#define SVC_RT			(0x0202U)
+
+/* a packet each */
+static uint8_t buf[1000U];
+
+static double
+now(void)
+{
+	struct timespec tsp;
+
+	clock_gettime(CLOCK_MONOTONIC, &tsp);
+	return (double)tsp.tv_sec + (double)tsp.tv_nsec * 1e-9;
+}
+
+static int
+drain(ud_sock_t p)
+{
+/* flush whenever the timer says so, until it stays quiet */
+	struct pollfd fds[1] = {{p->tfd, POLLIN, 0}};
+
+	do {
+		if (ud_flush(p) < 0 && errno != EAGAIN) {
+			return -1;
+		}
+	} while (poll(fds, countof(fds), 300) > 0);
+	return 0;
+}
+
+static int
+pace(unsigned int rate, unsigned int pkt_rate, double min)
+{
+/* send NBULK packets paced at RATE and PKT_RATE, which must take
+ * at least MIN seconds */
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	size_t nbulk = 0U;
+	double t0;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 8U,
+			.rate = rate,
+			.pkt_rate = pkt_rate,
+			.burst = BURST,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 16U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return -1;
+	} else if (p->tfd < 0) {
+		fputs("paced publisher has no timer\n", stderr);
+		res = -1;
+		goto out;
+	}
+
+	t0 = now();
+	for (size_t i = 0; i < NBULK; i++) {
+		struct pollfd tfds[1] = {{p->tfd, POLLIN, 0}};
+
+		while (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = SVC_BULK,
+				       .data = buf,
+				       .dlen = sizeof(buf),
+			       }) < 0) {
+			/* queue's full, wait for the timer */
+			if (errno != EAGAIN) {
+				perror("couldn't pack message");
+				res = -1;
+				goto out;
+			} else if (poll(tfds, countof(tfds), 2000) <= 0) {
+				fputs("timer never fired\n", stderr);
+				res = -1;
+				goto out;
+			}
+			(void)ud_flush(p);
+		}
+	}
+	if (drain(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+		goto out;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			nbulk += msg->svc == SVC_BULK;
+		}
+	}
+	if (nbulk != NBULK) {
+		fprintf(stderr, "%zu out of %u messages\n", nbulk, NBULK);
+		res = -1;
+	} else if (now() - t0 < min) {
+		fprintf(stderr, "rates exceeded, took %.3fs\n", now() - t0);
+		res = -1;
+	}
+out:
+	ud_close(s);
+	ud_close(p);
+	return res;
+}
+
+static int
+prio(void)
+{
+/* urgent messages must overtake held back ones */
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	size_t nbulk = 0U;
+	size_t rt_at = 0U;
+	size_t n = 0U;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 8U,
+			.pkt_rate = PKT_RATE,
+			.burst = BURST,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 16U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return -1;
+	} else if (ud_set_prio(p, SVC_RT, 1) < 0) {
+		perror("cannot prioritise service");
+		res = -1;
+		goto out;
+	}
+
+	/* fill the queue until it's clogged */
+	for (size_t i = 0; i < NBULK; i++) {
+		if (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = SVC_BULK,
+				       .data = buf,
+				       .dlen = sizeof(buf),
+			       }) < 0) {
+			break;
+		}
+		nbulk++;
+	}
+	(void)ud_flush(p);
+	/* the tick must go now, clogged or not */
+	if (ud_pack_msg(p, (struct ud_msg_s){
+			       .svc = SVC_RT,
+			       .data = buf,
+			       .dlen = 16U,
+		       }) < 0) {
+		perror("couldn't pack urgent message");
+		res = -1;
+		goto out;
+	} else if (ud_flush(p) < 0 && errno != EAGAIN) {
+		perror("couldn't flush urgent message");
+		res = -1;
+		goto out;
+	} else if (drain(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+		goto out;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			n++;
+			if (msg->svc == SVC_RT) {
+				rt_at = n;
+			}
+		}
+	}
+	if (n != nbulk + 1U) {
+		fprintf(stderr, "%zu out of %zu messages\n", n, nbulk + 1U);
+		res = -1;
+	} else if (rt_at == 0U || rt_at >= n) {
+		/* it's overtaken nothing */
+		fprintf(stderr, "urgent message came %zu of %zu\n", rt_at, n);
+		res = -1;
+	}
+out:
+	ud_close(s);
+	ud_close(p);
+	return res;
+}
+
+static int
+linger(void)
+{
+/* closing right after flushing must not lose held back packets */
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	size_t nbulk = 0U;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 2U * NBULK,
+			.pkt_rate = 10U * PKT_RATE,
+			.burst = BURST,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 16U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return -1;
+	}
+	for (size_t i = 0; i < NBULK; i++) {
+		if (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = SVC_BULK,
+				       .data = buf,
+				       .dlen = sizeof(buf),
+			       }) < 0) {
+			perror("couldn't pack message");
+			res = -1;
+			break;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+	}
+	if (ud_close(p) < 0) {
+		perror("couldn't close publisher");
+		res = -1;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			nbulk += msg->svc == SVC_BULK;
+		}
+	}
+	if (nbulk != NBULK) {
+		fprintf(stderr, "%zu out of %u messages\n", nbulk, NBULK);
+		res = -1;
+	}
+	ud_close(s);
+	return res;
+}
+
+static int
+unflushed(struct ud_sockopt_s opt)
+{
+/* closing with something packed but never flushed mustn't lose it */
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1];
+	size_t nbulk = 0U;
+	int res = 0;
+
+	if ((p = ud_socket(opt)) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return -1;
+	}
+	if (ud_pack_msg(p, (struct ud_msg_s){
+			       .svc = SVC_BULK,
+			       .data = buf,
+			       .dlen = 16U,
+		       }) < 0) {
+		perror("couldn't pack message");
+		res = -1;
+	}
+	if (ud_close(p) < 0) {
+		perror("couldn't close publisher");
+		res = -1;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			nbulk += msg->svc == SVC_BULK;
+		}
+	}
+	if (nbulk != 1U) {
+		fprintf(stderr, "%zu out of 1 messages\n", nbulk);
+		res = -1;
+	}
+	ud_close(s);
+	return res;
+}
+
+int
+main(void)
+{
+	int res = 0;
+
+	/* BURST go at once, the rest at the rate */
+	if (pace(0U, PKT_RATE, (double)(NBULK - BURST) / PKT_RATE * .9) < 0) {
+		fputs("packet rate pacing failed\n", stderr);
+		res = 1;
+	}
+	if (pace(RATE, 0U,
+		 (double)(NBULK - 2U * BURST) * sizeof(buf) / RATE) < 0) {
+		fputs("byte rate pacing failed\n", stderr);
+		res = 1;
+	}
+	if (prio() < 0) {
+		fputs("priorities failed\n", stderr);
+		res = 1;
+	}
+	if (linger() < 0) {
+		fputs("closing dropped held back packets\n", stderr);
+		res = 1;
+	}
+	if (unflushed((struct ud_sockopt_s){UD_PUB}) < 0) {
+		fputs("closing dropped unflushed packs\n", stderr);
+		res = 1;
+	}
+	/* coalescing would have held on to it for another second */
+	if (unflushed((struct ud_sockopt_s){
+			UD_PUB,
+			.max_delay = 1000000U,
+		}) < 0) {
+		fputs("closing dropped coalesced packs\n", stderr);
+		res = 1;
+	}
+	return res;
+}
+
+/* test_pubsub_33.c ends here */
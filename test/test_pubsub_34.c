@@ -0,0 +1,152 @@
+/*** test_pubsub_34.c -- testing drop accounting and buffer growth */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* way more than the smallest buffer holds */
+#define NFLOOD			(200U)
+#define MAX_RCVBUF		(1024U * 1024U)
+
+static uint8_t buf[1000U];
+
+static int
+choke(ud_sock_t p)
+{
+/* kernel's choking, wait for it */
+	struct pollfd fds[1] = {{p->fd, POLLOUT, 0}};
+
+	if (poll(fds, countof(fds), 1000) <= 0) {
+		perror("couldn't publish message");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+publish(ud_sock_t p, size_t n)
+{
+/* a packet per message, a failed flush leaves the packet queued so
+ * only the flush is tried again, packing anew would send it twice */
+	for (size_t i = 0; i < n; i++) {
+		while (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = 0xffff/*TEST SERVICE*/,
+				       .data = buf,
+				       .dlen = sizeof(buf),
+			       }) < 0) {
+			if (choke(p) < 0) {
+				return -1;
+			}
+		}
+		while (ud_flush(p) < 0) {
+			if (choke(p) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static size_t
+drain(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	struct pollfd fds[1] = {{s->fd, POLLIN, 0}};
+	size_t n = 0U;
+
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			n++;
+		}
+	}
+	return n;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_stats_s st[1];
+	int z0;
+	int z1;
+	size_t n;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){UD_PUB})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 16U,
+			.max_rcvbuf = MAX_RCVBUF,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	}
+
+	/* shrink the buffer as far as the kernel lets us */
+	z0 = 1;
+	(void)setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &z0, sizeof(z0));
+	{
+		socklen_t zz = sizeof(z0);
+
+		(void)getsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &z0, &zz);
+	}
+
+	/* flood it without reading, then read what's left */
+	if (publish(p, NFLOOD) < 0) {
+		res = 1;
+		goto fuck;
+	}
+	n = drain(s);
+	/* drops are told along with the packets after them */
+	for (size_t i = 0; i < 2U; i++) {
+		if (publish(p, 1U) < 0) {
+			res = 1;
+			goto fuck;
+		}
+		n += drain(s);
+	}
+
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+	} else if (n >= NFLOOD) {
+		fprintf(stderr, "nothing dropped, buffer's %d\n", z0);
+		res = 1;
+	} else if (st->novfl == 0U) {
+		fputs("drops went unnoticed\n", stderr);
+		res = 1;
+	} else if (n + st->novfl < NFLOOD + 2U) {
+		/* anyone else on the group drops along with us */
+		fprintf(stderr, "%zu received, %zu dropped, out of %u\n",
+			n, st->novfl, NFLOOD + 2U);
+		res = 1;
+	}
+
+	/* and the buffer must have grown */
+	{
+		socklen_t zz = sizeof(z1);
+
+		if (getsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &z1, &zz) < 0) {
+			perror("cannot obtain buffer size");
+			res = 1;
+		} else if (z1 <= z0 || z1 > (int)MAX_RCVBUF) {
+			fprintf(stderr, "buffer went from %d to %d\n", z0, z1);
+			res = 1;
+		}
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_34.c ends here */
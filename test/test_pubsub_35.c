@@ -0,0 +1,203 @@
+/*** test_pubsub_35.c -- testing batches of messages */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* a couple of packets' worth of each */
+#define NMSG			(120U)
+#define NTICKS			(200U)
+#define NLARGE			(4U)
+#define LARGEZ			(4000U)
+
+#define SVC_MSG			(0x0101U)
+#define SVC_TICK		(0x0102U)
+#define SVC_LARGE		(0x0103U)
+
+static uint8_t large[LARGEZ];
+
+static struct ud_tick_s
+mk_tick(size_t i)
+{
+	return (struct ud_tick_s){
+		.ts = 1380000000000000000LL + (int64_t)i * 1000LL,
+		.px = 1234500 + (int64_t)(i % 7U),
+		.qty = (int64_t)i,
+	};
+}
+
+static int
+publish(void)
+{
+	ud_sock_t p;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUB,
+			.mode_opt = UD_MOPT_PROTO2,
+			.nsend = 64U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	}
+	for (size_t i = 0; i < NMSG; i++) {
+		uint32_t x = (uint32_t)i;
+
+		if (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = SVC_MSG,
+				       .data = &x,
+				       .dlen = sizeof(x),
+			       }) < 0) {
+			perror("couldn't pack message");
+			res = -1;
+			goto out;
+		}
+	}
+	for (size_t i = 0; i < NTICKS; i++) {
+		struct ud_tick_s t = mk_tick(i);
+
+		if (ud_pack_tick(p, SVC_TICK, &t) < 0) {
+			perror("couldn't pack tick");
+			res = -1;
+			goto out;
+		}
+	}
+	for (size_t i = 0; i < NLARGE; i++) {
+		large[0U] = (uint8_t)i;
+		if (ud_pack_lmsg(p, (struct ud_msg_s){
+				       .svc = SVC_LARGE,
+				       .data = large,
+				       .dlen = sizeof(large),
+			       }) < 0) {
+			perror("couldn't pack large message");
+			res = -1;
+			goto out;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+	}
+out:
+	ud_close(p);
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	struct ud_msg_s msg[512U];
+	struct ud_auxmsg_s aux[countof(msg)];
+	struct pollfd fds[1];
+	size_t nmsg = 0U;
+	size_t ntick = 0U;
+	size_t nlarge = 0U;
+	size_t nbatch = 0U;
+	ssize_t n;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.nrecv = 64U,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		return 1;
+	} else if (publish() < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	/* let it all arrive */
+	nanosleep(&(struct timespec){0, 100000000L}, NULL);
+
+	/* a tiny batch first, the rest must carry on from there */
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	if (poll(fds, countof(fds), 2000) <= 0) {
+		fputs("nothing received\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (ud_chck_mmsg(msg, NULL, 2U, s) != 2) {
+		fputs("small batch b0rked\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (msg[1U].svc != SVC_MSG ||
+		   *(const uint32_t*)msg[1U].data != 1U) {
+		fputs("small batch has the wrong messages\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+	nmsg = 2U;
+
+	do {
+		while ((n = ud_chck_mmsg(msg, aux, countof(msg), s)) > 0) {
+			uint16_t pno = aux->pno;
+
+			nbatch++;
+			/* everything in a batch stays put till the next */
+			for (ssize_t i = 0; i < n; i++) {
+				const struct ud_msg_s *m = msg + i;
+
+				if ((uint16_t)(aux[i].pno - pno) > 0x7fffU) {
+					fputs("packets out of order\n", stderr);
+					res = 1;
+				}
+				pno = aux[i].pno;
+				switch (m->svc) {
+					struct ud_tick_s t;
+					uint32_t x;
+
+				case SVC_MSG:
+					memcpy(&x, m->data, sizeof(x));
+					if (x != nmsg++) {
+						fputs("msg b0rked\n", stderr);
+						res = 1;
+					}
+					break;
+				case SVC_TICK:
+					t = mk_tick(ntick++);
+					if (m->dlen != sizeof(t) ||
+					    memcmp(m->data, &t, sizeof(t))) {
+						fputs("tick b0rked\n", stderr);
+						res = 1;
+					}
+					break;
+				case SVC_LARGE:
+					x = *(const uint8_t*)m->data;
+					if (x != nlarge++ ||
+					    m->dlen != LARGEZ) {
+						fputs("lmsg b0rked\n", stderr);
+						res = 1;
+					} else if (i != n - 1) {
+						fputs("too long\n", stderr);
+						res = 1;
+					}
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	} while (poll(fds, countof(fds), 200) > 0);
+
+	if (nmsg != NMSG || ntick != NTICKS || nlarge != NLARGE) {
+		fprintf(stderr, "got %zu messages, %zu ticks, %zu large\n",
+			nmsg, ntick, nlarge);
+		res = 1;
+	} else if (nbatch > NLARGE + 1U) {
+		/* the ring holds everything, only large ones split */
+		fprintf(stderr, "took %zu batches\n", nbatch);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_35.c ends here */
@@ -0,0 +1,179 @@
+/*** test_pubsub_36.c -- testing dispatch tables */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* rounds of one message per service */
+#define NROUND			(20U)
+
+/* own handler, channel handler, dropped, own handler later on */
+#define SVC_OWN			(0x0101U)
+#define SVC_CHN			(0x0102U)
+#define SVC_DROP		(0x0203U)
+#define SVC_LATE		(0x0104U)
+
+static const ud_svc_t svcs[] = {SVC_OWN, SVC_CHN, SVC_DROP, SVC_LATE};
+
+struct cnt_s {
+	size_t own;
+	size_t chn;
+	size_t late;
+	size_t late_own;
+	size_t bad;
+};
+
+static void
+on_late(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	struct cnt_s *c = clo;
+
+	(void)s;
+	c->bad += msg->svc != SVC_LATE;
+	c->late_own++;
+	return;
+}
+
+static void
+on_own(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	struct cnt_s *c = clo;
+	uint32_t x;
+
+	memcpy(&x, msg->data, sizeof(x));
+	c->bad += msg->svc != SVC_OWN || x != c->own;
+	if (c->own++ == NROUND / 2U) {
+		/* from now on SVC_LATE has a handler of its own */
+		c->bad += ud_disp_on(s, SVC_LATE, on_late, c) < 0;
+	}
+	return;
+}
+
+static void
+on_chn(ud_sock_t s, const struct ud_msg_s *msg, void *clo)
+{
+	struct cnt_s *c = clo;
+
+	(void)s;
+	switch (msg->svc) {
+	case SVC_CHN:
+		c->chn++;
+		break;
+	case SVC_LATE:
+		c->late++;
+		break;
+	default:
+		c->bad++;
+		break;
+	}
+	return;
+}
+
+static int
+publish(void)
+{
+	ud_sock_t p;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){UD_PUB})) == NULL) {
+		perror("cannot initialise publisher");
+		return -1;
+	}
+	for (size_t i = 0; i < NROUND; i++) {
+		uint32_t x = (uint32_t)i;
+
+		for (size_t j = 0; j < countof(svcs); j++) {
+			if (ud_pack_msg(p, (struct ud_msg_s){
+					       .svc = svcs[j],
+					       .data = &x,
+					       .dlen = sizeof(x),
+				       }) < 0) {
+				perror("couldn't pack message");
+				res = -1;
+				goto out;
+			}
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush messages");
+		res = -1;
+	}
+out:
+	ud_close(p);
+	return res;
+}
+
+int
+main(void)
+{
+	ud_sock_t s;
+	struct cnt_s c = {0U};
+	struct pollfd fds[1];
+	ssize_t n;
+	size_t tot = 0U;
+	int res = 0;
+
+	if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		return 1;
+	} else if (ud_disp_run(s, 0U) >= 0) {
+		fputs("dispatched without handlers\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	if (ud_disp_on_chn(s, 0x01U, on_chn, &c) < 0 ||
+	    ud_disp_on(s, SVC_OWN, on_own, &c) < 0 ||
+	    /* channel 2 gets a handler, and loses it again */
+	    ud_disp_on_chn(s, 0x02U, on_chn, &c) < 0 ||
+	    ud_disp_on_chn(s, 0x02U, NULL, NULL) < 0 ||
+	    /* and SVC_CHN falls back to its channel's */
+	    ud_disp_on(s, SVC_CHN, on_late, &c) < 0 ||
+	    ud_disp_on(s, SVC_CHN, NULL, NULL) < 0) {
+		perror("cannot set up handlers");
+		res = 1;
+		goto fuck;
+	} else if (publish() < 0) {
+		res = 1;
+		goto fuck;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		/* in small bits, to see the budget's kept */
+		while ((n = ud_disp_run(s, 3U)) > 0) {
+			if (n > 3) {
+				fprintf(stderr, "dispatched %zd of 3\n", n);
+				res = 1;
+			}
+			tot += n;
+		}
+	}
+
+	if (tot != NROUND * countof(svcs)) {
+		fprintf(stderr, "dispatched %zu of %zu\n",
+			tot, NROUND * countof(svcs));
+		res = 1;
+	} else if (c.bad) {
+		fputs("messages went to the wrong handlers\n", stderr);
+		res = 1;
+	} else if (c.own != NROUND || c.chn != NROUND) {
+		fprintf(stderr, "own %zu chn %zu\n", c.own, c.chn);
+		res = 1;
+	} else if (c.late != NROUND / 2U || c.late_own != NROUND / 2U) {
+		/* half before on_own handed SVC_LATE to on_late */
+		fprintf(stderr, "late %zu %zu\n", c.late, c.late_own);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	return res;
+}
+
+/* test_pubsub_36.c ends here */
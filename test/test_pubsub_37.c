@@ -0,0 +1,259 @@
+/*** test_pubsub_37.c -- testing NAKs at the end of bursts, stale pnos */
+#include <unserding.h>
+#include <ud-private.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+/* a packet of data, one of control, and one of data again */
+#define NPKT			(3U)
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static char pkt[NPKT][1500U];
+static size_t pktz[NPKT];
+static char rtx[1500U];
+
+static size_t
+drain(ud_sock_t s)
+{
+	struct ud_msg_s msg[1];
+	size_t n = 0U;
+
+	while (ud_chck_msg(msg, s) >= 0) {
+		n++;
+	}
+	return n;
+}
+
+static ssize_t
+capture(ud_sock_t c, void *buf, size_t bsz, const struct sockaddr_in6 *from)
+{
+/* next packet captured on C sent by FROM */
+	struct pollfd fds[1] = {{c->fd, POLLIN, 0}};
+
+	while (poll(fds, countof(fds), 1000) > 0) {
+		struct sockaddr_in6 src;
+		socklen_t srcz = sizeof(src);
+		ssize_t nrd;
+
+		if ((nrd = recvfrom(c->fd, buf, bsz, 0,
+				    (struct sockaddr*)&src, &srcz)) <= 0) {
+			break;
+		} else if (src.sin6_port == from->sin6_port) {
+			return nrd;
+		}
+	}
+	return -1;
+}
+
+static int
+inject_pno(ud_sock_t s, const struct sockaddr_in6 *src, uint16_t pno)
+{
+/* inject a copy of the first data packet as PNO from SRC */
+	static char buf[1500U];
+	uint16_t bpno = htons(pno);
+
+	memcpy(buf, pkt[0U], pktz[0U]);
+	/* the pno comes after the protocol's initial */
+	memcpy(buf + 2U, &bpno, sizeof(bpno));
+	if (ud_inject(s, buf, pktz[0U], (const void*)src, NULL) < 0) {
+		return -1;
+	}
+	(void)drain(s);
+	return 0;
+}
+
+static int
+stale(ud_sock_t s)
+{
+/* retransmissions far behind mustn't look like a restart */
+	const struct sockaddr_in6 src = {
+		.sin6_family = AF_INET6,
+		.sin6_port = htons(4242U),
+		.sin6_addr = {{{0xfdU, [15U] = 0x01U}}},
+	};
+	struct ud_stats_s st[1];
+
+	if (inject_pno(s, &src, 200U) < 0 || inject_pno(s, &src, 201U) < 0) {
+		fputs("cannot inject packets\n", stderr);
+		return -1;
+	} else if (inject_pno(s, &src, 100U) >= 0) {
+		fputs("stale packet taken\n", stderr);
+		return -1;
+	} else if (inject_pno(s, &src, 202U) < 0) {
+		fputs("packet after stale one not taken\n", stderr);
+		return -1;
+	} else if (ud_get_src_stats(st, s, (const void*)&src) < 0) {
+		fputs("source not tracked\n", stderr);
+		return -1;
+	} else if (st->ngap) {
+		fprintf(stderr, "stale packet caused %zu gaps\n", st->ngap);
+		return -1;
+	}
+
+	/* publisher starting over, the first few are dropped */
+	for (uint16_t i = 0U; i < 3U; i++) {
+		if (inject_pno(s, &src, i) >= 0) {
+			fprintf(stderr, "restart taken after %hu\n", i);
+			return -1;
+		}
+	}
+	if (inject_pno(s, &src, 3U) < 0 || inject_pno(s, &src, 4U) < 0) {
+		fputs("restart not recognised\n", stderr);
+		return -1;
+	} else if (ud_get_src_stats(st, s, (const void*)&src) < 0) {
+		fputs("source not tracked\n", stderr);
+		return -1;
+	} else if (st->ngap) {
+		fprintf(stderr, "restart caused %zu gaps\n", st->ngap);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	/* plays the network, we lose packets by not injecting them */
+	ud_sock_t c;
+	struct ud_stats_s st[1];
+	struct sockaddr_in6 from;
+	socklen_t fromz = sizeof(from);
+	ssize_t nrd;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){
+			UD_PUBSUB,
+			.mode_opt = UD_MOPT_RELIABLE,
+			.nhist = 16U,
+		})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){
+			UD_SUB,
+			.mode_opt = UD_MOPT_RELIABLE,
+		})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	} else if ((c = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise capture socket");
+		ud_close(s);
+		ud_close(p);
+		return 1;
+	} else if (ud_tap(s) < 0) {
+		perror("cannot tap subscriber");
+		res = 1;
+		goto fuck;
+	}
+
+	/* data, control, data, the control packet's the one lost */
+	if (ud_pack_msg(p, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0 || ud_flush(p) < 0 ||
+	    ud_pack_cmsg(p, (struct ud_msg_s){
+				.svc = UD_CTRL_SVC(UD_SVC_TIME),
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0 ||
+	    ud_pack_msg(p, (struct ud_msg_s){
+				.svc = 0xffff/*TEST SERVICE*/,
+				.data = secret,
+				.dlen = sizeof(secret),
+			}) < 0 || ud_flush(p) < 0) {
+		perror("couldn't publish");
+		res = 1;
+		goto fuck;
+	}
+
+	/* the first one tells us who the publisher is */
+	{
+		struct pollfd fds[1] = {{c->fd, POLLIN, 0}};
+
+		if (poll(fds, countof(fds), 2000) <= 0 ||
+		    (nrd = recvfrom(c->fd, pkt[0U], sizeof(pkt[0U]), 0,
+				    (struct sockaddr*)&from, &fromz)) <= 0) {
+			fputs("nothing captured\n", stderr);
+			res = 1;
+			goto fuck;
+		}
+		pktz[0U] = nrd;
+	}
+	for (size_t i = 1U; i < NPKT; i++) {
+		if ((nrd = capture(c, pkt[i], sizeof(pkt[i]), &from)) < 0) {
+			fprintf(stderr, "packet %zu not captured\n", i);
+			res = 1;
+			goto fuck;
+		}
+		pktz[i] = nrd;
+	}
+	if (ud_inject(s, pkt[0U], pktz[0U], (void*)&from, NULL) < 0) {
+		perror("cannot inject packet");
+		res = 1;
+		goto fuck;
+	}
+	(void)drain(s);
+	if (ud_inject(s, pkt[2U], pktz[2U], (void*)&from, NULL) < 0) {
+		perror("cannot inject packet");
+		res = 1;
+		goto fuck;
+	}
+	(void)drain(s);
+
+	/* nothing follows the gap, the NAK must go anyway */
+	(void)ud_wait(s, 50);
+	{
+		struct pollfd fds[1] = {{p->fd, POLLIN, 0}};
+
+		/* the publisher answers as it reads */
+		while (poll(fds, countof(fds), 100) > 0) {
+			(void)drain(p);
+		}
+	}
+	if ((nrd = capture(c, rtx, sizeof(rtx), &from)) < 0) {
+		fputs("lost packet never retransmitted\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if ((size_t)nrd != pktz[1U] || memcmp(rtx, pkt[1U], nrd)) {
+		fputs("retransmission b0rked\n", stderr);
+		res = 1;
+		goto fuck;
+	} else if (ud_inject(s, rtx, nrd, (void*)&from, NULL) < 0) {
+		perror("cannot inject retransmission");
+		res = 1;
+		goto fuck;
+	}
+	(void)drain(s);
+	if (ud_get_stats(st, s) < 0) {
+		perror("cannot obtain stats");
+		res = 1;
+		goto fuck;
+	} else if (st->ngap) {
+		fprintf(stderr, "%zu packets still missing\n", st->ngap);
+		res = 1;
+		goto fuck;
+	}
+
+	if (stale(s) < 0) {
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(c);
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_37.c ends here */
@@ -0,0 +1,120 @@
+/*** test_pubsub_38.c -- testing path mtu notifications for publishers */
+#include <unserding.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NMSG			(8U)
+/* the minimum mtu for ipv6 */
+#define MIN_MTU			(1280)
+
+/* two of these fit a packet for 1400 octets or more, one for 1280 */
+static uint8_t buf[640U];
+static uint8_t big[1300U];
+
+int
+main(void)
+{
+	ud_sock_t p;
+	ud_sock_t s;
+	struct ud_msg_s msg[1];
+	struct ud_auxmsg_s aux[1];
+	struct pollfd fds[1];
+	const struct sockaddr *dst;
+	const int mtu = MIN_MTU;
+	size_t n = 0U;
+	size_t npkt = 0U;
+	uint16_t pno = 0U;
+	int res = 0;
+
+	if ((p = ud_socket((struct ud_sockopt_s){UD_PUB})) == NULL) {
+		perror("cannot initialise publisher");
+		return 1;
+	} else if ((s = ud_socket((struct ud_sockopt_s){UD_SUB})) == NULL) {
+		perror("cannot initialise subscriber");
+		ud_close(p);
+		return 1;
+	} else if ((dst = ud_socket_addr(p)) == NULL) {
+		fputs("publisher has no address\n", stderr);
+		res = 1;
+		goto fuck;
+	}
+
+	/* shrink the path, a datagram too big for it leaves a notification
+	 * behind, the kernel doesn't tell otherwise */
+	if (setsockopt(p->fd, IPPROTO_IPV6, IPV6_MTU, &mtu, sizeof(mtu)) < 0) {
+		perror("cannot shrink mtu");
+		res = 1;
+		goto fuck;
+	} else if (sendto(p->fd, big, sizeof(big), 0,
+			  dst, sizeof(struct sockaddr_in6)) >= 0) {
+		fputs("mtu didn't shrink, test inconclusive\n", stderr);
+		goto fuck;
+	} else if (errno != EMSGSIZE) {
+		perror("cannot probe path mtu");
+		res = 1;
+		goto fuck;
+	}
+	/* which the next flush picks up */
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush");
+		res = 1;
+		goto fuck;
+	}
+
+	/* packets sized for the old mtu would have to be fragmented */
+	for (size_t i = 0; i < NMSG; i++) {
+		buf[0U] = (uint8_t)i;
+		if (ud_pack_msg(p, (struct ud_msg_s){
+				       .svc = 0xffff/*TEST SERVICE*/,
+				       .data = buf,
+				       .dlen = sizeof(buf),
+			       }) < 0) {
+			perror("couldn't pack message");
+			res = 1;
+			goto fuck;
+		}
+	}
+	if (ud_flush(p) < 0) {
+		perror("couldn't flush messages");
+		res = 1;
+		goto fuck;
+	}
+
+	fds->fd = s->fd;
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		while (ud_chck_msg(msg, s) >= 0) {
+			if (ud_get_aux(aux, s) == 0 &&
+			    (!n || aux->pno != pno)) {
+				pno = aux->pno;
+				npkt++;
+			}
+			if (msg->dlen != sizeof(buf) ||
+			    *(const uint8_t*)msg->data != n++) {
+				fputs("message b0rked\n", stderr);
+				res = 1;
+			}
+		}
+	}
+	if (n != NMSG) {
+		fprintf(stderr, "%zu out of %u messages\n", n, NMSG);
+		res = 1;
+	} else if (npkt != NMSG) {
+		fprintf(stderr, "%zu packets, mtu didn't shrink\n", npkt);
+		res = 1;
+	}
+
+fuck:
+	res -= ud_close(s);
+	res -= ud_close(p);
+	return res;
+}
+
+/* test_pubsub_38.c ends here */
@@ -0,0 +1,122 @@
+/*** test_pubsub_39.c -- testing the tlv indexer against the tlv walk */
+#include <unserding.h>
+#include <ud-tlv.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define countof(x)		(sizeof(x) / sizeof(*(x)))
+
+#define NROUND			(20000U)
+
+static uint8_t pkt[9000U];
+static uint16_t off[9000U / 2U];
+static uint16_t ref[9000U / 2U];
+
+static uint32_t
+rnd(void)
+{
+/* xorshift, deterministic so failures can be replayed */
+	static uint32_t x = 2463534242U;
+
+	x ^= x << 13U;
+	x ^= x >> 17U;
+	x ^= x << 5U;
+	return x;
+}
+
+static size_t
+fill(size_t z)
+{
+/* pack Z octets with tlvs of all types, mostly short ones */
+	size_t i = 0U;
+
+	while (i + 2U <= z) {
+		uint8_t t = (uint8_t)(0x0cU | rnd() % 4U);
+		size_t hz = 2U + 2U * (t & 1U);
+		size_t dz = rnd() % 8U ? rnd() % 24U : rnd() % 1200U;
+
+		if (i + hz + dz > z) {
+			break;
+		}
+		pkt[i + 0U] = (uint8_t)(t | ((dz >> 8U) << 4U));
+		pkt[i + 1U] = (uint8_t)(dz & 0xffU);
+		memset(pkt + i + 2U, (int)rnd(), hz - 2U + dz);
+		i += hz + dz;
+	}
+	return i;
+}
+
+static int
+check(size_t z, size_t n)
+{
+	size_t nr = ud_tlv_index_sw(ref, n, pkt, z);
+	size_t nx = ud_tlv_index(off, n, pkt, z);
+
+	if (nx != nr) {
+		fprintf(stderr, "%zu tlvs indexed, %zu walked\n", nx, nr);
+		return -1;
+	} else if (memcmp(off, ref, nr * sizeof(*ref))) {
+		fputs("offsets b0rked\n", stderr);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	int res = 0;
+
+	/* nothing to index */
+	if (ud_tlv_index(off, countof(off), pkt, 0U) ||
+	    ud_tlv_index(off, countof(off), pkt, 1U)) {
+		fputs("tlvs in empty payload\n", stderr);
+		return 1;
+	}
+
+	for (size_t i = 0; i < NROUND && !res; i++) {
+		size_t z = fill(rnd() % 2U ? 1400U : sizeof(pkt));
+
+		switch (rnd() % 4U) {
+		case 0:
+			/* garbage in the middle, stops both */
+			pkt[rnd() % (z + 1U)] = (uint8_t)rnd();
+			break;
+		case 1:
+			/* cut short, the last tlv exceeds the payload */
+			z -= z ? rnd() % (z < 64U ? z : 64U) : 0U;
+			break;
+		default:
+			break;
+		}
+		res = check(z, countof(off)) < 0;
+		/* and with too little room for them all */
+		res = res || check(z, rnd() % 64U) < 0;
+	}
+
+	/* tlvs of 16 octets and more are walked over, 15 and less are
+	 * hopped through by table, alternate them */
+	{
+		size_t i = 0U;
+		size_t n = 0U;
+
+		for (; i + 18U + 2U + 13U <= sizeof(pkt); n += 2U) {
+			pkt[i++] = 0x0cU;
+			pkt[i++] = 16U;
+			i += 16U;
+			pkt[i++] = 0x0cU;
+			pkt[i++] = 13U;
+			i += 13U;
+		}
+		if (ud_tlv_index(off, countof(off), pkt, i) != n) {
+			fputs("mixed tlvs b0rked\n", stderr);
+			res = 1;
+		} else if (check(i, countof(off)) < 0) {
+			res = 1;
+		}
+	}
+	return res;
+}
+
+/* test_pubsub_39.c ends here */
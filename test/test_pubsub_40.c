@@ -0,0 +1,247 @@
+/*** test_pubsub_40.c -- testing the capture ring's frame dissection */
+#if defined HAVE_CONFIG_H
+# include "config.h"
+#endif	/* HAVE_CONFIG_H */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+/* the capture code isn't part of the lib, take it in whole,
+ * along with the link layer headers */
+#include <ud-tpacket.c>
+
+#if defined HAVE_LINUX_IF_PACKET_H
+#define SRC_PORT		(8641U)
+#define DST_PORT		(8653U)
+
+static const char secret[] = "JUST A PLAIN STRING";
+
+static uint8_t frm[256U];
+
+static size_t
+mk(const uint8_t *nxt, size_t nnxt, size_t extz, size_t ulen)
+{
+/* ipv6 header, NNXT extension headers of EXTZ octets each of the
+ * types in NXT, then a udp header of length ULEN and the secret */
+	size_t off = 40U;
+
+	memset(frm, 0, sizeof(frm));
+	frm[0U] = 0x60U;
+	frm[6U] = nnxt ? nxt[0U] : IPPROTO_UDP;
+	frm[7U] = 64U;
+	/* fd00::1 to fd00::2 */
+	frm[8U] = 0xfdU;
+	frm[23U] = 0x01U;
+	frm[24U] = 0xfdU;
+	frm[39U] = 0x02U;
+	for (size_t i = 0; i < nnxt; off += extz, i++) {
+		frm[off + 0U] = i + 1U < nnxt ? nxt[i + 1U] : IPPROTO_UDP;
+		frm[off + 1U] = (uint8_t)(extz / 8U - 1U);
+	}
+	frm[off + 0U] = SRC_PORT >> 8U;
+	frm[off + 1U] = SRC_PORT & 0xffU;
+	frm[off + 2U] = DST_PORT >> 8U;
+	frm[off + 3U] = DST_PORT & 0xffU;
+	frm[off + 4U] = (uint8_t)(ulen >> 8U);
+	frm[off + 5U] = (uint8_t)(ulen & 0xffU);
+	memcpy(frm + off + 8U, secret, sizeof(secret));
+	off += 8U + sizeof(secret);
+	frm[4U] = (uint8_t)((off - 40U) >> 8U);
+	frm[5U] = (uint8_t)((off - 40U) & 0xffU);
+	return off;
+}
+
+static int
+chck(const struct ud_tpkt_frm_s *f, size_t plz)
+{
+	static const uint8_t src[16U] = {0xfdU, [15U] = 0x01U};
+	static const uint8_t dst[16U] = {0xfdU, [15U] = 0x02U};
+
+	if (f->src.sin6_port != htons(SRC_PORT) ||
+	    f->dst.sin6_port != htons(DST_PORT)) {
+		fputs("ports b0rked\n", stderr);
+		return -1;
+	} else if (memcmp(&f->src.sin6_addr, src, sizeof(src)) ||
+		   memcmp(&f->dst.sin6_addr, dst, sizeof(dst))) {
+		fputs("addresses b0rked\n", stderr);
+		return -1;
+	} else if (f->plz != plz || memcmp(f->pl, secret, plz)) {
+		fprintf(stderr, "payload of %zu b0rked\n", f->plz);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+dissect(void)
+{
+	struct sockaddr_ll in = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_IPV6),
+		.sll_hatype = ARPHRD_LOOPBACK,
+		.sll_pkttype = PACKET_HOST,
+	};
+	struct sockaddr_ll sll;
+	struct ud_tpkt_frm_s f;
+	const size_t ulen = 8U + sizeof(secret);
+	const uint8_t ext[] = {IPPROTO_HOPOPTS, IPPROTO_DSTOPTS};
+	const uint8_t frag[] = {IPPROTO_FRAGMENT};
+	size_t z;
+
+	z = mk(NULL, 0U, 0U, ulen);
+	if (ud_tpkt_dissect(&f, &in, frm, z) < 0 || chck(&f, ulen - 8U) < 0) {
+		fputs("plain datagram not dissected\n", stderr);
+		return -1;
+	}
+	/* looped back on the way out, comes again on the way in */
+	sll = in;
+	sll.sll_pkttype = PACKET_OUTGOING;
+	if (ud_tpkt_dissect(&f, &sll, frm, z) >= 0) {
+		fputs("outgoing loopback frame taken\n", stderr);
+		return -1;
+	}
+	/* but on real links that's all we'll see */
+	sll.sll_hatype = ARPHRD_ETHER;
+	if (ud_tpkt_dissect(&f, &sll, frm, z) < 0 || chck(&f, ulen - 8U) < 0) {
+		fputs("outgoing ethernet frame not dissected\n", stderr);
+		return -1;
+	}
+	sll = in;
+	sll.sll_protocol = htons(ETH_P_IP);
+	if (ud_tpkt_dissect(&f, &sll, frm, z) >= 0) {
+		fputs("ipv4 frame taken\n", stderr);
+		return -1;
+	}
+	frm[0U] = 0x40U;
+	if (ud_tpkt_dissect(&f, &in, frm, z) >= 0) {
+		fputs("ipv4 header taken\n", stderr);
+		return -1;
+	}
+
+	/* extension headers, of 16 octets each */
+	z = mk(ext, countof(ext), 16U, ulen);
+	if (ud_tpkt_dissect(&f, &in, frm, z) < 0 || chck(&f, ulen - 8U) < 0) {
+		fputs("extension headers not skipped\n", stderr);
+		return -1;
+	} else if (ud_tpkt_dissect(&f, &in, frm, 40U + 16U + 4U) >= 0) {
+		fputs("truncated extension header taken\n", stderr);
+		return -1;
+	}
+	z = mk(frag, countof(frag), 8U, ulen);
+	if (ud_tpkt_dissect(&f, &in, frm, z) >= 0) {
+		fputs("fragment taken\n", stderr);
+		return -1;
+	}
+
+	/* cut short */
+	z = mk(NULL, 0U, 0U, ulen);
+	if (ud_tpkt_dissect(&f, &in, frm, 39U) >= 0) {
+		fputs("truncated ipv6 header taken\n", stderr);
+		return -1;
+	} else if (ud_tpkt_dissect(&f, &in, frm, 40U + 7U) >= 0) {
+		fputs("truncated udp header taken\n", stderr);
+		return -1;
+	} else if (ud_tpkt_dissect(&f, &in, frm, z - 1U) >= 0) {
+		fputs("truncated payload taken\n", stderr);
+		return -1;
+	}
+
+	/* udp lengths */
+	z = mk(NULL, 0U, 0U, 7U);
+	if (ud_tpkt_dissect(&f, &in, frm, z) >= 0) {
+		fputs("udp length under header size taken\n", stderr);
+		return -1;
+	}
+	z = mk(NULL, 0U, 0U, ulen + 1U);
+	if (ud_tpkt_dissect(&f, &in, frm, z) >= 0) {
+		fputs("udp length past frame taken\n", stderr);
+		return -1;
+	}
+	/* trailing octets aren't the payload's */
+	z = mk(NULL, 0U, 0U, ulen - 4U);
+	if (ud_tpkt_dissect(&f, &in, frm, z) < 0 || chck(&f, ulen - 12U) < 0) {
+		fputs("short udp length not honoured\n", stderr);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+on_frm(const struct ud_tpkt_frm_s *f, void *clo)
+{
+	size_t *n = clo;
+
+	if (f->dst.sin6_port == htons(DST_PORT) &&
+	    f->plz == sizeof(secret) && !memcmp(f->pl, secret, f->plz)) {
+		(*n)++;
+	}
+	return;
+}
+
+static int
+capture(void)
+{
+/* see our own datagram to ::1 in the ring, once */
+	struct sockaddr_in6 dst = {
+		.sin6_family = AF_INET6,
+		.sin6_port = htons(DST_PORT),
+		.sin6_addr = IN6ADDR_LOOPBACK_INIT,
+	};
+	struct pollfd fds[1];
+	ud_tpkt_t t;
+	size_t n = 0U;
+	int s;
+
+	if ((t = ud_tpkt_open("lo")) == NULL) {
+		/* no CAP_NET_RAW, nothing to see */
+		perror("cannot open capture ring, skipping");
+		return 0;
+	} else if ((s = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) {
+		perror("cannot open socket");
+		ud_tpkt_close(t);
+		return -1;
+	}
+	(void)sendto(s, secret, sizeof(secret), 0,
+		     (const void*)&dst, sizeof(dst));
+	fds->fd = ud_tpkt_fd(t);
+	fds->events = POLLIN;
+	while (poll(fds, countof(fds), 200) > 0) {
+		(void)ud_tpkt_walk(t, on_frm, &n);
+	}
+	close(s);
+	ud_tpkt_close(t);
+
+	if (n != 1U) {
+		fprintf(stderr, "datagram captured %zu times\n", n);
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	int res = 0;
+
+	if (dissect() < 0) {
+		res = 1;
+	}
+	if (capture() < 0) {
+		res = 1;
+	}
+	return res;
+}
+#else  /* !HAVE_LINUX_IF_PACKET_H */
+int
+main(void)
+{
+	/* no packet sockets, nothing to test */
+	return 0;
+}
+#endif	/* HAVE_LINUX_IF_PACKET_H */
+
+/* test_pubsub_40.c ends here */